@@ -22,12 +22,17 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 
 #include "app.h"
 #include "bookmarks.h"
+#include "cachemanager.h"
+#include "contentindex.h"
 #include "defs.h"
 #include "embedded.h"
 #include "feeds.h"
 #include "mimehooks.h"
+#include "pagecache.h"
+#include "statejournal.h"
 #include "gmcerts.h"
 #include "gmdocument.h"
+#include "gmrequest.h"
 #include "gmutil.h"
 #include "history.h"
 #include "ui/certimportwidget.h"
@@ -43,6 +48,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 #include "ui/window.h"
 #include "visited.h"
 
+#include <the_Foundation/buffer.h>
 #include <the_Foundation/commandline.h>
 #include <the_Foundation/file.h>
 #include <the_Foundation/fileinfo.h>
@@ -96,6 +102,7 @@ static const char *stateFileName_App_      = "state.lgr";
 static const char *defaultDownloadDir_App_ = "~/Downloads";
 
 static const int idleThreshold_App_ = 1000; /* ms */
+static const int checkpointInterval_App_ = 10000; /* ms */
 
 struct Impl_App {
     iCommandLine args;
@@ -104,6 +111,8 @@ struct Impl_App {
     iGmCerts *   certs;
     iVisited *   visited;
     iBookmarks * bookmarks;
+    iStateJournal *journal;
+    int          checkpointTimer;
     iWindow *    window;
     iSortedArray tickers;
     uint32_t     lastTickerTime;
@@ -195,6 +204,8 @@ static iString *serializePrefs_App_(const iApp *d) {
     appendFormat_String(str, "smoothscroll arg:%d\n", d->prefs.smoothScrolling);
     appendFormat_String(str, "imageloadscroll arg:%d\n", d->prefs.loadImageInsteadOfScrolling);
     appendFormat_String(str, "cachesize.set arg:%d\n", d->prefs.maxCacheSize);
+    appendFormat_String(str, "prefetch.set arg:%d\n", d->prefs.prefetchLinks);
+    appendFormat_String(str, "feedrequests.set arg:%d\n", d->prefs.maxFeedRequests);
     appendFormat_String(str, "decodeurls arg:%d\n", d->prefs.decodeUserVisibleURLs);
     appendFormat_String(str, "linewidth.set arg:%d\n", d->prefs.lineWidth);
     appendFormat_String(str, "prefs.biglede.changed arg:%d\n", d->prefs.bigFirstParagraph);
@@ -293,8 +304,42 @@ static void savePrefs_App_(const iApp *d) {
 static const char *magicState_App_       = "lgL1";
 static const char *magicTabDocument_App_ = "tabd";
 
+static iBool restoreState_App_(iApp *d) {
+    iPtrArray states;
+    size_t    current = 0;
+    uint32_t  version = 0;
+    init_PtrArray(&states);
+    const iBool ok = restore_StateJournal(d->journal, &states, &current, &version) &&
+                     !isEmpty_PtrArray(&states);
+    iDocumentWidget *doc = document_App();
+    iDocumentWidget *currentDoc = NULL;
+    iConstForEach(PtrArray, i, &states) {
+        if (!doc) {
+            doc = newTab_App(NULL, iTrue);
+        }
+        if (index_PtrArrayConstIterator(&i) == current) {
+            currentDoc = doc;
+        }
+        iBuffer *buf = new_Buffer();
+        open_Buffer(buf, i.ptr);
+        setVersion_Stream(stream_Buffer(buf), version);
+        deserializeState_DocumentWidget(doc, stream_Buffer(buf));
+        iRelease(buf);
+        delete_Block(i.ptr);
+        doc = NULL;
+    }
+    deinit_PtrArray(&states);
+    if (ok) {
+        postCommandf_App("tabs.switch page:%p", currentDoc);
+    }
+    return ok;
+}
+
 static iBool loadState_App_(iApp *d) {
-    iUnused(d);
+    if (restoreState_App_(d)) {
+        return iTrue;
+    }
+    /* State saved by an older version. */
     const char *oldPath = concatPath_CStr(dataDir_App_(), oldStateFileName_App_);
     const char *path    = concatPath_CStr(dataDir_App_(), stateFileName_App_);
     iFile *f = iClob(newCStr_File(fileExistsCStr_FileInfo(path) ? path : oldPath));
@@ -306,8 +351,8 @@ static iBool loadState_App_(iApp *d) {
             return iFalse;
         }
         const uint32_t version = readU32_File(f);
-        /* Check supported versions. */
-        if (version > latest_FileVersion) {
+        /* Check supported versions. Newer files are read from the state journal. */
+        if (version >= addedStateJournal_FileVersion) {
             printf("%s: unsupported version\n", cstr_String(path_File(f)));
             return iFalse;
         }
@@ -348,21 +393,45 @@ iObjectList *listDocuments_App(void) {
     return docs;
 }
 
-static void saveState_App_(const iApp *d) {
-    iUnused(d);
-    trimCache_App();
-    iFile *f = newCStr_File(concatPath_CStr(dataDir_App_(), stateFileName_App_));
-    if (open_File(f, writeOnly_FileMode)) {
-        writeData_File(f, magicState_App_, 4);
-        writeU32_File(f, latest_FileVersion); /* version */
-        iConstForEach(ObjectList, i, iClob(listDocuments_App())) {
-            iAssert(isInstance_Object(i.object, &Class_DocumentWidget));
-            writeData_File(f, magicTabDocument_App_, 4);
-            write8_File(f, document_App() == i.object ? 1 : 0);
-            serializeState_DocumentWidget(i.object, stream_File(f));
+static void checkpointState_App_(iApp *d, iBool compact) {
+    /* Only tabs that have been modified since the previous checkpoint are serialized, unless
+       compacting: then every tab is, so all of their cached bodies are marked as used. */
+    compact |= isCompactionDue_StateJournal(d->journal);
+    const iObjectList *docs = iClob(listDocuments_App());
+    iStringArray *ids = iClob(new_StringArray());
+    size_t current = 0;
+    iConstForEach(ObjectList, i, docs) {
+        iAssert(isInstance_Object(i.object, &Class_DocumentWidget));
+        if (document_App() == i.object) {
+            current = size_StringArray(ids);
         }
+        pushBack_StringArray(ids, id_Widget(constAs_Widget(i.object)));
+    }
+    setTabs_StateJournal(d->journal, ids, current);
+    iConstForEach(ObjectList, j, docs) {
+        const iString *id       = id_Widget(constAs_Widget(j.object));
+        const uint32_t modCount = modCount_DocumentWidget(j.object);
+        if (!compact && !isModified_StateJournal(d->journal, id, modCount)) {
+            continue;
+        }
+        iBuffer *buf = new_Buffer();
+        openEmpty_Buffer(buf);
+        serializeState_DocumentWidget(j.object, stream_Buffer(buf));
+        update_StateJournal(d->journal, id, modCount, data_Buffer(buf));
+        iRelease(buf);
     }
-    iRelease(f);
+    commit_StateJournal(d->journal, compact);
+}
+
+static uint32_t postCheckpoint_App_(uint32_t interval, void *param) {
+    iUnused(param);
+    postCommand_App("state.checkpoint");
+    return interval;
+}
+
+static void saveState_App_(iApp *d) {
+    trim_CacheManager();
+    checkpointState_App_(d, iTrue); /* unreferenced page bodies are removed once written */
 }
 
 #if defined (LAGRANGE_IDLE_SLEEP)
@@ -420,8 +489,15 @@ static void init_App_(iApp *d, int argc, char **argv) {
     set_Atomic(&d->pendingRefresh, iFalse);
     d->mimehooks         = new_MimeHooks();
     d->certs             = new_GmCerts(dataDir_App_());
+    init_GmRequestScheduler();
+    init_PageCache(dataDir_App_());
+    init_CacheManager(d->prefs.maxCacheSize * 1000000);
+    init_ContentIndex();
+    init_SharedBodies();
+    init_HistoryCompressor();
     d->visited           = new_Visited();
     d->bookmarks         = new_Bookmarks();
+    d->journal           = new_StateJournal(dataDir_App_());
     d->tabEnum           = 0; /* generates unique IDs for tab pages */
     setThemePalette_Color(d->prefs.theme);
 #if defined (LAGRANGE_IDLE_SLEEP)
@@ -434,6 +510,8 @@ static void init_App_(iApp *d, int argc, char **argv) {
 #endif
     init_Keys();
     loadPrefs_App_(d);
+    /* The saved preferences may or may not have set the cache size. */
+    setLimit_CacheManager(d->prefs.maxCacheSize * 1000000);
     load_Keys(dataDir_App_());
     load_Visited(d->visited, dataDir_App_());
     load_Bookmarks(d->bookmarks, dataDir_App_());
@@ -469,6 +547,9 @@ static void init_App_(iApp *d, int argc, char **argv) {
     if (!loadState_App_(d)) {
         postCommand_App("navigate.home");
     }
+    /* Start a fresh journal based on the restored tabs. */
+    checkpointState_App_(d, iTrue);
+    d->checkpointTimer = SDL_AddTimer(checkpointInterval_App_, postCheckpoint_App_, d);
     postCommand_App("window.unfreeze");
     d->isFinishedLaunching = iTrue;
     /* Run any commands that were pending completion of launch. */ {
@@ -496,7 +577,9 @@ static void init_App_(iApp *d, int argc, char **argv) {
 }
 
 static void deinit_App(iApp *d) {
+    SDL_RemoveTimer(d->checkpointTimer);
     saveState_App_(d);
+    delete_StateJournal(d->journal); /* waits until the journal has been written */
     deinit_Feeds();
     save_Keys(dataDir_App_());
     deinit_Keys();
@@ -512,6 +595,12 @@ static void deinit_App(iApp *d) {
     deinit_SortedArray(&d->tickers);
     delete_Window(d->window);
     d->window = NULL;
+    deinit_HistoryCompressor();
+    deinit_SharedBodies();
+    deinit_GmRequestScheduler();
+    deinit_PageCache();
+    deinit_CacheManager();
+    deinit_ContentIndex();
     deinit_CommandLine(&d->args);
     iRelease(d->launchCommands);
     delete_String(d->execPath);
@@ -536,6 +625,7 @@ const iString *debugInfo_App(void) {
     iString *msg = collectNew_String();
     format_String(msg, "# Debug information\n");
     appendFormat_String(msg, "## Documents\n");
+    appendFormat_String(msg, "Cached in memory: %.3f MB\n", size_CacheManager() / 1.0e6f);
     iForEach(ObjectList, k, iClob(listDocuments_App())) {
         iDocumentWidget *doc = k.object;
         appendFormat_String(msg, "### Tab %zu: %s\n",
@@ -556,6 +646,8 @@ const iString *debugInfo_App(void) {
     iConstForEach(StringList, j, d->launchCommands) {
         appendFormat_String(msg, "%s\n", cstr_String(j.value));
     }
+    appendFormat_String(msg, "## Request queue\n");
+    append_String(msg, collect_String(debugInfo_GmRequestScheduler()));
     appendFormat_String(msg, "## MIME hooks\n");
     append_String(msg, debugInfo_MimeHooks(d->mimehooks));
     return msg;
@@ -582,6 +674,9 @@ void processEvents_App(enum iAppEventMode eventMode) {
             case SDL_QUIT:
                 d->isRunning = iFalse;
                 goto backToMainLoop;
+            case SDL_APP_LOWMEMORY:
+                flush_CacheManager();
+                break;
             case SDL_DROPFILE: {
                 iBool wasUsed = processEvent_Window(d->window, &ev);
                 if (!wasUsed) {
@@ -899,6 +994,10 @@ static iBool handlePrefsCommands_(iWidget *d, const char *cmd) {
                          isSelected_Widget(findChild_Widget(d, "prefs.decodeurls")));
         postCommandf_App("cachesize.set arg:%d",
                          toInt_String(text_InputWidget(findChild_Widget(d, "prefs.cachesize"))));
+        postCommandf_App("prefetch.set arg:%d",
+                         toInt_String(text_InputWidget(findChild_Widget(d, "prefs.prefetch"))));
+        postCommandf_App("feedrequests.set arg:%d",
+                         toInt_String(text_InputWidget(findChild_Widget(d, "prefs.feedrequests"))));
         postCommandf_App("proxy.gemini address:%s",
                          cstr_String(text_InputWidget(findChild_Widget(d, "prefs.proxy.gemini"))));
         postCommandf_App("proxy.gopher address:%s",
@@ -982,33 +1081,6 @@ iDocumentWidget *newTab_App(const iDocumentWidget *duplicateOf, iBool switchToNe
     return doc;
 }
 
-void trimCache_App(void) {
-    iApp *d = &app_;
-    size_t cacheSize = 0;
-    const size_t limit = d->prefs.maxCacheSize * 1000000;
-    iObjectList *docs = listDocuments_App();
-    iForEach(ObjectList, i, docs) {
-        cacheSize += cacheSize_History(history_DocumentWidget(i.object));
-    }
-    init_ObjectListIterator(&i, docs);
-    iBool wasPruned = iFalse;
-    while (cacheSize > limit) {
-        iDocumentWidget *doc = i.object;
-        const size_t pruned = pruneLeastImportant_History(history_DocumentWidget(doc));
-        if (pruned) {
-            cacheSize -= pruned;
-            wasPruned = iTrue;
-        }
-        next_ObjectListIterator(&i);
-        if (!i.value) {
-            if (!wasPruned) break;
-            wasPruned = iFalse;
-            init_ObjectListIterator(&i, docs);
-        }
-    }
-    iRelease(docs);
-}
-
 static iBool handleIdentityCreationCommands_(iWidget *dlg, const char *cmd) {
     iApp *d = &app_;
     if (equal_Command(cmd, "ident.temp.changed")) {
@@ -1236,6 +1308,25 @@ iBool handleCommand_App(const char *cmd) {
         if (d->prefs.maxCacheSize <= 0) {
             d->prefs.maxCacheSize = 0;
         }
+        setLimit_CacheManager(d->prefs.maxCacheSize * 1000000);
+        return iTrue;
+    }
+    else if (equal_Command(cmd, "state.checkpoint")) {
+        if (d->isFinishedLaunching) {
+            checkpointState_App_(d, iFalse);
+        }
+        return iTrue;
+    }
+    else if (equal_Command(cmd, "cache.trim")) {
+        trim_CacheManager();
+        return iTrue;
+    }
+    else if (equal_Command(cmd, "prefetch.set")) {
+        d->prefs.prefetchLinks = iClamp(arg_Command(cmd), 0, 10);
+        return iTrue;
+    }
+    else if (equal_Command(cmd, "feedrequests.set")) {
+        d->prefs.maxFeedRequests = iClamp(arg_Command(cmd), 1, 8);
         return iTrue;
     }
     else if (equal_Command(cmd, "proxy.gemini")) {
@@ -1417,6 +1508,10 @@ iBool handleCommand_App(const char *cmd) {
             iTrue);
         setText_InputWidget(findChild_Widget(dlg, "prefs.cachesize"),
                             collectNewFormat_String("%d", d->prefs.maxCacheSize));
+        setText_InputWidget(findChild_Widget(dlg, "prefs.prefetch"),
+                            collectNewFormat_String("%d", d->prefs.prefetchLinks));
+        setText_InputWidget(findChild_Widget(dlg, "prefs.feedrequests"),
+                            collectNewFormat_String("%d", d->prefs.maxFeedRequests));
         setToggle_Widget(findChild_Widget(dlg, "prefs.decodeurls"), d->prefs.decodeUserVisibleURLs);
         setText_InputWidget(findChild_Widget(dlg, "prefs.proxy.gemini"), &d->prefs.geminiProxy);
         setText_InputWidget(findChild_Widget(dlg, "prefs.proxy.gopher"), &d->prefs.gopherProxy);
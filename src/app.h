@@ -68,7 +68,6 @@ iMimeHooks *        mimeHooks_App       (void);
 iDocumentWidget *   document_App        (void);
 iObjectList *       listDocuments_App   (void);
 iDocumentWidget *   newTab_App          (const iDocumentWidget *duplicateOf, iBool switchToNew);
-void                trimCache_App       (void);
 
 const iPrefs *      prefs_App           (void);
 iBool               forceSoftwareRender_App(void);
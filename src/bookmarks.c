@@ -25,12 +25,15 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 #include "gmrequest.h"
 #include "app.h"
 
+#include <the_Foundation/atomic.h>
 #include <the_Foundation/file.h>
 #include <the_Foundation/hash.h>
+#include <the_Foundation/intset.h>
 #include <the_Foundation/mutex.h>
 #include <the_Foundation/path.h>
 #include <the_Foundation/regexp.h>
-#include <the_Foundation/stringset.h>
+#include <the_Foundation/sortedarray.h>
+#include <the_Foundation/stringlist.h>
 
 void init_Bookmark(iBookmark *d) {
     init_String(&d->url);
@@ -81,13 +84,114 @@ static int cmpTitleAscending_Bookmark_(const iBookmark **a, const iBookmark **b)
 
 /*----------------------------------------------------------------------------------------------*/
 
-static const char *fileName_Bookmarks_ = "bookmarks.txt";
+static const char *fileName_Bookmarks_          = "bookmarks.txt";
+static const int   minRefetchSeconds_Bookmarks_ = 60;
+
+iDeclareType(RemoteSource)
+iDeclareType(RemoteFetch)
+iDeclareTypeConstruction(RemoteFetch)
+
+/* Result of the latest successful fetch of a remote bookmark source. */
+struct Impl_RemoteSource {
+    iHashNode node; /* source bookmark ID */
+    iBool     hasContent;
+    uint32_t  contentHash;
+    iTime     lastFetched;
+};
+
+/* A remote source being fetched. The links are parsed in the request's thread, and only
+   if the content has changed. */
+struct Impl_RemoteFetch {
+    uint32_t     sourceId;
+    iBool        hasKnownHash;
+    uint32_t     knownHash;
+    iBool        isValid;
+    uint32_t     contentHash;
+    iStringList *urls;
+    iStringList *titles;
+};
+
+static void init_RemoteFetch(iRemoteFetch *d) {
+    d->sourceId     = 0;
+    d->hasKnownHash = iFalse;
+    d->knownHash    = 0;
+    d->isValid      = iFalse;
+    d->contentHash  = 0;
+    d->urls         = new_StringList();
+    d->titles       = new_StringList();
+}
+
+static void deinit_RemoteFetch(iRemoteFetch *d) {
+    iRelease(d->titles);
+    iRelease(d->urls);
+}
+
+iDefineTypeConstruction(RemoteFetch)
+
+static void remoteRequestFinished_Bookmarks_(iBookmarks *d, iGmRequest *req);
+
+iDeclareType(BookmarkKey)
+iDeclareType(BookmarkTag)
+
+/* URL index entry: checksum of the URL, and the bookmark that has it. */
+struct Impl_BookmarkKey {
+    uint32_t key;
+    uint32_t id;
+};
+
+static int cmp_BookmarkKey_(const void *a, const void *b) {
+    const iBookmarkKey *x = a, *y = b;
+    const int cmp = iCmp(x->key, y->key);
+    return cmp ? cmp : iCmp(x->id, y->id);
+}
+
+/* Tag view entry. Sorted by tag, and bookmarks with the same tag by title. */
+struct Impl_BookmarkTag {
+    iString *        tag;
+    const iBookmark *bookmark; /* NULL sorts before all bookmarks with the tag */
+};
+
+static int cmpId_Bookmark_(const iBookmark **a, const iBookmark **b) {
+    return iCmp(id_Bookmark(*a), id_Bookmark(*b));
+}
+
+static int cmpTimeView_(const void *a, const void *b) {
+    const int cmp = cmpTimeDescending_Bookmark_(a, b);
+    return cmp ? cmp : cmpId_Bookmark_(a, b);
+}
+
+static int cmpTitleView_(const void *a, const void *b) {
+    const int cmp = cmpTitleAscending_Bookmark_(a, b);
+    return cmp ? cmp : cmpId_Bookmark_(a, b);
+}
+
+static int cmp_BookmarkTag_(const void *a, const void *b) {
+    const iBookmarkTag *x = a, *y = b;
+    const int cmp = cmpString_String(x->tag, y->tag);
+    if (cmp) return cmp;
+    if (!x->bookmark || !y->bookmark) {
+        return (x->bookmark != NULL) - (y->bookmark != NULL);
+    }
+    return cmpTitleView_(&x->bookmark, &y->bookmark);
+}
+
+static uint32_t urlKey_(const iString *url) {
+    /* URLs are compared case-insensitively. */
+    return crc32_Block(&collect_String(lower_String(url))->chars);
+}
 
 struct Impl_Bookmarks {
-    iMutex *  mtx;
-    int       idEnum;
-    iHash     bookmarks; /* bookmark ID is the hash key */
-    iPtrArray remoteRequests;
+    iMutex *     mtx;
+    int          idEnum;
+    iAtomicInt   generation; /* read without locking */
+    iHash        bookmarks; /* bookmark ID is the hash key */
+    iSortedArray urlIndex;  /* iBookmarkKey */
+    iSortedArray timeView;  /* const iBookmark *, newest first */
+    iSortedArray titleView; /* const iBookmark * */
+    iSortedArray tagView;   /* iBookmarkTag, one for each space-separated tag */
+    iHash        remoteSources; /* iRemoteSource */
+    iPtrArray    remoteRequests;
+    iBool        isRemoteChanged;
 };
 
 iDefineTypeConstruction(Bookmarks)
@@ -95,29 +199,112 @@ iDefineTypeConstruction(Bookmarks)
 void init_Bookmarks(iBookmarks *d) {
     d->mtx = new_Mutex();
     d->idEnum = 0;
+    set_Atomic(&d->generation, 1);
     init_Hash(&d->bookmarks);
+    init_SortedArray(&d->urlIndex, sizeof(iBookmarkKey), cmp_BookmarkKey_);
+    init_SortedArray(&d->timeView, sizeof(const iBookmark *), cmpTimeView_);
+    init_SortedArray(&d->titleView, sizeof(const iBookmark *), cmpTitleView_);
+    init_SortedArray(&d->tagView, sizeof(iBookmarkTag), cmp_BookmarkTag_);
+    init_Hash(&d->remoteSources);
     init_PtrArray(&d->remoteRequests);
+    d->isRemoteChanged = iFalse;
 }
 
 void deinit_Bookmarks(iBookmarks *d) {
     iForEach(PtrArray, i, &d->remoteRequests) {
+        iRemoteFetch *fetch = userData_Object(i.ptr);
+        iDisconnect(GmRequest, i.ptr, finished, d, remoteRequestFinished_Bookmarks_);
         cancel_GmRequest(i.ptr);
-        free(userData_Object(i.ptr));
+        /* The finished callback may be running right now. Deleting the request waits for
+           its thread, and only then is the fetch no longer used. */
         iRelease(i.ptr);
+        delete_RemoteFetch(fetch);
     }
     deinit_PtrArray(&d->remoteRequests);
     clear_Bookmarks(d);
+    deinit_Hash(&d->remoteSources);
+    deinit_SortedArray(&d->tagView);
+    deinit_SortedArray(&d->titleView);
+    deinit_SortedArray(&d->timeView);
+    deinit_SortedArray(&d->urlIndex);
     deinit_Hash(&d->bookmarks);
     delete_Mutex(d->mtx);
 }
 
+static void index_Bookmarks_(iBookmarks *d, const iBookmark *bm) {
+    insert_SortedArray(&d->urlIndex,
+                       &(iBookmarkKey){ .key = urlKey_(&bm->url), .id = id_Bookmark(bm) });
+    insert_SortedArray(&d->timeView, &bm);
+    insert_SortedArray(&d->titleView, &bm);
+    iRangecc tag = iNullRange;
+    while (nextSplit_Rangecc(range_String(&bm->tags), " ", &tag)) {
+        if (!isEmpty_Range(&tag)) {
+            iBookmarkTag entry = { .tag = newRange_String(tag), .bookmark = bm };
+            size_t pos;
+            if (locate_SortedArray(&d->tagView, &entry, &pos)) {
+                delete_String(entry.tag); /* same tag repeated */
+            }
+            else {
+                insert_SortedArray(&d->tagView, &entry);
+            }
+        }
+    }
+    add_Atomic(&d->generation, 1);
+}
+
+static iBool isUnindexed_Bookmarks_(const iBookmarks *d, const iBookmark *bm,
+                                    const iBookmark *target) {
+    /* If `target` is NULL, bookmarks no longer in the hash are unindexed. */
+    return target ? bm == target : (const iBookmark *) value_Hash(&d->bookmarks, id_Bookmark(bm)) != bm;
+}
+
+static void unindex_Bookmarks_(iBookmarks *d, const iBookmark *target) {
+    /* Edited bookmarks may not be where they were sorted, so this is a linear search. */
+    iForEach(Array, i, &d->urlIndex.values) {
+        const iBookmarkKey *entry = i.value;
+        if (target ? entry->id == id_Bookmark(target) : !value_Hash(&d->bookmarks, entry->id)) {
+            remove_ArrayIterator(&i);
+        }
+    }
+    iForEach(Array, t, &d->timeView.values) {
+        if (isUnindexed_Bookmarks_(d, *(const iBookmark **) t.value, target)) {
+            remove_ArrayIterator(&t);
+        }
+    }
+    iForEach(Array, n, &d->titleView.values) {
+        if (isUnindexed_Bookmarks_(d, *(const iBookmark **) n.value, target)) {
+            remove_ArrayIterator(&n);
+        }
+    }
+    iForEach(Array, g, &d->tagView.values) {
+        iBookmarkTag *entry = g.value;
+        if (isUnindexed_Bookmarks_(d, entry->bookmark, target)) {
+            delete_String(entry->tag);
+            remove_ArrayIterator(&g);
+        }
+    }
+    add_Atomic(&d->generation, 1);
+}
+
 void clear_Bookmarks(iBookmarks *d) {
     lock_Mutex(d->mtx);
+    iForEach(Array, g, &d->tagView.values) {
+        delete_String(((iBookmarkTag *) g.value)->tag);
+    }
+    clear_SortedArray(&d->tagView);
+    clear_SortedArray(&d->titleView);
+    clear_SortedArray(&d->timeView);
+    clear_SortedArray(&d->urlIndex);
     iForEach(Hash, i, &d->bookmarks) {
         delete_Bookmark((iBookmark *) i.value);
     }
     clear_Hash(&d->bookmarks);
+    iForEach(Hash, j, &d->remoteSources) {
+        free(j.value);
+    }
+    clear_Hash(&d->remoteSources); /* IDs are reassigned */
     d->idEnum = 0;
+    add_Atomic(&d->generation, 1);
     unlock_Mutex(d->mtx);
 }
 
@@ -125,9 +312,51 @@ static void insert_Bookmarks_(iBookmarks *d, iBookmark *bookmark) {
     lock_Mutex(d->mtx);
     bookmark->node.key = ++d->idEnum;
     insert_Hash(&d->bookmarks, &bookmark->node);
+    index_Bookmarks_(d, bookmark);
     unlock_Mutex(d->mtx);
 }
 
+void update_Bookmarks(iBookmarks *d, uint32_t id, const iString *title, const iString *url,
+                      const iString *tags) {
+    lock_Mutex(d->mtx);
+    iBookmark *bm = get_Bookmarks(d, id);
+    if (bm) {
+        if (title) set_String(&bm->title, title);
+        if (url)   set_String(&bm->url, url);
+        if (tags)  set_String(&bm->tags, tags);
+        unindex_Bookmarks_(d, bm);
+        index_Bookmarks_(d, bm);
+    }
+    unlock_Mutex(d->mtx);
+}
+
+iBool toggleTag_Bookmarks(iBookmarks *d, uint32_t id, const char *tag) {
+    iBool isSet = iFalse;
+    lock_Mutex(d->mtx);
+    iBookmark *bm = get_Bookmarks(d, id);
+    if (bm) {
+        if (hasTag_Bookmark(bm, tag)) {
+            removeTag_Bookmark(bm, tag);
+        }
+        else {
+            addTag_Bookmark(bm, tag);
+            isSet = iTrue;
+        }
+        unindex_Bookmarks_(d, bm);
+        index_Bookmarks_(d, bm);
+    }
+    unlock_Mutex(d->mtx);
+    return isSet;
+}
+
+uint32_t generation_Bookmarks(const iBookmarks *d) {
+    return (uint32_t) value_Atomic(&d->generation);
+}
+
+const iPtrArray *sorted_Bookmarks(const iBookmarks *d, enum iBookmarkSortOrder order) {
+    return order == byTitle_BookmarkSortOrder ? &d->titleView.values : &d->timeView.values;
+}
+
 void load_Bookmarks(iBookmarks *d, const char *dirPath) {
     clear_Bookmarks(d);
     iFile *f = newCStr_File(concatPath_CStr(dirPath, fileName_Bookmarks_));
@@ -214,6 +443,7 @@ iBool remove_Bookmarks(iBookmarks *d, uint32_t id) {
     lock_Mutex(d->mtx);
     iBookmark *bm = (iBookmark *) remove_Hash(&d->bookmarks, id);
     if (bm) {
+        unindex_Bookmarks_(d, bm);
         delete_Bookmark(bm);
     }
     unlock_Mutex(d->mtx);
@@ -229,6 +459,7 @@ iBool updateBookmarkIcon_Bookmarks(iBookmarks *d, const iString *url, iChar icon
         if (!hasTag_Bookmark(bm, "remote")) {
             if (icon != bm->icon) {
                 bm->icon = icon;
+                add_Atomic(&d->generation, 1);
                 changed = iTrue;
             }
         }
@@ -247,30 +478,65 @@ iBool filterTagsRegExp_Bookmarks(void *regExp, const iBookmark *bm) {
     return matchString_RegExp(regExp, &bm->tags, &m);
 }
 
-static iBool matchUrl_(void *url, const iBookmark *bm) {
-    return equalCase_String(url, &bm->url);
+uint32_t findUrl_Bookmarks(const iBookmarks *d, const iString *url) {
+    const uint32_t   key   = urlKey_(url);
+    const iBookmark *found = NULL;
+    size_t pos;
+    lock_Mutex(d->mtx);
+    locate_SortedArray(&d->urlIndex, &(iBookmarkKey){ .key = key, .id = 0 }, &pos);
+    for (; pos < size_SortedArray(&d->urlIndex); pos++) {
+        const iBookmarkKey *entry = constAt_SortedArray(&d->urlIndex, pos);
+        if (entry->key != key) {
+            break;
+        }
+        const iBookmark *bm = (const iBookmark *) value_Hash(&d->bookmarks, entry->id);
+        /* The most recently created one is preferred. */
+        if (bm && equalCase_String(url, &bm->url) &&
+            (!found || cmpTimeDescending_Bookmark_(&bm, &found) < 0)) {
+            found = bm;
+        }
+    }
+    unlock_Mutex(d->mtx);
+    return found ? id_Bookmark(found) : 0;
 }
 
-uint32_t findUrl_Bookmarks(const iBookmarks *d, const iString *url) {
-    /* TODO: O(n), boo */
-    const iPtrArray *found = list_Bookmarks(d, NULL, matchUrl_, (void *) url);
-    if (isEmpty_PtrArray(found)) return 0;
-    return id_Bookmark(constFront_PtrArray(found));
+const iPtrArray *listTagged_Bookmarks(const iBookmarks *d, const char *tag,
+                                      iBookmarksCompareFunc cmp) {
+    iPtrArray *list = collectNew_PtrArray();
+    iString    tagStr;
+    size_t     pos;
+    initCStr_String(&tagStr, tag);
+    lock_Mutex(d->mtx);
+    locate_SortedArray(&d->tagView, &(iBookmarkTag){ .tag = &tagStr, .bookmark = NULL }, &pos);
+    for (; pos < size_SortedArray(&d->tagView); pos++) {
+        const iBookmarkTag *entry = constAt_SortedArray(&d->tagView, pos);
+        if (!equal_String(entry->tag, &tagStr)) {
+            break;
+        }
+        pushBack_PtrArray(list, entry->bookmark);
+    }
+    unlock_Mutex(d->mtx);
+    deinit_String(&tagStr);
+    if (!cmp) cmp = cmpTimeDescending_Bookmark_;
+    sort_Array(list, (int (*)(const void *, const void *)) cmp);
+    return list;
 }
 
 const iPtrArray *list_Bookmarks(const iBookmarks *d, iBookmarksCompareFunc cmp,
                                 iBookmarksFilterFunc filter, void *context) {
     lock_Mutex(d->mtx);
     iPtrArray *list = collectNew_PtrArray();
-    iConstForEach(Hash, i, &d->bookmarks) {
-        const iBookmark *bm = (const iBookmark *) i.value;
+    /* The time view is already in the default order. */
+    iConstForEach(PtrArray, i, &d->timeView.values) {
+        const iBookmark *bm = i.ptr;
         if (!filter || filter(context, bm)) {
             pushBack_PtrArray(list, bm);
         }
     }
     unlock_Mutex(d->mtx);
-    if (!cmp) cmp = cmpTimeDescending_Bookmark_;
-    sort_Array(list, (int (*)(const void *, const void *)) cmp);
+    if (cmp) {
+        sort_Array(list, (int (*)(const void *, const void *)) cmp);
+    }
     return list;
 }
 
@@ -295,55 +561,39 @@ const iString *bookmarkListPage_Bookmarks(const iBookmarks *d, enum iBookmarkLis
                                  "Only tagged bookmarks are listed. "
                                  "Bookmarks with multiple tags are repeated under each tag.\n\n");
     }
-    iStringSet *tags = new_StringSet();
-    const iPtrArray *bmList = list_Bookmarks(d,
-                                             listType == listByCreationTime_BookmarkListType
-                                                 ? cmpTimeDescending_Bookmark_
-                                                 : cmpTitleAscending_Bookmark_,
-                                             NULL,
-                                             NULL);
-    iConstForEach(PtrArray, i, bmList) {
-        const iBookmark *bm = i.ptr;
-        if (listType == listByFolder_BookmarkListType) {
-            appendFormat_String(str, "=> %s %s\n", cstr_String(&bm->url), cstr_String(&bm->title));
-        }
-        else if (listType == listByCreationTime_BookmarkListType) {
-            appendFormat_String(str, "=> %s %s - %s\n", cstr_String(&bm->url),
-                                cstrCollect_String(format_Time(&bm->when, "%Y-%m-%d")),
-                                cstr_String(&bm->title));
-        }
-        iRangecc tag = iNullRange;
-        while (nextSplit_Rangecc(range_String(&bm->tags), " ", &tag)) {
-            if (!isEmpty_Range(&tag)) {
-                iString t;
-                initRange_String(&t, tag);
-                insert_StringSet(tags, &t);
-                deinit_String(&t);
+    if (listType == listByTag_BookmarkListType) {
+        const iString *tag = NULL;
+        iConstForEach(Array, i, &d->tagView.values) {
+            const iBookmarkTag *entry = i.value;
+            if (!tag || !equal_String(tag, entry->tag)) {
+                tag = entry->tag;
+                appendFormat_String(str, "\n## %s\n", cstr_String(tag));
             }
+            appendFormat_String(str,
+                                "=> %s %s\n",
+                                cstr_String(&entry->bookmark->url),
+                                cstr_String(&entry->bookmark->title));
         }
     }
-    if (listType == listByTag_BookmarkListType) {
-        iConstForEach(StringSet, t, tags) {
-            const iString *tag = t.value;
-            appendFormat_String(str, "\n## %s\n", cstr_String(tag));
-            iConstForEach(PtrArray, i, bmList) {
-                const iBookmark *bm = i.ptr;
-                iRangecc bmTag = iNullRange;
-                iBool isTagged = iFalse;
-                while (nextSplit_Rangecc(range_String(&bm->tags), " ", &bmTag)) {
-                    if (equal_Rangecc(bmTag, cstr_String(tag))) {
-                        isTagged = iTrue;
-                        break;
-                    }
-                }
-                if (isTagged) {
-                    appendFormat_String(
-                        str, "=> %s %s\n", cstr_String(&bm->url), cstr_String(&bm->title));
-                }
+    else {
+        iConstForEach(PtrArray,
+                      i,
+                      sorted_Bookmarks(d,
+                                       listType == listByCreationTime_BookmarkListType
+                                           ? byTime_BookmarkSortOrder
+                                           : byTitle_BookmarkSortOrder)) {
+            const iBookmark *bm = i.ptr;
+            if (listType == listByFolder_BookmarkListType) {
+                appendFormat_String(
+                    str, "=> %s %s\n", cstr_String(&bm->url), cstr_String(&bm->title));
+            }
+            else {
+                appendFormat_String(str, "=> %s %s - %s\n", cstr_String(&bm->url),
+                                    cstrCollect_String(format_Time(&bm->when, "%Y-%m-%d")),
+                                    cstr_String(&bm->title));
             }
         }
     }
-    iRelease(tags);
     unlock_Mutex(d->mtx);
     if (listType == listByCreationTime_BookmarkListType) {
         appendCStr_String(str, "\nThis page is formatted according to the "
@@ -365,16 +615,65 @@ const iString *bookmarkListPage_Bookmarks(const iBookmarks *d, enum iBookmarkLis
     return str;
 }
 
-static iBool isRemoteSource_Bookmark_(void *context, const iBookmark *d) {
-    iUnused(context);
-    return hasTag_Bookmark(d, "remotesource");
-}
-
-void remoteRequestFinished_Bookmarks_(iBookmarks *d, iGmRequest *req) {
+static void remoteRequestFinished_Bookmarks_(iBookmarks *d, iGmRequest *req) {
+    /* Called in the request's thread without locking Bookmarks. The links are parsed here
+       so the main thread only needs to merge them. */
     iUnused(d);
+    iRemoteFetch *fetch = userData_Object(req);
+    if (isSuccess_GmStatusCode(status_GmRequest(req))) {
+        iBeginCollect();
+        const iBlock *body = body_GmRequest(req);
+        fetch->isValid     = iTrue;
+        fetch->contentHash = crc32_Block(body);
+        if (!fetch->hasKnownHash || fetch->contentHash != fetch->knownHash) {
+            iRegExp *linkPattern = new_RegExp("^=>\\s*([^\\s]+)\\s+(.*)", 0);
+            iRangecc srcLine = iNullRange;
+            while (nextSplit_Rangecc(range_Block(body), "\n", &srcLine)) {
+                iRangecc line = srcLine;
+                trimEnd_Rangecc(&line);
+                iRegExpMatch m;
+                init_RegExpMatch(&m);
+                if (matchRange_RegExp(linkPattern, line, &m)) {
+                    const iString *url =
+                        collect_String(newRange_String(capturedRange_RegExpMatch(&m, 1)));
+                    pushBack_StringList(fetch->urls, absoluteUrl_String(url_GmRequest(req), url));
+                    pushBackRange_StringList(fetch->titles, capturedRange_RegExpMatch(&m, 2));
+                }
+            }
+            iRelease(linkPattern);
+        }
+        iEndCollect();
+    }
     postCommandf_App("bookmarks.request.finished req:%p", req);
 }
 
+static iBool isFromSource_Bookmark_(void *context, const iBookmark *bm) {
+    return bm->sourceId == *(const uint32_t *) context;
+}
+
+static iBool isOrphan_Bookmark_(void *context, const iBookmark *bm) {
+    return !contains_IntSet(context, bm->sourceId);
+}
+
+static size_t removeRemote_Bookmarks_(iBookmarks *d, iBookmarksFilterFunc filter, void *context) {
+    iPtrArray *removed = new_PtrArray();
+    iConstForEach(PtrArray, i, listTagged_Bookmarks(d, "remote", NULL)) {
+        if (filter(context, i.ptr)) {
+            remove_Hash(&d->bookmarks, id_Bookmark(i.ptr));
+            pushBack_PtrArray(removed, i.ptr);
+        }
+    }
+    const size_t count = size_PtrArray(removed);
+    if (count) {
+        unindex_Bookmarks_(d, NULL); /* all at once */
+        iForEach(PtrArray, j, removed) {
+            delete_Bookmark(j.ptr);
+        }
+    }
+    iRelease(removed);
+    return count;
+}
+
 void requestFinished_Bookmarks(iBookmarks *d, iGmRequest *req) {
     iBool found = iFalse;
     iForEach(PtrArray, i, &d->remoteRequests) {
@@ -385,44 +684,36 @@ void requestFinished_Bookmarks(iBookmarks *d, iGmRequest *req) {
         }
     }
     iAssert(found);
-    /* Parse all links in the result. */
-    if (isSuccess_GmStatusCode(status_GmRequest(req))) {
-        iTime now;
-        initCurrent_Time(&now);
-        iRegExp *linkPattern = new_RegExp("^=>\\s*([^\\s]+)\\s+(.*)", 0);
-        iString src;
-        const iString *remoteTag = collectNewCStr_String("remote");
-        initBlock_String(&src, body_GmRequest(req));
-        iRangecc srcLine = iNullRange;
-        while (nextSplit_Rangecc(range_String(&src), "\n", &srcLine)) {
-            iRangecc line = srcLine;
-            trimEnd_Rangecc(&line);
-            iRegExpMatch m;
-            init_RegExpMatch(&m);            
-            if (matchRange_RegExp(linkPattern, line, &m)) {
-                const iRangecc url    = capturedRange_RegExpMatch(&m, 1);
-                const iRangecc title  = capturedRange_RegExpMatch(&m, 2);
-                iString *      urlStr = newRange_String(url);
-                const iString *absUrl = absoluteUrl_String(url_GmRequest(req), urlStr);
-                if (!findUrl_Bookmarks(d, absUrl)) {
-                    iString *titleStr = newRange_String(title);
-                    const uint32_t bmId = add_Bookmarks(d, absUrl, titleStr, remoteTag, 0x2913);
-                    iBookmark *bm = get_Bookmarks(d, bmId);
-                    bm->sourceId = *(uint32_t *) userData_Object(req);
-                    delete_String(titleStr);
+    iRemoteFetch *fetch = userData_Object(req);
+    lock_Mutex(d->mtx);
+    iRemoteSource *source = (iRemoteSource *) value_Hash(&d->remoteSources, fetch->sourceId);
+    if (fetch->isValid && source) {
+        initCurrent_Time(&source->lastFetched);
+        if (!fetch->hasKnownHash || fetch->contentHash != fetch->knownHash) {
+            /* Replace the bookmarks of this source only. */
+            const iString *remoteTag = collectNewCStr_String("remote");
+            removeRemote_Bookmarks_(d, isFromSource_Bookmark_, &fetch->sourceId);
+            for (size_t n = 0; n < size_StringList(fetch->urls); n++) {
+                const iString *url = constAt_StringList(fetch->urls, n);
+                if (!findUrl_Bookmarks(d, url)) {
+                    const uint32_t bmId = add_Bookmarks(
+                        d, url, constAt_StringList(fetch->titles, n), remoteTag, 0x2913);
+                    get_Bookmarks(d, bmId)->sourceId = fetch->sourceId;
                 }
-                delete_String(urlStr);
             }
+            source->contentHash = fetch->contentHash;
+            source->hasContent  = iTrue;
+            d->isRemoteChanged  = iTrue;
         }
-        deinit_String(&src);
-        iRelease(linkPattern);
     }
     else {
-        /* TODO: Show error? */
+        /* TODO: Show error? The previously fetched bookmarks are kept. */
     }
-    free(userData_Object(req));
+    unlock_Mutex(d->mtx);
     iRelease(req);
-    if (isEmpty_PtrArray(&d->remoteRequests)) {
+    delete_RemoteFetch(fetch);
+    if (isEmpty_PtrArray(&d->remoteRequests) && d->isRemoteChanged) {
+        d->isRemoteChanged = iFalse;
         postCommand_App("bookmarks.changed");
     }
 }
@@ -432,29 +723,48 @@ void fetchRemote_Bookmarks(iBookmarks *d) {
         return; /* Already ongoing. */
     }
     lock_Mutex(d->mtx);
-    /* Remove all current remote bookmarks. */ {
-        size_t numRemoved = 0;
-        iForEach(Hash, i, &d->bookmarks) {
-            iBookmark *bm = (iBookmark *) i.value;
-            if (hasTag_Bookmark(bm, "remote")) {
-                remove_HashIterator(&i);
-                delete_Bookmark(bm);
-                numRemoved++;
+    const iPtrArray *sources = listTagged_Bookmarks(d, "remotesource", NULL);
+    /* Forget sources that have been removed, and their bookmarks. */ {
+        iIntSet *sourceIds = new_IntSet();
+        iConstForEach(PtrArray, i, sources) {
+            insert_IntSet(sourceIds, id_Bookmark(i.ptr));
+        }
+        iForEach(Hash, j, &d->remoteSources) {
+            if (!contains_IntSet(sourceIds, j.value->key)) {
+                remove_HashIterator(&j);
+                free(j.value);
             }
         }
-        if (numRemoved) {
+        if (removeRemote_Bookmarks_(d, isOrphan_Bookmark_, sourceIds)) {
             postCommand_App("bookmarks.changed");
         }
+        iRelease(sourceIds);
     }
-    iConstForEach(PtrArray, i, list_Bookmarks(d, NULL, isRemoteSource_Bookmark_, NULL)) {
-        const iBookmark *bm   = i.ptr;
-        iGmRequest *     req  = new_GmRequest(certs_App());
-        uint32_t *       bmId = malloc(4);
-        *bmId                 = id_Bookmark(bm);
-        setUserData_Object(req, bmId);
+    /* All sources are fetched concurrently. */
+    iConstForEach(PtrArray, i, sources) {
+        const iBookmark *bm     = i.ptr;
+        iRemoteSource *  source = (iRemoteSource *) value_Hash(&d->remoteSources, id_Bookmark(bm));
+        if (!source) {
+            source = iMalloc(RemoteSource);
+            source->node.key   = id_Bookmark(bm);
+            source->hasContent = iFalse;
+            iZap(source->lastFetched);
+            insert_Hash(&d->remoteSources, &source->node);
+        }
+        else if (source->hasContent &&
+                 elapsedSeconds_Time(&source->lastFetched) < minRefetchSeconds_Bookmarks_) {
+            continue; /* just fetched */
+        }
+        iRemoteFetch *fetch = new_RemoteFetch();
+        fetch->sourceId     = id_Bookmark(bm);
+        fetch->hasKnownHash = source->hasContent;
+        fetch->knownHash    = source->contentHash;
+        iGmRequest *req = new_GmRequest(certs_App());
+        setUserData_Object(req, fetch);
         pushBack_PtrArray(&d->remoteRequests, req);
         setUrl_GmRequest(req, &bm->url);
-        iConnect(GmRequest, req, finished, req, remoteRequestFinished_Bookmarks_);
+        setPriority_GmRequest(req, background_GmRequestPriority);
+        iConnect(GmRequest, req, finished, d, remoteRequestFinished_Bookmarks_);
         submit_GmRequest(req);
     }
     unlock_Mutex(d->mtx);
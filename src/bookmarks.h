@@ -44,6 +44,7 @@ struct Impl_Bookmark {
 
 iLocalDef uint32_t  id_Bookmark (const iBookmark *d) { return d->node.key; }
 
+/* Editing the tags of an added bookmark must go through Bookmarks so it gets reindexed. */
 iBool   hasTag_Bookmark     (const iBookmark *d, const char *tag);
 void    addTag_Bookmark     (iBookmark *d, const char *tag);
 void    removeTag_Bookmark  (iBookmark *d, const char *tag);
@@ -59,12 +60,15 @@ uint32_t    add_Bookmarks               (iBookmarks *, const iString *url, const
                                          const iString *tags, iChar icon);
 iBool       remove_Bookmarks            (iBookmarks *, uint32_t id);
 iBookmark * get_Bookmarks               (iBookmarks *, uint32_t id);
+void        update_Bookmarks            (iBookmarks *, uint32_t id, const iString *title,
+                                         const iString *url, const iString *tags); /* NULL: unchanged */
+iBool       toggleTag_Bookmarks         (iBookmarks *, uint32_t id, const char *tag); /* returns iTrue if added */
 void        fetchRemote_Bookmarks       (iBookmarks *);
 void        requestFinished_Bookmarks   (iBookmarks *, iGmRequest *req);
 iBool       updateBookmarkIcon_Bookmarks(iBookmarks *, const iString *url, iChar icon);
 
 void        save_Bookmarks              (const iBookmarks *, const char *dirPath);
-uint32_t    findUrl_Bookmarks           (const iBookmarks *, const iString *url); /* O(n) */
+uint32_t    findUrl_Bookmarks           (const iBookmarks *, const iString *url);
 
 typedef iBool (*iBookmarksFilterFunc) (void *context, const iBookmark *);
 typedef int   (*iBookmarksCompareFunc)(const iBookmark **, const iBookmark **);
@@ -85,6 +89,36 @@ iBool   filterTagsRegExp_Bookmarks      (void *regExp, const iBookmark *);
 const iPtrArray *list_Bookmarks(const iBookmarks *, iBookmarksCompareFunc cmp,
                                 iBookmarksFilterFunc filter, void *context);
 
+/**
+ * Lists the bookmarks that have a tag, using the tag index. Tags are separated by spaces
+ * and matched case-sensitively.
+ *
+ * @param cmp  Sort function. If NULL, sorted by descending creation time.
+ *
+ * @return Collected array of bookmarks.
+ */
+const iPtrArray *listTagged_Bookmarks(const iBookmarks *, const char *tag,
+                                      iBookmarksCompareFunc cmp);
+
+enum iBookmarkSortOrder {
+    byTime_BookmarkSortOrder, /* newest first */
+    byTitle_BookmarkSortOrder,
+};
+
+/**
+ * Returns all bookmarks in a sorted view that is kept up to date as bookmarks are added,
+ * removed, and updated. The array is not a copy: it is only valid until the next change.
+ * Bookmarks are only changed in the main thread, so use the view in the main thread only;
+ * other threads should use list_Bookmarks() or listTagged_Bookmarks().
+ */
+const iPtrArray *sorted_Bookmarks(const iBookmarks *, enum iBookmarkSortOrder order);
+
+/**
+ * Returns a number that changes whenever bookmarks are added, removed, or modified via
+ * Bookmarks. Lists built from bookmarks need not be rebuilt if this has not changed.
+ */
+uint32_t generation_Bookmarks(const iBookmarks *);
+
 enum iBookmarkListType {
     listByFolder_BookmarkListType,
     listByTag_BookmarkListType,
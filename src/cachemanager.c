@@ -0,0 +1,320 @@
+/* Copyright 2020 Jaakko Keränen <jaakko.keranen@iki.fi>
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+#include "cachemanager.h"
+#include "app.h"
+
+#include <the_Foundation/mutex.h>
+#include <the_Foundation/array.h>
+#include <the_Foundation/thread.h>
+
+struct Impl_CacheEntry {
+    iCacheEntry *       prev;
+    iCacheEntry *       next;
+    size_t              size;
+    enum iCachePriority priority;
+    uint32_t            lastUsed;
+    size_t              heapPos; /* iInvalidPos if not evictable */
+    iBool               isEvicting; /* taken off the heap; freed after eviction */
+    iCacheEvictFunc     evict;
+    void *              context;
+};
+
+iDeclareType(CacheManager)
+
+struct Impl_CacheManager {
+    iMutex *     mtx;
+    iArray       heap;    /* iCacheEntry *; binary min-heap of evictable entries */
+    iCacheEntry *entries; /* all entries, evictable or not */
+    size_t       totalSize;
+    size_t       maxSize;
+    uint32_t     useCounter;
+    iBool        isTrimPosted;
+    iCacheEntry *evicting; /* callback of this entry is running */
+    iCondition   evicted;
+};
+
+static iCacheManager cacheManager_;
+
+static iBool isLess_CacheEntry_(const iCacheEntry *d, const iCacheEntry *other) {
+    if (d->priority != other->priority) {
+        return d->priority < other->priority;
+    }
+    return d->lastUsed < other->lastUsed;
+}
+
+static iCacheEntry *at_CacheManager_(iCacheManager *d, size_t pos) {
+    return value_Array(&d->heap, pos, iCacheEntry *);
+}
+
+static void swap_CacheManager_(iCacheManager *d, size_t a, size_t b) {
+    iCacheEntry *ea = at_CacheManager_(d, a);
+    iCacheEntry *eb = at_CacheManager_(d, b);
+    set_Array(&d->heap, a, &eb);
+    set_Array(&d->heap, b, &ea);
+    ea->heapPos = b;
+    eb->heapPos = a;
+}
+
+static void siftUp_CacheManager_(iCacheManager *d, size_t pos) {
+    while (pos > 0) {
+        const size_t parent = (pos - 1) / 2;
+        if (!isLess_CacheEntry_(at_CacheManager_(d, pos), at_CacheManager_(d, parent))) {
+            break;
+        }
+        swap_CacheManager_(d, pos, parent);
+        pos = parent;
+    }
+}
+
+static void siftDown_CacheManager_(iCacheManager *d, size_t pos) {
+    const size_t count = size_Array(&d->heap);
+    for (;;) {
+        const size_t left  = 2 * pos + 1;
+        const size_t right = left + 1;
+        size_t least = pos;
+        if (left < count && isLess_CacheEntry_(at_CacheManager_(d, left),
+                                               at_CacheManager_(d, least))) {
+            least = left;
+        }
+        if (right < count && isLess_CacheEntry_(at_CacheManager_(d, right),
+                                                at_CacheManager_(d, least))) {
+            least = right;
+        }
+        if (least == pos) {
+            break;
+        }
+        swap_CacheManager_(d, pos, least);
+        pos = least;
+    }
+}
+
+static void update_CacheManager_(iCacheManager *d, iCacheEntry *entry) {
+    if (entry->heapPos != iInvalidPos) {
+        siftUp_CacheManager_(d, entry->heapPos);
+        siftDown_CacheManager_(d, entry->heapPos);
+    }
+}
+
+static void removeFromHeap_CacheManager_(iCacheManager *d, iCacheEntry *entry) {
+    const size_t pos  = entry->heapPos;
+    const size_t last = size_Array(&d->heap) - 1;
+    if (pos != last) {
+        swap_CacheManager_(d, pos, last);
+    }
+    popBack_Array(&d->heap);
+    entry->heapPos = iInvalidPos;
+    if (pos != last) {
+        update_CacheManager_(d, at_CacheManager_(d, pos));
+    }
+}
+
+static void link_CacheManager_(iCacheManager *d, iCacheEntry *entry) {
+    entry->prev = NULL;
+    entry->next = d->entries;
+    if (d->entries) {
+        d->entries->prev = entry;
+    }
+    d->entries = entry;
+}
+
+static void unlink_CacheManager_(iCacheManager *d, iCacheEntry *entry) {
+    if (entry->prev) {
+        entry->prev->next = entry->next;
+    }
+    else {
+        d->entries = entry->next;
+    }
+    if (entry->next) {
+        entry->next->prev = entry->prev;
+    }
+}
+
+static void checkPressure_CacheManager_(iCacheManager *d) {
+    /* Trimming is done later so that eviction never happens in the middle of an update
+       to the entry's owner. */
+    if (d->totalSize > d->maxSize && !d->isTrimPosted && !isEmpty_Array(&d->heap)) {
+        d->isTrimPosted = iTrue;
+        postCommand_App("cache.trim");
+    }
+}
+
+static void trimTo_CacheManager_(iCacheManager *d, size_t maxSize) {
+    /* The owners are called without holding the lock, because they lock themselves and
+       may call the manager while doing so. */
+    iArray victims;
+    init_Array(&victims, sizeof(iCacheEntry *));
+    lock_Mutex(d->mtx);
+    d->isTrimPosted = iFalse;
+    while (d->totalSize > maxSize && !isEmpty_Array(&d->heap)) {
+        iCacheEntry *entry = at_CacheManager_(d, 0);
+        removeFromHeap_CacheManager_(d, entry);
+        d->totalSize -= entry->size;
+        entry->isEvicting = iTrue;
+        pushBack_Array(&victims, &entry);
+    }
+    unlock_Mutex(d->mtx);
+    iConstForEach(Array, i, &victims) {
+        iCacheEntry *entry = *(iCacheEntry * const *) i.value;
+        lock_Mutex(d->mtx);
+        const iCacheEvictFunc evict = entry->evict; /* NULL if already removed */
+        if (evict) {
+            /* Until the callback returns, removing the entry waits. */
+            d->evicting = entry;
+            unlock_Mutex(d->mtx);
+            evict(entry->context, entry);
+            lock_Mutex(d->mtx);
+            d->evicting = NULL;
+            signalAll_Condition(&d->evicted);
+        }
+        unlink_CacheManager_(d, entry);
+        unlock_Mutex(d->mtx);
+        free(entry);
+    }
+    deinit_Array(&victims);
+}
+
+void init_CacheManager(size_t maxSize) {
+    iCacheManager *d = &cacheManager_;
+    d->mtx = new_Mutex();
+    init_Array(&d->heap, sizeof(iCacheEntry *));
+    d->entries      = NULL;
+    d->totalSize    = 0;
+    d->maxSize      = maxSize;
+    d->useCounter   = 0;
+    d->isTrimPosted = iFalse;
+    d->evicting     = NULL;
+    init_Condition(&d->evicted);
+}
+
+void deinit_CacheManager(void) {
+    iCacheManager *d = &cacheManager_;
+    /* All owners should have released their entries by now. */
+    iAssert(d->entries == NULL);
+    while (d->entries) {
+        iCacheEntry *entry = d->entries;
+        d->entries = entry->next;
+        free(entry);
+    }
+    deinit_Array(&d->heap);
+    deinit_Condition(&d->evicted);
+    delete_Mutex(d->mtx);
+}
+
+void setLimit_CacheManager(size_t maxSize) {
+    iCacheManager *d = &cacheManager_;
+    iGuardMutex(d->mtx, {
+        d->maxSize = maxSize;
+        checkPressure_CacheManager_(d);
+    });
+}
+
+size_t size_CacheManager(void) {
+    iCacheManager *d = &cacheManager_;
+    size_t size;
+    iGuardMutex(d->mtx, size = d->totalSize);
+    return size;
+}
+
+void trim_CacheManager(void) {
+    iCacheManager *d = &cacheManager_;
+    trimTo_CacheManager_(d, d->maxSize);
+}
+
+void flush_CacheManager(void) {
+    trimTo_CacheManager_(&cacheManager_, 0);
+}
+
+iCacheEntry *add_CacheManager(size_t size, enum iCachePriority priority,
+                              iCacheEvictFunc evict, void *context) {
+    iCacheManager *d = &cacheManager_;
+    iCacheEntry *entry = iMalloc(CacheEntry);
+    entry->size     = size;
+    entry->priority = priority;
+    entry->heapPos  = iInvalidPos;
+    entry->isEvicting = iFalse;
+    entry->evict    = evict;
+    entry->context  = context;
+    lock_Mutex(d->mtx);
+    link_CacheManager_(d, entry);
+    entry->lastUsed = ++d->useCounter;
+    d->totalSize += size;
+    if (evict) {
+        entry->heapPos = size_Array(&d->heap);
+        pushBack_Array(&d->heap, &entry);
+        siftUp_CacheManager_(d, entry->heapPos);
+    }
+    checkPressure_CacheManager_(d);
+    unlock_Mutex(d->mtx);
+    return entry;
+}
+
+void remove_CacheManager(iCacheEntry *entry) {
+    if (!entry) return;
+    iCacheManager *d = &cacheManager_;
+    lock_Mutex(d->mtx);
+    if (entry->isEvicting) {
+        /* Being evicted; the trimmer frees it. If the callback is running, the owner (its
+           context) must not go away before it returns. */
+        entry->evict = NULL;
+        while (d->evicting == entry) {
+            wait_Condition(&d->evicted, d->mtx);
+        }
+        unlock_Mutex(d->mtx);
+        return;
+    }
+    if (entry->heapPos != iInvalidPos) {
+        removeFromHeap_CacheManager_(d, entry);
+    }
+    d->totalSize -= entry->size;
+    unlink_CacheManager_(d, entry);
+    unlock_Mutex(d->mtx);
+    free(entry);
+}
+
+void resize_CacheManager(iCacheEntry *entry, size_t size) {
+    iCacheManager *d = &cacheManager_;
+    iGuardMutex(d->mtx, {
+        if (!entry->isEvicting) { /* no longer counted */
+            d->totalSize -= entry->size;
+            d->totalSize += size;
+            checkPressure_CacheManager_(d);
+        }
+        entry->size = size;
+    });
+}
+
+void touch_CacheManager(iCacheEntry *entry) {
+    iCacheManager *d = &cacheManager_;
+    iGuardMutex(d->mtx, {
+        entry->lastUsed = ++d->useCounter;
+        update_CacheManager_(d, entry);
+    });
+}
+
+void setPriority_CacheManager(iCacheEntry *entry, enum iCachePriority priority) {
+    iCacheManager *d = &cacheManager_;
+    iGuardMutex(d->mtx, {
+        entry->priority = priority;
+        update_CacheManager_(d, entry);
+    });
+}
@@ -0,0 +1,57 @@
+/* Copyright 2020 Jaakko Keränen <jaakko.keranen@iki.fi>
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+#pragma once
+
+#include <the_Foundation/defs.h>
+
+/* Memory budget shared by the cached responses of all tabs. Each cached item registers
+   an entry with its size; when the total exceeds the limit, the least recently used
+   entries are evicted. Entries without an eviction callback are counted but never
+   evicted. The eviction callback drops the cached data and forgets the entry, which is
+   then deleted by the manager. The callback is made without the manager being locked, so
+   it may lock the owner and call the manager. Removing an entry whose callback is running
+   waits for the callback to return, so the owner can't be deleted while in use. */
+
+iDeclareType(CacheEntry)
+
+typedef void (*iCacheEvictFunc)(void *context, iCacheEntry *entry);
+
+enum iCachePriority {
+    speculative_CachePriority, /* evicted before anything else */
+    normal_CachePriority,
+};
+
+void            init_CacheManager           (size_t maxSize);
+void            deinit_CacheManager         (void);
+
+void            setLimit_CacheManager       (size_t maxSize);
+size_t          size_CacheManager           (void);
+void            trim_CacheManager           (void);
+void            flush_CacheManager          (void); /* evict all that can be evicted */
+
+iCacheEntry *   add_CacheManager            (size_t size, enum iCachePriority priority,
+                                             iCacheEvictFunc evict, void *context);
+void            remove_CacheManager         (iCacheEntry *entry);
+void            resize_CacheManager         (iCacheEntry *entry, size_t size);
+void            touch_CacheManager          (iCacheEntry *entry);
+void            setPriority_CacheManager    (iCacheEntry *entry, enum iCachePriority priority);
@@ -0,0 +1,248 @@
+/* Copyright 2020 Jaakko Keränen <jaakko.keranen@iki.fi>
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+#include "contentindex.h"
+#include "sha256.h"
+
+#include <the_Foundation/array.h>
+#include <the_Foundation/hash.h>
+#include <the_Foundation/mutex.h>
+
+iDeclareType(IndexedTrigram)
+
+struct Impl_IndexedTrigram {
+    iHashNode node;  /* key is the three characters */
+    iIntSet   pages; /* pages where the trigram appears */
+};
+
+iDeclareType(IndexedPage)
+
+struct Impl_IndexedPage {
+    iHashNode node;     /* key is derived from the URL and the content; see findPage_() */
+    iString   url;
+    iSha256   content;
+    iArray    trigrams; /* uint32_t; everything indexed for the page, for removal */
+    int       numRefs;
+};
+
+iDeclareType(ContentIndex)
+
+struct Impl_ContentIndex {
+    iMutex *mtx;
+    iHash   trigrams;
+    iHash   pages;
+};
+
+static iContentIndex contentIndex_;
+
+iLocalDef iBool isIndexed_(char ch) {
+    return (ch >= 'a' && ch <= 'z') || (ch >= '0' && ch <= '9');
+}
+
+iLocalDef char lower_(char ch) {
+    return ch >= 'A' && ch <= 'Z' ? ch + ('a' - 'A') : ch;
+}
+
+static void collectTrigrams_(iRangecc text, iIntSet *trigrams_out) {
+    uint32_t tri = 0;
+    int      len = 0; /* characters in the current run */
+    for (const char *ch = text.start; ch != text.end; ch++) {
+        const char c = lower_(*ch);
+        if (!isIndexed_(c)) {
+            len = 0;
+            continue;
+        }
+        tri = ((tri << 8) | (uint8_t) c) & 0xffffff;
+        if (++len >= 3) {
+            insert_IntSet(trigrams_out, (int) tri);
+        }
+    }
+}
+
+static iIndexedPage *findPage_ContentIndex_(const iContentIndex *d, const iString *url,
+                                            const iSha256 *content, uint32_t *key_out) {
+    /* Pages whose keys collide are given the next free key instead. Zero is not used. After
+       a removal, an identical page may end up indexed twice, which is harmless. */
+    uint32_t key;
+    memcpy(&key, content->bytes, sizeof(key));
+    key ^= crc32_Block(&url->chars);
+    for (;; key++) {
+        if (key == 0) {
+            continue;
+        }
+        iIndexedPage *page = (iIndexedPage *) value_Hash(&d->pages, key);
+        if (!page || (equal_Sha256(&page->content, content) && equal_String(&page->url, url))) {
+            *key_out = key;
+            return page;
+        }
+    }
+}
+
+void init_ContentIndex(void) {
+    iContentIndex *d = &contentIndex_;
+    d->mtx = new_Mutex();
+    init_Hash(&d->trigrams);
+    init_Hash(&d->pages);
+}
+
+void deinit_ContentIndex(void) {
+    iContentIndex *d = &contentIndex_;
+    iForEach(Hash, i, &d->trigrams) {
+        iIndexedTrigram *tri = (iIndexedTrigram *) i.value;
+        deinit_IntSet(&tri->pages);
+        free(tri);
+    }
+    deinit_Hash(&d->trigrams);
+    iForEach(Hash, j, &d->pages) {
+        iIndexedPage *page = (iIndexedPage *) j.value;
+        deinit_String(&page->url);
+        deinit_Array(&page->trigrams);
+        free(page);
+    }
+    deinit_Hash(&d->pages);
+    delete_Mutex(d->mtx);
+}
+
+uint32_t add_ContentIndex(const iString *url, const iBlock *text) {
+    iContentIndex *d = &contentIndex_;
+    const iSha256 content = digest_Sha256(text);
+    uint32_t key;
+    lock_Mutex(d->mtx);
+    iIndexedPage *page = findPage_ContentIndex_(d, url, &content, &key);
+    if (page) {
+        page->numRefs++;
+        unlock_Mutex(d->mtx);
+        return key;
+    }
+    unlock_Mutex(d->mtx);
+    /* Find the trigrams without holding the lock. */
+    iIntSet found;
+    init_IntSet(&found);
+    collectTrigrams_(range_Block(text), &found);
+    lock_Mutex(d->mtx);
+    page = findPage_ContentIndex_(d, url, &content, &key);
+    if (page) {
+        /* Someone else got here first. */
+        page->numRefs++;
+    }
+    else {
+        page = iMalloc(IndexedPage);
+        page->node.key = key;
+        initCopy_String(&page->url, url);
+        page->content = content;
+        init_Array(&page->trigrams, sizeof(uint32_t));
+        page->numRefs = 1;
+        iConstForEach(IntSet, i, &found) {
+            const uint32_t triKey = (uint32_t) *i.value;
+            iIndexedTrigram *tri = (iIndexedTrigram *) value_Hash(&d->trigrams, triKey);
+            if (!tri) {
+                tri = iMalloc(IndexedTrigram);
+                tri->node.key = triKey;
+                init_IntSet(&tri->pages);
+                insert_Hash(&d->trigrams, &tri->node);
+            }
+            insert_IntSet(&tri->pages, (int) key);
+            pushBack_Array(&page->trigrams, &triKey);
+        }
+        insert_Hash(&d->pages, &page->node);
+    }
+    unlock_Mutex(d->mtx);
+    deinit_IntSet(&found);
+    return key;
+}
+
+void ref_ContentIndex(uint32_t key) {
+    iContentIndex *d = &contentIndex_;
+    lock_Mutex(d->mtx);
+    iIndexedPage *page = (iIndexedPage *) value_Hash(&d->pages, key);
+    if (page) {
+        page->numRefs++;
+    }
+    unlock_Mutex(d->mtx);
+}
+
+void remove_ContentIndex(uint32_t key) {
+    iContentIndex *d = &contentIndex_;
+    lock_Mutex(d->mtx);
+    iIndexedPage *page = (iIndexedPage *) value_Hash(&d->pages, key);
+    if (page && --page->numRefs == 0) {
+        iConstForEach(Array, i, &page->trigrams) {
+            const uint32_t triKey = *(const uint32_t *) i.value;
+            iIndexedTrigram *tri = (iIndexedTrigram *) value_Hash(&d->trigrams, triKey);
+            if (tri) {
+                remove_IntSet(&tri->pages, (int) key);
+                if (isEmpty_IntSet(&tri->pages)) {
+                    remove_Hash(&d->trigrams, triKey);
+                    deinit_IntSet(&tri->pages);
+                    free(tri);
+                }
+            }
+        }
+        remove_Hash(&d->pages, key);
+        deinit_String(&page->url);
+        deinit_Array(&page->trigrams);
+        free(page);
+    }
+    unlock_Mutex(d->mtx);
+}
+
+iIntSet *find_ContentIndex(const iString *terms) {
+    iContentIndex *d = &contentIndex_;
+    iIntSet wanted;
+    init_IntSet(&wanted);
+    collectTrigrams_(range_String(terms), &wanted);
+    if (isEmpty_IntSet(&wanted)) {
+        deinit_IntSet(&wanted);
+        return NULL;
+    }
+    iIntSet *pages = NULL;
+    lock_Mutex(d->mtx);
+    /* A matching page must have all of the trigrams. */
+    iConstForEach(IntSet, i, &wanted) {
+        const iIndexedTrigram *tri = (const iIndexedTrigram *) value_Hash(&d->trigrams, *i.value);
+        if (!tri) {
+            if (pages) {
+                clear_IntSet(pages);
+            }
+            else {
+                pages = new_IntSet();
+            }
+            break;
+        }
+        iIntSet *common = new_IntSet();
+        iConstForEach(IntSet, p, &tri->pages) {
+            if (!pages || contains_IntSet(pages, *p.value)) {
+                insert_IntSet(common, *p.value);
+            }
+        }
+        if (pages) {
+            delete_IntSet(pages);
+        }
+        pages = common;
+        if (isEmpty_IntSet(pages)) {
+            break;
+        }
+    }
+    unlock_Mutex(d->mtx);
+    deinit_IntSet(&wanted);
+    return pages;
+}
@@ -25,8 +25,11 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 enum iFileVersion {
     initial_FileVersion                 = 0,
     addedResponseTimestamps_FileVersion = 1,
+    addedPageCache_FileVersion          = 2,
+    addedStateJournal_FileVersion       = 3,
+    addedRestoredTitle_FileVersion      = 4,
     /* meta */
-    latest_FileVersion = 1
+    latest_FileVersion = 4
 };
 
 /* Icons */
@@ -22,21 +22,24 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 
 #include "feeds.h"
 #include "bookmarks.h"
+#include "defs.h"
 #include "gmrequest.h"
 #include "visited.h"
 #include "app.h"
 
+#include <the_Foundation/buffer.h>
 #include <the_Foundation/file.h>
+#include <the_Foundation/fileinfo.h>
 #include <the_Foundation/hash.h>
 #include <the_Foundation/intset.h>
 #include <the_Foundation/mutex.h>
 #include <the_Foundation/path.h>
 #include <the_Foundation/queue.h>
-#include <the_Foundation/regexp.h>
 #include <the_Foundation/stringset.h>
 #include <the_Foundation/thread.h>
 #include <SDL_timer.h>
 #include <ctype.h>
+#include <stdio.h> /* rename(), remove() */
 
 iDeclareType(Feeds)
 iDeclareType(FeedJob)
@@ -81,14 +84,18 @@ struct Impl_FeedJob {
     iTime       startTime;
     iBool       isFirstUpdate; /* hasn't been checked ever before */
     iBool       checkHeadings;
+    iBool       isFinished; /* request has finished; guarded by the Feeds mutex */
     iGmRequest *request;
     iPtrArray   results;
 };
 
+static void requestFinished_FeedJob_(iFeedJob *d, iGmRequest *req);
+
 static void init_FeedJob(iFeedJob *d, const iBookmark *bookmark) {
     initCopy_String(&d->url, &bookmark->url);
     d->bookmarkId = id_Bookmark(bookmark);
     d->request = NULL;
+    d->isFinished = iFalse;
     init_PtrArray(&d->results);
     iZap(d->startTime);
     d->isFirstUpdate = iFalse;
@@ -96,7 +103,10 @@ static void init_FeedJob(iFeedJob *d, const iBookmark *bookmark) {
 }
 
 static void deinit_FeedJob(iFeedJob *d) {
-    iRelease(d->request);
+    if (d->request) {
+        iDisconnect(GmRequest, d->request, finished, d, requestFinished_FeedJob_);
+        iRelease(d->request); /* cancelled if still ongoing */
+    }
     iForEach(PtrArray, i, &d->results) {
         delete_FeedEntry(i.ptr);
     }
@@ -108,8 +118,39 @@ iDefineTypeConstructionArgs(FeedJob, (const iBookmark *bm), bm)
 
 /*----------------------------------------------------------------------------------------------*/
 
-static const char *feedsFilename_Feeds_         = "feeds.txt";
-static const int   updateIntervalSeconds_Feeds_ = 4 * 60 * 60;
+static const char *feedsFilename_Feeds_            = "feeds.lgr";
+static const char *oldFeedsFilename_Feeds_         = "feeds.txt";
+static const char *magic_Feeds_                    = "lgF1";
+static const int   updateIntervalSeconds_Feeds_    = 4 * 60 * 60; /* for new feeds */
+static const int   minUpdateIntervalSeconds_Feeds_ = 60 * 60;
+static const int   maxUpdateIntervalSeconds_Feeds_ = 3 * 24 * 60 * 60;
+
+iDeclareType(FeedState)
+
+/* Each feed is checked on its own schedule. Feeds that change often are checked more
+   frequently, and the interval of unchanging ones grows exponentially. */
+struct Impl_FeedState {
+    iHashNode node;        /* key is the bookmark ID */
+    uint32_t  contentHash; /* of the latest fetched page */
+    iTime     lastChecked;
+    iTime     lastChanged;
+    int       interval;    /* seconds */
+};
+
+static iFeedState *new_FeedState_(uint32_t bookmarkId) {
+    iFeedState *d = iMalloc(FeedState);
+    d->node.key    = bookmarkId;
+    d->contentHash = 0;
+    iZap(d->lastChecked);
+    iZap(d->lastChanged);
+    d->interval = updateIntervalSeconds_Feeds_;
+    return d;
+}
+
+static iBool isDue_FeedState_(const iFeedState *d, const iTime *now) {
+    return !isValid_Time(&d->lastChecked) ||
+           secondsSince_Time(now, &d->lastChecked) >= d->interval - 60; /* roughly */
+}
 
 struct Impl_Feeds {
     iMutex *  mtx;
@@ -119,44 +160,149 @@ struct Impl_Feeds {
     int       refreshTimer;
     iThread * worker;
     iBool     stopWorker;
+    iCondition jobFinished; /* signaled by requests */
     iPtrArray jobs; /* pending */
-    iSortedArray entries; /* pointers to all discovered feed entries, sorted by entry ID (URL) */
+    iHash     states; /* iFeedState *, by bookmark ID */
+    iHash     entries; /* iFeedEntryNode *, all discovered feed entries by URL */
+    size_t    numEntries;
 };
 
 static iFeeds feeds_;
 
-#define maxConcurrentRequests_Feeds 4
+iDeclareType(FeedEntryNode)
+
+struct Impl_FeedEntryNode {
+    iHashNode       node; /* key is a checksum of the entry URL */
+    iFeedEntry *    entry;
+    iFeedEntryNode *next; /* another entry with the same key */
+};
+
+static uint32_t entryKey_(const iString *url) {
+    return crc32_Block(&url->chars);
+}
+
+static iFeedEntry *findEntry_Feeds_(const iFeeds *d, const iString *url) {
+    for (const iFeedEntryNode *node = (const iFeedEntryNode *) value_Hash(&d->entries, entryKey_(url));
+         node;
+         node = node->next) {
+        if (equal_String(&node->entry->url, url)) {
+            return node->entry;
+        }
+    }
+    return NULL;
+}
+
+static void insertEntry_Feeds_(iFeeds *d, iFeedEntry *entry) {
+    /* The entry must not be in the table yet. */
+    iFeedEntryNode *node = iMalloc(FeedEntryNode);
+    node->node.key = entryKey_(&entry->url);
+    node->entry    = entry;
+    node->next     = (iFeedEntryNode *) remove_Hash(&d->entries, node->node.key);
+    insert_Hash(&d->entries, &node->node);
+    d->numEntries++;
+}
+
+static void removeEntriesIf_Feeds_(iFeeds *d, iBool (*func)(const iFeedEntry *, uint32_t),
+                                   uint32_t arg) {
+    /* Matching entries are deleted; NULL removes all. */
+    iPtrArray heads;
+    init_PtrArray(&heads);
+    iForEach(Hash, i, &d->entries) {
+        iFeedEntryNode *node = (iFeedEntryNode *) i.value;
+        remove_HashIterator(&i);
+        iFeedEntryNode *head = NULL;
+        while (node) {
+            iFeedEntryNode *next = node->next;
+            if (!func || func(node->entry, arg)) {
+                delete_FeedEntry(node->entry);
+                free(node);
+                d->numEntries--;
+            }
+            else {
+                node->next = head;
+                head = node;
+            }
+            node = next;
+        }
+        if (head) {
+            pushBack_PtrArray(&heads, head);
+        }
+    }
+    iForEach(PtrArray, h, &heads) {
+        insert_Hash(&d->entries, h.ptr);
+    }
+    deinit_PtrArray(&heads);
+}
+
+static iPtrArray *allEntries_Feeds_(const iFeeds *d) {
+    iPtrArray *list = collectNew_PtrArray();
+    iConstForEach(Hash, i, &d->entries) {
+        for (const iFeedEntryNode *node = (const iFeedEntryNode *) i.value; node; node = node->next) {
+            pushBack_PtrArray(list, node->entry);
+        }
+    }
+    return list;
+}
+
+#define requestTimeout_Feeds        15.0f /* seconds */
+
+static void requestFinished_FeedJob_(iFeedJob *d, iGmRequest *req) {
+    /* Called in the request's thread. */
+    iUnused(req);
+    iFeeds *feeds = &feeds_;
+    iGuardMutex(feeds->mtx, {
+        d->isFinished = iTrue;
+        signal_Condition(&feeds->jobFinished);
+    });
+}
 
 static void submit_FeedJob_(iFeedJob *d) {
     d->request = new_GmRequest(certs_App());
+    iConnect(GmRequest, d->request, finished, d, requestFinished_FeedJob_);
     setUrl_GmRequest(d->request, &d->url);
+    setPriority_GmRequest(d->request, background_GmRequestPriority);
+    setTimeout_GmRequest(d->request, requestTimeout_Feeds, requestTimeout_Feeds);
     initCurrent_Time(&d->startTime);
     submit_GmRequest(d->request);
 }
 
-static iBool isSubscribed_(void *context, const iBookmark *bm) {
-    iUnused(context);
-    static iRegExp *pattern_ = NULL;
-    if (!pattern_) {
-        pattern_ = new_RegExp("\\bsubscribed\\b", caseSensitive_RegExpOption);
-    }
-    iRegExpMatch m;
-    init_RegExpMatch(&m);
-    return matchString_RegExp(pattern_, &bm->tags, &m);
+static const iPtrArray *listSubscriptions_(void) {
+    return listTagged_Bookmarks(bookmarks_App(), "subscribed", NULL);
 }
 
-static const iPtrArray *listSubscriptions_(void) {
-    return list_Bookmarks(bookmarks_App(), NULL, isSubscribed_, NULL);
+static iFeedState *state_Feeds_(iFeeds *d, uint32_t bookmarkId) {
+    iFeedState *state = (iFeedState *) value_Hash(&d->states, bookmarkId);
+    if (!state) {
+        state = new_FeedState_(bookmarkId);
+        insert_Hash(&d->states, &state->node);
+    }
+    return state;
 }
 
-static iFeedJob *startNextJob_Feeds_(iFeeds *d) {
-    if (isEmpty_PtrArray(&d->jobs)) {
-        return NULL;
+static iBool checkChanged_Feeds_(iFeeds *d, const iFeedJob *job) {
+    /* Updates the feed's schedule. Returns iTrue if the page needs to be parsed. */
+    const iBool isSuccess = isSuccess_GmStatusCode(status_GmRequest(job->request));
+    const uint32_t hash   = isSuccess ? crc32_Block(body_GmRequest(job->request)) : 0;
+    iBool isChanged;
+    lock_Mutex(d->mtx);
+    iFeedState *state = state_Feeds_(d, job->bookmarkId);
+    initCurrent_Time(&state->lastChecked);
+    isChanged = isSuccess && (job->isFirstUpdate || hash != state->contentHash);
+    if (isChanged) {
+        state->contentHash = hash;
+        state->lastChanged = state->lastChecked;
+        state->interval    = iMax(minUpdateIntervalSeconds_Feeds_, state->interval / 2);
     }
-    iFeedJob *job;
-    take_PtrArray(&d->jobs, 0, (void **) &job);
-    submit_FeedJob_(job);
-    return job;
+    else {
+        /* Failed requests are also retried less often. */
+        state->interval = iMin(maxUpdateIntervalSeconds_Feeds_, state->interval * 2);
+    }
+    unlock_Mutex(d->mtx);
+    return isChanged;
+}
+
+static size_t maxConcurrentRequests_Feeds_(void) {
+    return iClamp(prefs_App()->maxFeedRequests, 1, 8);
 }
 
 static iBool isTrimmablePunctuation_(iChar c) {
@@ -181,109 +327,218 @@ static void trimTitle_(iString *title) {
     remove_Block(&title->chars, 0, start - constBegin_String(title));
 }
 
+static iBool isSpace_(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+static iBool isDigit_(char c) {
+    return c >= '0' && c <= '9';
+}
+
+static int digits_(const char *pos, int count) {
+    int value = 0;
+    for (int i = 0; i < count; i++) {
+        value = value * 10 + (pos[i] - '0');
+    }
+    return value;
+}
+
+static iBool parseDatedLink_(iRangecc line, iRangecc *url_out, iDate *date_out,
+                             iRangecc *title_out) {
+    /* Matches lines like "=> URL YYYY-MM-DD title". */
+    const char *pos = line.start;
+    const char *end = line.end;
+    if (end - pos < 2 || pos[0] != '=' || pos[1] != '>') {
+        return iFalse;
+    }
+    for (pos += 2; pos < end && isSpace_(*pos); pos++) {}
+    url_out->start = pos;
+    for (; pos < end && !isSpace_(*pos); pos++) {}
+    url_out->end = pos;
+    if (isEmpty_Range(url_out) || pos == end) {
+        return iFalse;
+    }
+    for (; pos < end && isSpace_(*pos); pos++) {}
+    if (end - pos < 11 ||
+        !isDigit_(pos[0]) || !isDigit_(pos[1]) || !isDigit_(pos[2]) || !isDigit_(pos[3]) ||
+        pos[4] != '-' || pos[5] < '0' || pos[5] > '1' || !isDigit_(pos[6]) ||
+        pos[7] != '-' || pos[8] < '0' || pos[8] > '3' || !isDigit_(pos[9]) ||
+        isDigit_(pos[10])) {
+        return iFalse;
+    }
+    iZap(*date_out);
+    date_out->year  = digits_(pos, 4);
+    date_out->month = digits_(pos + 5, 2);
+    date_out->day   = digits_(pos + 8, 2);
+    date_out->hour  = 12; /* noon UTC */
+    *title_out = (iRangecc){ pos + 10, end };
+    return iTrue;
+}
+
+iDeclareType(FeedParser)
+
+/* Parses a feed page one line at a time. The page can be given in pieces of any size; only
+   a line that is cut short at the end of a piece is copied. */
+struct Impl_FeedParser {
+    iFeedJob *job;
+    iTime     now;
+    iBlock    partialLine;
+};
+
+static void init_FeedParser_(iFeedParser *d, iFeedJob *job) {
+    d->job = job;
+    initCurrent_Time(&d->now);
+    init_Block(&d->partialLine, 0);
+}
+
+static void deinit_FeedParser_(iFeedParser *d) {
+    deinit_Block(&d->partialLine);
+}
+
+static void parseLine_FeedParser_(iFeedParser *d, iRangecc line) {
+    iFeedJob *job = d->job;
+    trimEnd_Rangecc(&line);
+    iRangecc url, title;
+    iDate    date;
+    if (parseDatedLink_(line, &url, &date, &title)) {
+        iFeedEntry *entry = new_FeedEntry();
+        entry->discovered = d->now;
+        entry->bookmarkId = job->bookmarkId;
+        setRange_String(&entry->url, url);
+        set_String(&entry->url, absoluteUrl_String(url_GmRequest(job->request), &entry->url));
+        setRange_String(&entry->title, title);
+        trimTitle_(&entry->title);
+        init_Time(&entry->posted, &date);
+        pushBack_PtrArray(&job->results, entry);
+    }
+    if (job->checkHeadings && startsWith_Rangecc(line, "#")) {
+        while (*line.start == '#' && line.start < line.end) {
+            line.start++;
+        }
+        trimStart_Rangecc(&line);
+        iFeedEntry *entry = new_FeedEntry();
+        entry->posted = d->now;
+        if (!job->isFirstUpdate) {
+            entry->discovered = d->now;
+        }
+        entry->bookmarkId = job->bookmarkId;
+        iString *heading = newRange_String(line);
+        set_String(&entry->title, heading);
+        set_String(&entry->url, &job->url);
+        appendChar_String(&entry->url, '#');
+        append_String(&entry->url, collect_String(urlEncode_String(heading)));
+        delete_String(heading);
+        pushBack_PtrArray(&job->results, entry);
+    }
+}
+
+static void parse_FeedParser_(iFeedParser *d, iRangecc chunk) {
+    const char *pos = chunk.start;
+    for (;;) {
+        const char *lineEnd = memchr(pos, '\n', chunk.end - pos);
+        if (!lineEnd) {
+            appendData_Block(&d->partialLine, pos, chunk.end - pos);
+            break;
+        }
+        if (!isEmpty_Block(&d->partialLine)) {
+            appendData_Block(&d->partialLine, pos, lineEnd - pos);
+            parseLine_FeedParser_(d, range_Block(&d->partialLine));
+            clear_Block(&d->partialLine);
+        }
+        else {
+            parseLine_FeedParser_(d, (iRangecc){ pos, lineEnd });
+        }
+        pos = lineEnd + 1;
+    }
+}
+
+static void finish_FeedParser_(iFeedParser *d) {
+    if (!isEmpty_Block(&d->partialLine)) {
+        parseLine_FeedParser_(d, range_Block(&d->partialLine));
+        clear_Block(&d->partialLine);
+    }
+}
+
 static void parseResult_FeedJob_(iFeedJob *d) {
     /* TODO: Should tell the user if the request failed. */
     if (isSuccess_GmStatusCode(status_GmRequest(d->request))) {
         iBeginCollect();
-        iTime now;
-        initCurrent_Time(&now);
-        iRegExp *linkPattern =
-            new_RegExp("^=>\\s*([^\\s]+)\\s+"
-                       "([0-9][0-9][0-9][0-9]-[0-1][0-9]-[0-3][0-9])"
-                       "([^0-9].*)",
-                       0);
-        iString src;
-        initBlock_String(&src, body_GmRequest(d->request));
-        iRangecc srcLine = iNullRange;
-        while (nextSplit_Rangecc(range_String(&src), "\n", &srcLine)) {
-            iRangecc line = srcLine;
-            trimEnd_Rangecc(&line);
-            iRegExpMatch m;
-            init_RegExpMatch(&m);
-            if (matchRange_RegExp(linkPattern, line, &m)) {
-                const iRangecc url   = capturedRange_RegExpMatch(&m, 1);
-                const iRangecc date  = capturedRange_RegExpMatch(&m, 2);
-                const iRangecc title = capturedRange_RegExpMatch(&m, 3);
-                iFeedEntry *   entry = new_FeedEntry();
-                entry->discovered = now;
-                entry->bookmarkId = d->bookmarkId;
-                setRange_String(&entry->url, url);
-                set_String(&entry->url, absoluteUrl_String(url_GmRequest(d->request), &entry->url));
-                setRange_String(&entry->title, title);
-                trimTitle_(&entry->title);
-                int year, month, day;
-                sscanf(date.start, "%04d-%02d-%02d", &year, &month, &day);
-                init_Time(
-                    &entry->posted,
-                    &(iDate){
-                        .year = year, .month = month, .day = day, .hour = 12 /* noon UTC */ });
-                pushBack_PtrArray(&d->results, entry);
-            }
-            if (d->checkHeadings) {
-                init_RegExpMatch(&m);
-                if (startsWith_Rangecc(line, "#")) {
-                    while (*line.start == '#' && line.start < line.end) {
-                        line.start++;
-                    }
-                    trimStart_Rangecc(&line);
-                    iFeedEntry *entry = new_FeedEntry();
-                    entry->posted = now;
-                    if (!d->isFirstUpdate) {
-                        entry->discovered = now;
-                    }
-                    entry->bookmarkId = d->bookmarkId;
-                    iString *title = newRange_String(line);
-                    set_String(&entry->title, title);
-                    set_String(&entry->url, &d->url);
-                    appendChar_String(&entry->url, '#');
-                    append_String(&entry->url, collect_String(urlEncode_String(title)));
-                    delete_String(title);
-                    pushBack_PtrArray(&d->results, entry);
-                }
-            }
-        }
-        deinit_String(&src);
-        iRelease(linkPattern);
+        /* The complete body is available, since it has already been checked for changes. */
+        iFeedParser parser;
+        init_FeedParser_(&parser, d);
+        parse_FeedParser_(&parser, range_Block(body_GmRequest(d->request)));
+        finish_FeedParser_(&parser);
+        deinit_FeedParser_(&parser);
         iEndCollect();
     }
 }
 
 static void save_Feeds_(iFeeds *d) {
-    iFile *f = new_File(collect_String(concatCStr_Path(&d->saveDir, feedsFilename_Feeds_)));
-    if (open_File(f, write_FileMode | text_FileMode)) {
-        lock_Mutex(d->mtx);
-        iString *str = new_String();
-        format_String(str, "%llu\n# Feeds\n", integralSeconds_Time(&d->lastRefreshedAt));
-        write_File(f, utf8_String(str));
-        /* Index of feeds for IDs. */ {
-            iConstForEach(PtrArray, i, listSubscriptions_()) {
-                const iBookmark *bm = i.ptr;
-                format_String(str, "%08x %s\n", id_Bookmark(bm), cstr_String(&bm->url));
-                write_File(f, utf8_String(str));
+    iBuffer *buf = new_Buffer();
+    openEmpty_Buffer(buf);
+    iStream *outs = stream_Buffer(buf);
+    /* Only the encoding is done while holding the lock. */
+    lock_Mutex(d->mtx);
+    writeData_Buffer(buf, magic_Feeds_, 4);
+    writeU32_Stream(outs, latest_FileVersion);
+    writeU64_Stream(outs, integralSeconds_Time(&d->lastRefreshedAt));
+    /* Feeds and their schedules. Entries refer to feeds by bookmark ID. */ {
+        const iPtrArray *subs = listSubscriptions_();
+        writeU32_Stream(outs, size_PtrArray(subs));
+        iConstForEach(PtrArray, i, subs) {
+            const iBookmark * bm    = i.ptr;
+            const iFeedState *state = (const iFeedState *) value_Hash(&d->states, id_Bookmark(bm));
+            writeU32_Stream(outs, id_Bookmark(bm));
+            serialize_String(&bm->url, outs);
+            write8_Stream(outs, state != NULL);
+            if (state) {
+                writeU32_Stream(outs, state->contentHash);
+                writeU64_Stream(outs, integralSeconds_Time(&state->lastChecked));
+                writeU64_Stream(outs, integralSeconds_Time(&state->lastChanged));
+                writeU32_Stream(outs, state->interval);
             }
         }
-        writeData_File(f, "# Entries\n", 10);
-        iTime now;
-        initCurrent_Time(&now);
-        iConstForEach(Array, i, &d->entries.values) {
-            const iFeedEntry *entry = *(const iFeedEntry **) i.value;
-            if (isValid_Time(&entry->discovered) &&
-                secondsSince_Time(&now, &entry->discovered) > maxAge_Visited) {
-                continue; /* Forget entries discovered long ago. */
-            }
-            format_String(str, "%x\n%llu\n%llu\n%s\n%s\n",
-                          entry->bookmarkId,
-                          integralSeconds_Time(&entry->posted),
-                          integralSeconds_Time(&entry->discovered),
-                          cstr_String(&entry->url),
-                          cstr_String(&entry->title));
-            write_File(f, utf8_String(str));
+    }
+    iTime now;
+    initCurrent_Time(&now);
+    iPtrArray saved;
+    init_PtrArray(&saved);
+    iConstForEach(PtrArray, i, allEntries_Feeds_(d)) {
+        const iFeedEntry *entry = i.ptr;
+        if (isValid_Time(&entry->discovered) &&
+            secondsSince_Time(&now, &entry->discovered) > maxAge_Visited) {
+            continue; /* Forget entries discovered long ago. */
         }
-        delete_String(str);
+        pushBack_PtrArray(&saved, entry);
+    }
+    writeU32_Stream(outs, size_PtrArray(&saved));
+    iConstForEach(PtrArray, j, &saved) {
+        const iFeedEntry *entry = j.ptr;
+        writeU32_Stream(outs, entry->bookmarkId);
+        writeU64_Stream(outs, integralSeconds_Time(&entry->posted));
+        writeU64_Stream(outs, integralSeconds_Time(&entry->discovered));
+        serialize_String(&entry->url, outs);
+        serialize_String(&entry->title, outs);
+    }
+    deinit_PtrArray(&saved);
+    unlock_Mutex(d->mtx);
+    /* Replace the old file only when the new one has been fully written. */
+    const iString *path    = collect_String(concatCStr_Path(&d->saveDir, feedsFilename_Feeds_));
+    const iString *tmpPath = collectNewFormat_String("%s.tmp", cstr_String(path));
+    iBool ok = iFalse;
+    iFile *f = new_File(tmpPath);
+    if (open_File(f, writeOnly_FileMode)) {
+        ok = (write_File(f, data_Buffer(buf)) == size_Block(data_Buffer(buf)));
         close_File(f);
-        unlock_Mutex(d->mtx);
     }
     iRelease(f);
+    if (ok) {
+#if defined (iPlatformMsys)
+        remove(cstr_String(path)); /* rename() does not replace existing files */
+#endif
+        rename(cstr_String(tmpPath), cstr_String(path));
+    }
+    iRelease(buf);
 }
 
 static iBool isHeadingEntry_FeedEntry_(const iFeedEntry *d) {
@@ -295,9 +550,8 @@ static iBool updateEntries_Feeds_(iFeeds *d, iPtrArray *incoming) {
     lock_Mutex(d->mtx);
     iForEach(PtrArray, i, incoming) {
         iFeedEntry *entry = i.ptr;
-        size_t pos;
-        if (locate_SortedArray(&d->entries, &entry, &pos)) {
-            iFeedEntry *existing = *(iFeedEntry **) at_SortedArray(&d->entries, pos);
+        iFeedEntry *existing = findEntry_Feeds_(d, &entry->url);
+        if (existing) {
             iAssert(isHeadingEntry_FeedEntry_(existing) == isHeadingEntry_FeedEntry_(entry));
             /* Already known, but update it, maybe the time and label have changed. */
             if (!isHeadingEntry_FeedEntry_(existing)) {
@@ -322,7 +576,7 @@ static iBool updateEntries_Feeds_(iFeeds *d, iPtrArray *incoming) {
             }
         }
         else {
-            insert_SortedArray(&d->entries, &entry);
+            insertEntry_Feeds_(d, entry);
             gotNew = iTrue;
         }
         remove_PtrArrayIterator(&i);
@@ -334,53 +588,83 @@ static iBool updateEntries_Feeds_(iFeeds *d, iPtrArray *incoming) {
 static iThreadResult fetch_Feeds_(iThread *thread) {
     iFeeds *d = &feeds_;
     iUnused(thread);
-    iFeedJob *work[maxConcurrentRequests_Feeds]; /* We'll do a couple of concurrent requests. */
-    iZap(work);
+    iPtrArray work; /* ongoing jobs */
+    init_PtrArray(&work);
     iBool gotNew = iFalse;
     postCommand_App("feeds.update.started");
+    lock_Mutex(d->mtx);
     while (!d->stopWorker) {
-        /* Start new jobs. */
-        iForIndices(i, work) {
-            if (!work[i]) {
-                work[i] = startNextJob_Feeds_(d);
-            }
+        /* Start new jobs to fill the window of concurrent requests. */
+        while (size_PtrArray(&work) < maxConcurrentRequests_Feeds_() &&
+               !isEmpty_PtrArray(&d->jobs)) {
+            iFeedJob *job;
+            take_PtrArray(&d->jobs, 0, (void **) &job);
+            pushBack_PtrArray(&work, job);
+            unlock_Mutex(d->mtx);
+            submit_FeedJob_(job);
+            lock_Mutex(d->mtx);
         }
-        sleep_Thread(0.5); /* TODO: wait on a Condition so we can exit quickly */
-        if (d->stopWorker) break;
-        size_t ongoing = 0;
-        iForIndices(i, work) {
-            if (work[i]) {
-                if (isFinished_GmRequest(work[i]->request)) {
-                    /* TODO: Handle redirects. Need to resubmit the job with new URL. */
-                    parseResult_FeedJob_(work[i]);
-                    gotNew |= updateEntries_Feeds_(d, &work[i]->results);
-                    delete_FeedJob(work[i]);
-                    work[i] = NULL;
-                }
-                else {
-                    ongoing++;
+        /* Stop if everything has finished. */
+        if (isEmpty_PtrArray(&work)) {
+            break;
+        }
+        /* Requests signal when they finish; stalled ones time out on their own. */
+        iPtrArray finished;
+        init_PtrArray(&finished);
+        for (;;) {
+            iForEach(PtrArray, i, &work) {
+                iFeedJob *job = i.ptr;
+                if (job->isFinished) {
+                    pushBack_PtrArray(&finished, job);
+                    remove_PtrArrayIterator(&i);
                 }
-                /* TODO: abort job if it takes too long (> 15 seconds?) */
             }
+            if (!isEmpty_PtrArray(&finished) || d->stopWorker) {
+                break;
+            }
+            wait_Condition(&d->jobFinished, d->mtx);
         }
-        /* Stop if everything has finished. */
-        if (ongoing == 0 && isEmpty_PtrArray(&d->jobs)) {
-            break;
+        unlock_Mutex(d->mtx);
+        iForEach(PtrArray, j, &finished) {
+            iFeedJob *job = j.ptr;
+            /* TODO: Handle redirects. Need to resubmit the job with new URL. */
+            if (checkChanged_Feeds_(d, job)) {
+                parseResult_FeedJob_(job);
+                gotNew |= updateEntries_Feeds_(d, &job->results);
+            }
+            delete_FeedJob(job);
         }
+        deinit_PtrArray(&finished);
+        lock_Mutex(d->mtx);
     }
+    unlock_Mutex(d->mtx);
+    /* Ongoing requests are cancelled when stopping. */
+    iForEach(PtrArray, k, &work) {
+        delete_FeedJob(k.ptr);
+    }
+    deinit_PtrArray(&work);
     initCurrent_Time(&d->lastRefreshedAt);
     save_Feeds_(d);
     postCommandf_App("feeds.update.finished arg:%d", gotNew ? 1 : 0);
     return 0;
 }
 
-static iBool startWorker_Feeds_(iFeeds *d) {
+static iBool startWorker_Feeds_(iFeeds *d, iBool checkAll) {
     if (d->worker) {
         return iFalse; /* Refresh is already ongoing. */
     }
-    /* Queue up all the subscriptions for the worker. */
+    iTime now;
+    initCurrent_Time(&now);
+    /* Queue up the subscriptions for the worker. */
     iConstForEach(PtrArray, i, listSubscriptions_()) {
         const iBookmark *bm = i.ptr;
+        if (!checkAll) {
+            iBool isDue;
+            iGuardMutex(d->mtx, isDue = isDue_FeedState_(state_Feeds_(d, id_Bookmark(bm)), &now));
+            if (!isDue) {
+                continue;
+            }
+        }
         iFeedJob *job = new_FeedJob(bm);
         if (!contains_IntSet(&d->previouslyCheckedFeeds, id_Bookmark(bm))) {
             job->isFirstUpdate = iTrue;
@@ -401,13 +685,16 @@ static iBool startWorker_Feeds_(iFeeds *d) {
 
 static uint32_t refresh_Feeds_(uint32_t interval, void *data) {
     /* Called in the SDL timer thread, so let's start a worker thread for running the update. */
-    startWorker_Feeds_(&feeds_);
-    return 1000 * updateIntervalSeconds_Feeds_;
+    startWorker_Feeds_(&feeds_, iFalse);
+    return 1000 * minUpdateIntervalSeconds_Feeds_;
 }
 
 static void stopWorker_Feeds_(iFeeds *d) {
     if (d->worker) {
-        d->stopWorker = iTrue;
+        iGuardMutex(d->mtx, {
+            d->stopWorker = iTrue;
+            signal_Condition(&d->jobFinished);
+        });
         join_Thread(d->worker);
         iReleasePtr(&d->worker);
     }
@@ -418,11 +705,6 @@ static void stopWorker_Feeds_(iFeeds *d) {
     clear_PtrArray(&d->jobs);
 }
 
-static int cmp_FeedEntryPtr_(const void *a, const void *b) {
-    const iFeedEntry * const *elem[2] = { a, b };    
-    return cmpString_String(&(*elem[0])->url, &(*elem[1])->url);
-}
-
 iDeclareType(FeedHashNode)
 
 struct Impl_FeedHashNode {
@@ -430,9 +712,89 @@ struct Impl_FeedHashNode {
     uint32_t  bookmarkId;
 };
 
-static void load_Feeds_(iFeeds *d) {
-    /* TODO: If there are lots of entries, it would make sense to load async. */
+static iBool load_Feeds_(iFeeds *d) {
     iFile *f = new_File(collect_String(concatCStr_Path(&d->saveDir, feedsFilename_Feeds_)));
+    if (!open_File(f, readOnly_FileMode)) {
+        iRelease(f);
+        return iFalse;
+    }
+    iBlock *src = readAll_File(f);
+    iRelease(f);
+    iBuffer *buf = new_Buffer();
+    open_Buffer(buf, src);
+    iStream *ins = stream_Buffer(buf);
+    char magic[4];
+    iBool ok = iFalse;
+    if (size_Block(src) >= 8 && readData_Buffer(buf, 4, magic) == 4 &&
+        !memcmp(magic, magic_Feeds_, 4)) {
+        const uint32_t version = readU32_Stream(ins);
+        if (version <= latest_FileVersion) {
+            setVersion_Stream(ins, version);
+            ok = iTrue;
+        }
+    }
+    if (ok) {
+        iHash   feeds; /* mapping from saved IDs to current bookmark IDs */
+        iString url;
+        init_Hash(&feeds);
+        init_String(&url);
+        d->lastRefreshedAt.ts.tv_sec = readU64_Stream(ins);
+        for (uint32_t n = readU32_Stream(ins); n > 0 && !atEnd_Buffer(buf); n--) {
+            const uint32_t id = readU32_Stream(ins);
+            deserialize_String(&url, ins);
+            const uint32_t bookmarkId = findUrl_Bookmarks(bookmarks_App(), &url);
+            if (bookmarkId) {
+                iFeedHashNode *node = iMalloc(FeedHashNode);
+                node->node.key      = id;
+                node->bookmarkId    = bookmarkId;
+                free(insert_Hash(&feeds, &node->node));
+                insert_IntSet(&d->previouslyCheckedFeeds, bookmarkId);
+            }
+            if (read8_Stream(ins)) {
+                const uint32_t           contentHash = readU32_Stream(ins);
+                const unsigned long long checked     = readU64_Stream(ins);
+                const unsigned long long changed     = readU64_Stream(ins);
+                const int                interval    = readU32_Stream(ins);
+                if (bookmarkId) {
+                    iFeedState *state = state_Feeds_(d, bookmarkId);
+                    state->contentHash           = contentHash;
+                    state->lastChecked.ts.tv_sec = checked;
+                    state->lastChanged.ts.tv_sec = changed;
+                    state->interval = iClamp(interval,
+                                             minUpdateIntervalSeconds_Feeds_,
+                                             maxUpdateIntervalSeconds_Feeds_);
+                }
+            }
+        }
+        for (uint32_t n = readU32_Stream(ins); n > 0 && !atEnd_Buffer(buf); n--) {
+            const uint32_t feedId = readU32_Stream(ins);
+            iFeedEntry *entry = new_FeedEntry();
+            entry->posted.ts.tv_sec     = readU64_Stream(ins);
+            entry->discovered.ts.tv_sec = readU64_Stream(ins);
+            deserialize_String(&entry->url, ins);
+            deserialize_String(&entry->title, ins);
+            const iFeedHashNode *node = (const iFeedHashNode *) value_Hash(&feeds, feedId);
+            if (node && !findEntry_Feeds_(d, &entry->url)) {
+                entry->bookmarkId = node->bookmarkId;
+                insertEntry_Feeds_(d, entry);
+            }
+            else {
+                delete_FeedEntry(entry);
+            }
+        }
+        deinit_String(&url);
+        iForEach(Hash, i, &feeds) {
+            free(i.value);
+        }
+        deinit_Hash(&feeds);
+    }
+    iRelease(buf);
+    delete_Block(src);
+    return ok;
+}
+
+static void loadOld_Feeds_(iFeeds *d) {
+    iFile *f = new_File(collect_String(concatCStr_Path(&d->saveDir, oldFeedsFilename_Feeds_)));
     if (open_File(f, read_FileMode | text_FileMode)) {
         iBlock * src     = readAll_File(f);
         iRangecc line    = iNullRange;
@@ -447,6 +809,10 @@ static void load_Feeds_(iFeeds *d) {
                 section = 2;
                 continue;
             }
+            else if (equal_Rangecc(line, "# Schedule")) {
+                section = 3;
+                continue;
+            }
             switch (section) {
                 case 0: {
                     unsigned long long ts = 0;
@@ -510,12 +876,36 @@ static void load_Feeds_(iFeeds *d) {
                         set_String(&entry->url, url);
                         stripDefaultUrlPort_String(&entry->url);
                         set_String(&entry->title, title);
-                        insert_SortedArray(&d->entries, &entry);
+                        if (!findEntry_Feeds_(d, &entry->url)) {
+                            insertEntry_Feeds_(d, entry);
+                        }
+                        else {
+                            delete_FeedEntry(entry);
+                        }
                     }
                     delete_String(title);
                     delete_String(url);
                     break;
                 }
+                case 3: {
+                    uint32_t           feedId = 0, contentHash = 0;
+                    unsigned long long checked = 0, changed = 0;
+                    int                interval = 0;
+                    if (sscanf(line.start, "%08x %08x %llu %llu %d",
+                               &feedId, &contentHash, &checked, &changed, &interval) == 5) {
+                        const iFeedHashNode *node = (iFeedHashNode *) value_Hash(feeds, feedId);
+                        if (node) {
+                            iFeedState *state = state_Feeds_(d, node->bookmarkId);
+                            state->contentHash           = contentHash;
+                            state->lastChecked.ts.tv_sec = checked;
+                            state->lastChanged.ts.tv_sec = changed;
+                            state->interval = iClamp(interval,
+                                                     minUpdateIntervalSeconds_Feeds_,
+                                                     maxUpdateIntervalSeconds_Feeds_);
+                        }
+                    }
+                    break;
+                }
             }
         }
     aborted:
@@ -538,14 +928,20 @@ void init_Feeds(const char *saveDir) {
     init_IntSet(&d->previouslyCheckedFeeds);
     iZap(d->lastRefreshedAt);
     d->worker = NULL;
+    d->stopWorker = iFalse;
+    init_Condition(&d->jobFinished);
     init_PtrArray(&d->jobs);
-    init_SortedArray(&d->entries, sizeof(iFeedEntry *), cmp_FeedEntryPtr_);
-    load_Feeds_(d);
-    /* Update feeds if it has been a while. */
-    int intervalSec = updateIntervalSeconds_Feeds_;
+    init_Hash(&d->states);
+    init_Hash(&d->entries);
+    d->numEntries = 0;
+    if (!load_Feeds_(d)) {
+        loadOld_Feeds_(d);
+    }
+    /* Check for due feeds if it has been a while. */
+    int intervalSec = minUpdateIntervalSeconds_Feeds_;
     if (isValid_Time(&d->lastRefreshedAt)) {
         const double elapsed = elapsedSeconds_Time(&d->lastRefreshedAt);
-        intervalSec = iMax(1, updateIntervalSeconds_Feeds_ - elapsed);
+        intervalSec = iMax(1, minUpdateIntervalSeconds_Feeds_ - elapsed);
     }
     d->refreshTimer = SDL_AddTimer(1000 * intervalSec, refresh_Feeds_, NULL);
 }
@@ -556,33 +952,36 @@ void deinit_Feeds(void) {
     stopWorker_Feeds_(d);
     iAssert(isEmpty_PtrArray(&d->jobs));
     deinit_PtrArray(&d->jobs);
+    deinit_Condition(&d->jobFinished);
     deinit_String(&d->saveDir);
     delete_Mutex(d->mtx);
-    iForEach(Array, i, &d->entries.values) {
-        iFeedEntry **entry = i.value;
-        delete_FeedEntry(*entry);
+    removeEntriesIf_Feeds_(d, NULL, 0);
+    iForEach(Hash, s, &d->states) {
+        free(s.value);
     }
+    deinit_Hash(&d->states);
     deinit_IntSet(&d->previouslyCheckedFeeds);
-    deinit_SortedArray(&d->entries);
+    deinit_Hash(&d->entries);
 }
 
 void refresh_Feeds(void) {
-    startWorker_Feeds_(&feeds_);
+    startWorker_Feeds_(&feeds_, iTrue);
 }
 
 void refreshFinished_Feeds(void) {
     stopWorker_Feeds_(&feeds_);
 }
 
+static iBool isFromFeed_FeedEntry_(const iFeedEntry *d, uint32_t feedBookmarkId) {
+    return d->bookmarkId == feedBookmarkId;
+}
+
 void removeEntries_Feeds(uint32_t feedBookmarkId) {
     iFeeds *d = &feeds_;
-    iForEach(Array, i, &d->entries.values) {
-        iFeedEntry **entry = i.value;
-        if ((*entry)->bookmarkId == feedBookmarkId) {
-            delete_FeedEntry(*entry);
-            remove_ArrayIterator(&i);
-        }
-    }
+    iGuardMutex(d->mtx, {
+        free(remove_Hash(&d->states, feedBookmarkId));
+        removeEntriesIf_Feeds_(d, isFromFeed_FeedEntry_, feedBookmarkId);
+    });
 }
 
 static int cmpTimeDescending_FeedEntryPtr_(const void *a, const void *b) {
@@ -593,9 +992,9 @@ static int cmpTimeDescending_FeedEntryPtr_(const void *a, const void *b) {
 const iPtrArray *listEntries_Feeds(void) {
     iFeeds *d = &feeds_;
     lock_Mutex(d->mtx);
-    /* The worker will never delete feed entries so we can use the same ones. Just make a copy
-       of the array in case the worker modifies it. */
-    iPtrArray *list = collect_PtrArray(copy_Array(&d->entries.values));
+    /* The worker will never delete feed entries so we can use the same ones. The list is
+       a snapshot in case the worker modifies the table. */
+    iPtrArray *list = allEntries_Feeds_(d);
     unlock_Mutex(d->mtx);
     sort_Array(list, cmpTimeDescending_FeedEntryPtr_);
     return list;
@@ -620,7 +1019,7 @@ const iString *entryListPage_Feeds(void) {
         size_PtrArray(subs),
         iPluralS(size_PtrArray(subs)),
         size_PtrArray(subs) == 1 ? "s" : "",
-        size_SortedArray(&d->entries));
+        d->numEntries);
     if (isValid_Time(&d->lastRefreshedAt)) {
         appendFormat_String(src,
             "\nThe latest refresh occurred %s.\n",
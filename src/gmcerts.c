@@ -23,50 +23,82 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 #include "gmcerts.h"
 #include "defs.h"
 
+#include <the_Foundation/atomic.h>
 #include <the_Foundation/file.h>
 #include <the_Foundation/fileinfo.h>
 #include <the_Foundation/mutex.h>
 #include <the_Foundation/path.h>
-#include <the_Foundation/regexp.h>
+#include <the_Foundation/sortedarray.h>
 #include <the_Foundation/stringarray.h>
-#include <the_Foundation/stringhash.h>
 #include <the_Foundation/stringlist.h>
+#include <the_Foundation/thread.h>
 #include <the_Foundation/time.h>
 #include <ctype.h>
+#include <stdio.h> /* rename(), remove() */
 
 static const char *filename_GmCerts_          = "trusted.txt";
 static const char *identsDir_GmCerts_         = "idents";
 static const char *oldIdentsFilename_GmCerts_ = "idents.binary";
 static const char *identsFilename_GmCerts_    = "idents.lgr";
 
-iDeclareClass(TrustEntry)
+enum { maxFingerprintSize_TrustEntry = 64 };
 
+iDeclareType(TrustEntry)
+
+/* Trust tables are sorted arrays of these, so lookups need no allocations. */
 struct Impl_TrustEntry {
-    iObject object;
-    iBlock fingerprint;
-    iTime validUntil;
+    uint32_t       domainHash;
+    const iString *domain; /* owned by GmCerts */
+    iTime          validUntil;
+    size_t         fingerprintSize;
+    uint8_t        fingerprint[maxFingerprintSize_TrustEntry];
 };
 
-void init_TrustEntry(iTrustEntry *d, const iBlock *fingerprint, const iDate *until) {
-    initCopy_Block(&d->fingerprint, fingerprint);
-    init_Time(&d->validUntil, until);
+static int cmp_TrustEntry_(const void *a, const void *b) {
+    const iTrustEntry *x = a, *y = b;
+    const int cmp = iCmp(x->domainHash, y->domainHash);
+    return cmp ? cmp : cmpString_String(x->domain, y->domain);
 }
 
-void deinit_TrustEntry(iTrustEntry *d) {
-    deinit_Block(&d->fingerprint);
+static void setFingerprint_TrustEntry_(iTrustEntry *d, const iBlock *fingerprint) {
+    d->fingerprintSize = iMin(size_Block(fingerprint), sizeof(d->fingerprint));
+    memcpy(d->fingerprint, constData_Block(fingerprint), d->fingerprintSize);
+}
+
+static void setCertificate_TrustEntry_(iTrustEntry *d, const iTlsCertificate *cert) {
+    iBlock *fingerprint = fingerprint_TlsCertificate(cert);
+    setFingerprint_TrustEntry_(d, fingerprint);
+    delete_Block(fingerprint);
+}
+
+static iBool equalFingerprint_TrustEntry_(const iTrustEntry *d, const iTrustEntry *other) {
+    return d->fingerprintSize == other->fingerprintSize &&
+           memcmp(d->fingerprint, other->fingerprint, d->fingerprintSize) == 0;
 }
 
-iDefineObjectConstructionArgs(TrustEntry,
-                              (const iBlock *fingerprint, const iDate *until),
-                              fingerprint, until)
-iDefineClass(TrustEntry)
+static const iTrustEntry *find_TrustEntry_(const iSortedArray *table, iRangecc domain) {
+    const iString key = { iBlockLiteral(domain.start, size_Range(&domain), size_Range(&domain)) };
+    size_t pos;
+    if (locate_SortedArray(table,
+                           &(iTrustEntry){ .domainHash = crc32_Block(&key.chars), .domain = &key },
+                           &pos)) {
+        return constAt_SortedArray(table, pos);
+    }
+    return NULL;
+}
 
 /*----------------------------------------------------------------------------------------------*/
 
+static iAtomicInt useGeneration_GmIdentity_; /* changed when any identity's use changes */
+
 static int cmpUrl_GmIdentity_(const iString *a, const iString *b) {
     return cmpStringCase_String(a, b);
 }
 
+static void useChanged_GmIdentity_(void) {
+    add_Atomic(&useGeneration_GmIdentity_, 1);
+}
+
 void init_GmIdentity(iGmIdentity *d) {
     d->icon  = 0x1f511; /* key */
     d->flags = 0;
@@ -170,14 +202,17 @@ void setUse_GmIdentity(iGmIdentity *d, const iString *url, iBool use) {
 #endif
         insert_StringSet(d->useUrls, url);
         iAssert(wasInserted);
+        useChanged_GmIdentity_();
     }
     else {
         remove_StringSet(d->useUrls, url);
+        useChanged_GmIdentity_();
     }
 }
 
 void clearUse_GmIdentity(iGmIdentity *d) {
     clear_StringSet(d->useUrls);
+    useChanged_GmIdentity_();
 }
 
 const iString *name_GmIdentity(const iGmIdentity *d) {
@@ -188,11 +223,37 @@ iDefineTypeConstruction(GmIdentity)
 
 /*-----------------------------------------------------------------------------------------------*/
 
+iDeclareType(UseTrieNode)
+
+struct Impl_UseTrieNode {
+    uint32_t child;    /* first child node, or zero */
+    uint32_t sibling;  /* next sibling node, or zero */
+    int      identity; /* lowest index of an identity used on this prefix, or -1 */
+    char     ch;       /* lowercase */
+};
+
 struct Impl_GmCerts {
     iMutex *mtx;
     iString saveDir;
-    iStringHash *trusted;
     iPtrArray idents;
+    /* Trusted certificates are checked by many request threads at once, so they are read
+       without locking. There are two copies of the trust table: readers use the current one
+       while the other is modified (with the mutex locked) and then made current. */
+    iSortedArray trust[2]; /* iTrustEntry */
+    iAtomicInt currentTrust;
+    iAtomicInt numTrustReaders[2];
+    iCondition trustReleased; /* last reader of the other table is done */
+    iTrustEntry lastTrustChange; /* not yet made in the other table */
+    iBool hasLastTrustChange;
+    iPtrArray trustDomains; /* iString *, in no particular order */
+    /* Prefix trie of the URLs where identities are used. Rebuilt when the use changes. */
+    iArray useTrie; /* iUseTrieNode, root first */
+    int useTrieGeneration;
+    /* Trusted certificates are saved in a background thread. */
+    iThread *saver;
+    iCondition saveRequested;
+    iBool isTrustDirty;
+    iBool isStopping;
 };
 
 static const char *magicIdMeta_GmCerts_   = "lgL2";
@@ -216,25 +277,129 @@ static void saveIdentities_GmCerts_(const iGmCerts *d) {
     iRelease(f);
 }
 
-static void save_GmCerts_(const iGmCerts *d) {
+static void endReadTrust_GmCerts_(const iGmCerts *d, int index) {
+    iGmCerts *m = iConstCast(iGmCerts *, d);
+    if (add_Atomic(&m->numTrustReaders[index], -1) == 1 &&
+        value_Atomic(&m->currentTrust) != index) {
+        /* A writer may be waiting for the other table. */
+        iGuardMutex(m->mtx, signal_Condition(&m->trustReleased));
+    }
+}
+
+static const iSortedArray *beginReadTrust_GmCerts_(const iGmCerts *d, int *index_out) {
+    iGmCerts *m = iConstCast(iGmCerts *, d);
+    for (;;) {
+        const int index = value_Atomic(&m->currentTrust);
+        add_Atomic(&m->numTrustReaders[index], 1);
+        if (value_Atomic(&m->currentTrust) == index) {
+            *index_out = index;
+            return &d->trust[index];
+        }
+        endReadTrust_GmCerts_(d, index); /* switched just now, try again */
+    }
+}
+
+static void setTrust_GmCerts_(iGmCerts *d, iRangecc domain, const iTrustEntry *trusted) {
+    /* Called with the mutex locked. The other table lags behind the current one by the
+       previous change, so it is caught up before making this change to it. `trusted` has
+       the fingerprint and expiration time. */
+    const int current = value_Atomic(&d->currentTrust);
+    const int next    = 1 - current;
+    while (value_Atomic(&d->numTrustReaders[next])) {
+        /* Readers of the previous version only need a moment to finish a lookup. */
+        wait_Condition(&d->trustReleased, d->mtx);
+    }
+    iSortedArray *table = &d->trust[next];
+    if (d->hasLastTrustChange) {
+        insert_SortedArray(table, &d->lastTrustChange); /* replaces the old entry */
+    }
+    iTrustEntry entry;
+    const iTrustEntry *old = find_TrustEntry_(&d->trust[current], domain);
+    if (old) {
+        entry = *old;
+    }
+    else {
+        iString *domainStr = newRange_String(domain);
+        pushBack_PtrArray(&d->trustDomains, domainStr);
+        entry = (iTrustEntry){ .domainHash = crc32_Block(&domainStr->chars), .domain = domainStr };
+    }
+    entry.validUntil      = trusted->validUntil;
+    entry.fingerprintSize = trusted->fingerprintSize;
+    memcpy(entry.fingerprint, trusted->fingerprint, trusted->fingerprintSize);
+    insert_SortedArray(table, &entry);
+    d->lastTrustChange    = entry;
+    d->hasLastTrustChange = iTrue;
+    set_Atomic(&d->currentTrust, next);
+}
+
+static void encodeTrusted_GmCerts_(const iGmCerts *d, iString *out) {
+    /* Called with the mutex locked, so the current table will not change. */
+    iBlock fingerprint;
+    init_Block(&fingerprint, 0);
     iBeginCollect();
-    iFile *f = new_File(collect_String(concatCStr_Path(&d->saveDir, filename_GmCerts_)));
+    iConstForEach(Array, i, &d->trust[value_Atomic(&d->currentTrust)].values) {
+        const iTrustEntry *trust = i.value;
+        setData_Block(&fingerprint, trust->fingerprint, trust->fingerprintSize);
+        appendFormat_String(out,
+                            "%s %ld %s\n",
+                            cstr_String(trust->domain),
+                            integralSeconds_Time(&trust->validUntil),
+                            cstrCollect_String(hexEncode_Block(&fingerprint)));
+    }
+    iEndCollect();
+    deinit_Block(&fingerprint);
+}
+
+static void writeTrusted_GmCerts_(const iGmCerts *d, const iString *src) {
+    /* The complete file replaces the old one, so a crash cannot leave it truncated. */
+    iString *path    = concatCStr_Path(&d->saveDir, filename_GmCerts_);
+    iString *tmpPath = copy_String(path);
+    appendCStr_String(tmpPath, ".tmp");
+    iBool ok = iFalse;
+    iFile *f = new_File(tmpPath);
     if (open_File(f, writeOnly_FileMode | text_FileMode)) {
-        iString line;
-        init_String(&line);
-        iConstForEach(StringHash, i, d->trusted) {
-            const iTrustEntry *trust = value_StringHashNode(i.value);
-            format_String(&line,
-                          "%s %ld %s\n",
-                          cstr_String(key_StringHashConstIterator(&i)),
-                          integralSeconds_Time(&trust->validUntil),
-                          cstrCollect_String(hexEncode_Block(&trust->fingerprint)));
-            write_File(f, &line.chars);
-        }
-        deinit_String(&line);
+        ok = (write_File(f, &src->chars) == size_String(src));
+        close_File(f);
     }
     iRelease(f);
-    iEndCollect();
+    if (ok) {
+#if defined (iPlatformMsys)
+        remove(cstr_String(path)); /* rename() does not replace existing files */
+#endif
+        rename(cstr_String(tmpPath), cstr_String(path));
+    }
+    delete_String(tmpPath);
+    delete_String(path);
+}
+
+static iThreadResult saveTrusted_GmCerts_(iThread *thread) {
+    iGmCerts *d = userData_Thread(thread);
+    lock_Mutex(d->mtx);
+    for (;;) {
+        while (!d->isStopping && !d->isTrustDirty) {
+            wait_Condition(&d->saveRequested, d->mtx);
+        }
+        if (!d->isTrustDirty) {
+            break; /* stopping, and everything has been saved */
+        }
+        /* Changes made while the file is being written are saved together afterwards. */
+        iString src;
+        init_String(&src);
+        encodeTrusted_GmCerts_(d, &src);
+        d->isTrustDirty = iFalse;
+        unlock_Mutex(d->mtx);
+        writeTrusted_GmCerts_(d, &src);
+        deinit_String(&src);
+        lock_Mutex(d->mtx);
+    }
+    unlock_Mutex(d->mtx);
+    return 0;
+}
+
+static void requestSave_GmCerts_(iGmCerts *d) {
+    /* Called with the mutex locked. */
+    d->isTrustDirty = iTrue;
+    signal_Condition(&d->saveRequested);
 }
 
 static void loadIdentities_GmCerts_(iGmCerts *d) {
@@ -306,27 +471,36 @@ static void loadIdentityFromCertificate_GmCerts_(iGmCerts *d, const iString *crt
 static void load_GmCerts_(iGmCerts *d) {
     iFile *f = new_File(collect_String(concatCStr_Path(&d->saveDir, filename_GmCerts_)));
     if (open_File(f, readOnly_FileMode | text_FileMode)) {
-        iRegExp *      pattern = new_RegExp("([^\\s]+) ([0-9]+) ([a-z0-9]+)", 0);
-        const iRangecc src     = range_Block(collect_Block(readAll_File(f)));
-        iRangecc       line    = iNullRange;
+        /* Each line is: domain, expiration time in seconds, and the hex fingerprint. */
+        iSortedArray * table = &d->trust[0];
+        const iRangecc src   = range_Block(collect_Block(readAll_File(f)));
+        iRangecc       line  = iNullRange;
         while (nextSplit_Rangecc(src, "\n", &line)) {
-            iRegExpMatch m;
-            init_RegExpMatch(&m);
-            if (matchRange_RegExp(pattern, line, &m)) {
-                const iRangecc domain = capturedRange_RegExpMatch(&m, 1);
-                const iRangecc until  = capturedRange_RegExpMatch(&m, 2);
-                const iRangecc fp     = capturedRange_RegExpMatch(&m, 3);
-                time_t sec;
-                sscanf(until.start, "%ld", &sec);
-                iDate untilDate;
-                initSinceEpoch_Date(&untilDate, sec);
-                insert_StringHash(d->trusted,
-                                  collect_String(newRange_String(domain)),
-                                  new_TrustEntry(collect_Block(hexDecode_Rangecc(fp)),
-                                                 &untilDate));
+            iRangecc fields[3];
+            iRangecc field = iNullRange;
+            size_t   count = 0;
+            while (count < 3 && nextSplit_Rangecc(line, " ", &field)) {
+                if (!isEmpty_Range(&field)) {
+                    fields[count++] = field;
+                }
             }
+            if (count < 3 || !isdigit(*fields[1].start)) {
+                continue;
+            }
+            trimEnd_Rangecc(&fields[2]);
+            iBlock *fingerprint = hexDecode_Rangecc(fields[2]);
+            iDate untilDate;
+            initSinceEpoch_Date(&untilDate, strtoll(fields[1].start, NULL, 10));
+            iString *domain = newRange_String(fields[0]);
+            pushBack_PtrArray(&d->trustDomains, domain);
+            iTrustEntry entry = { .domainHash = crc32_Block(&domain->chars), .domain = domain };
+            init_Time(&entry.validUntil, &untilDate);
+            setFingerprint_TrustEntry_(&entry, fingerprint);
+            insert_SortedArray(table, &entry); /* a later duplicate replaces the earlier */
+            delete_Block(fingerprint);
         }
-        iRelease(pattern);
+        /* Both tables start out the same. Afterwards they are changed incrementally. */
+        setCopy_Array(&d->trust[1].values, &table->values);
     }
     iRelease(f);
     /* Load all identity certificates. */ {
@@ -355,21 +529,53 @@ static void load_GmCerts_(iGmCerts *d) {
 void init_GmCerts(iGmCerts *d, const char *saveDir) {
     d->mtx = new_Mutex();
     initCStr_String(&d->saveDir, saveDir);
-    d->trusted = new_StringHash();
     init_PtrArray(&d->idents);
+    iForIndices(i, d->trust) {
+        init_SortedArray(&d->trust[i], sizeof(iTrustEntry), cmp_TrustEntry_);
+        set_Atomic(&d->numTrustReaders[i], 0);
+    }
+    set_Atomic(&d->currentTrust, 0);
+    init_Condition(&d->trustReleased);
+    d->hasLastTrustChange = iFalse;
+    init_PtrArray(&d->trustDomains);
+    init_Array(&d->useTrie, sizeof(iUseTrieNode));
+    d->useTrieGeneration = value_Atomic(&useGeneration_GmIdentity_) - 1; /* needs building */
     load_GmCerts_(d);
+    init_Condition(&d->saveRequested);
+    d->isTrustDirty = iFalse;
+    d->isStopping = iFalse;
+    d->saver = new_Thread(saveTrusted_GmCerts_);
+    setUserData_Thread(d->saver, d);
+    start_Thread(d->saver);
 }
 
 void deinit_GmCerts(iGmCerts *d) {
+    /* Let the saver write any remaining changes. */ {
+        iGuardMutex(d->mtx, {
+            d->isStopping = iTrue;
+            signal_Condition(&d->saveRequested);
+        });
+        join_Thread(d->saver);
+        iRelease(d->saver);
+        deinit_Condition(&d->saveRequested);
+    }
     iGuardMutex(d->mtx, {
         saveIdentities_GmCerts_(d);
         iForEach(PtrArray, i, &d->idents) {
             delete_GmIdentity(i.ptr);
         }
         deinit_PtrArray(&d->idents);
-        iRelease(d->trusted);
+        iForIndices(j, d->trust) {
+            deinit_SortedArray(&d->trust[j]);
+        }
+        iForEach(PtrArray, k, &d->trustDomains) {
+            delete_String(k.ptr);
+        }
+        deinit_PtrArray(&d->trustDomains);
+        deinit_Array(&d->useTrie);
         deinit_String(&d->saveDir);
     });
+    deinit_Condition(&d->trustReleased);
     delete_Mutex(d->mtx);
 }
 
@@ -383,69 +589,61 @@ iBool checkTrust_GmCerts(iGmCerts *d, iRangecc domain, const iTlsCertificate *ce
     if (!verifyDomain_TlsCertificate(cert, domain)) {
         return iFalse;
     }
-    /* TODO: Could call setTrusted_GmCerts() instead of duplicating the trust-setting. */
-    /* Good certificate. If not already trusted, add it now. */
-    iString *key = newRange_String(domain);
-    iDate until;
-    validUntil_TlsCertificate(cert, &until);
-    iBlock *fingerprint = fingerprint_TlsCertificate(cert);
-    lock_Mutex(d->mtx);
-    iTrustEntry *trust = value_StringHash(d->trusted, key);
-    if (trust) {
-        /* We already have it, check if it matches the one we trust for this domain (if it's
-           still valid. */
-        iTime now;
-        initCurrent_Time(&now);
-        if (secondsSince_Time(&trust->validUntil, &now) > 0) {
+    iTime now;
+    initCurrent_Time(&now);
+    iTrustEntry checked; /* fingerprint compared as is, no block */
+    setCertificate_TrustEntry_(&checked, cert);
+    /* Most checks are for domains that are already trusted. */ {
+        int index;
+        const iTrustEntry *trust = find_TrustEntry_(beginReadTrust_GmCerts_(d, &index), domain);
+        if (trust && secondsSince_Time(&trust->validUntil, &now) > 0) {
             /* Trusted cert is still valid. */
-            const iBool isTrusted = cmp_Block(fingerprint, &trust->fingerprint) == 0;
-            unlock_Mutex(d->mtx);
-            delete_Block(fingerprint);
-            delete_String(key);
+            const iBool isTrusted = equalFingerprint_TrustEntry_(trust, &checked);
+            endReadTrust_GmCerts_(d, index);
             return isTrusted;
         }
-        /* Update the trusted cert. */
-        init_Time(&trust->validUntil, &until);
-        set_Block(&trust->fingerprint, fingerprint);
+        endReadTrust_GmCerts_(d, index);
+    }
+    /* Good certificate. If not already trusted, add it now. */
+    iBool isTrusted = iTrue;
+    lock_Mutex(d->mtx);
+    /* Another thread may have trusted a certificate for the domain in the meantime. */
+    const iTrustEntry *trust =
+        find_TrustEntry_(&d->trust[value_Atomic(&d->currentTrust)], domain);
+    if (trust && secondsSince_Time(&trust->validUntil, &now) > 0) {
+        isTrusted = equalFingerprint_TrustEntry_(trust, &checked);
     }
     else {
-        insert_StringHash(d->trusted, key, iClob(new_TrustEntry(fingerprint, &until)));
+        iDate until;
+        validUntil_TlsCertificate(cert, &until);
+        init_Time(&checked.validUntil, &until);
+        setTrust_GmCerts_(d, domain, &checked);
+        requestSave_GmCerts_(d);
     }
-    save_GmCerts_(d);
     unlock_Mutex(d->mtx);
-    delete_Block(fingerprint);
-    delete_String(key);
-    return iTrue;
+    return isTrusted;
 }
 
 void setTrusted_GmCerts(iGmCerts *d, iRangecc domain, const iBlock *fingerprint,
                         const iDate *validUntil) {
-    iString *key = collect_String(newRange_String(domain));
+    iTrustEntry trusted;
+    init_Time(&trusted.validUntil, validUntil);
+    setFingerprint_TrustEntry_(&trusted, fingerprint);
     lock_Mutex(d->mtx);
-    iTrustEntry *trust = value_StringHash(d->trusted, key);
-    if (trust) {
-        init_Time(&trust->validUntil, validUntil);
-        set_Block(&trust->fingerprint, fingerprint);
-    }
-    else {
-        insert_StringHash(d->trusted, key, iClob(trust = new_TrustEntry(fingerprint, validUntil)));
-    }
-    save_GmCerts_(d);
+    setTrust_GmCerts_(d, domain, &trusted);
+    requestSave_GmCerts_(d);
     unlock_Mutex(d->mtx);
 }
 
 iTime domainValidUntil_GmCerts(const iGmCerts *d, iRangecc domain) {
     iTime expiry;
     iZap(expiry);
-    lock_Mutex(d->mtx);
-    iString key;
-    initRange_String(&key, domain);
-    const iTrustEntry *trust = constValue_StringHash(d->trusted, &key);
+    int index;
+    const iTrustEntry *trust = find_TrustEntry_(beginReadTrust_GmCerts_(d, &index), domain);
     if (trust) {
         expiry = trust->validUntil;
     }
-    deinit_String(&key);
-    unlock_Mutex(d->mtx);
+    endReadTrust_GmCerts_(d, index);
     return expiry;
 }
 
@@ -457,22 +655,77 @@ const iGmIdentity *constIdentity_GmCerts(const iGmCerts *d, unsigned int id) {
     return constAt_PtrArray(&d->idents, id);
 }
 
-const iGmIdentity *identityForUrl_GmCerts(const iGmCerts *d, const iString *url) {
-    lock_Mutex(d->mtx);
-    const iGmIdentity *found = NULL;
+static uint32_t findChild_UseTrie_(const iArray *trie, uint32_t node, char ch) {
+    for (uint32_t child = ((const iUseTrieNode *) constAt_Array(trie, node))->child; child;
+         child = ((const iUseTrieNode *) constAt_Array(trie, child))->sibling) {
+        if (((const iUseTrieNode *) constAt_Array(trie, child))->ch == ch) {
+            return child;
+        }
+    }
+    return 0;
+}
+
+static void insert_UseTrie_(iArray *trie, const iString *url, int identity) {
+    uint32_t node = 0;
+    for (const char *ch = cstr_String(url); *ch; ch++) {
+        const char lower = tolower((unsigned char) *ch);
+        uint32_t   child = findChild_UseTrie_(trie, node, lower);
+        if (!child) {
+            iUseTrieNode *parent = at_Array(trie, node);
+            const iUseTrieNode newNode = {
+                .child = 0, .sibling = parent->child, .identity = -1, .ch = lower
+            };
+            child = size_Array(trie);
+            parent->child = child;
+            pushBack_Array(trie, &newNode); /* `parent` is invalid after this */
+        }
+        node = child;
+    }
+    iUseTrieNode *end = at_Array(trie, node);
+    if (end->identity < 0 || identity < end->identity) {
+        end->identity = identity;
+    }
+}
+
+static void updateUseTrie_GmCerts_(iGmCerts *d) {
+    /* Called with the mutex locked. */
+    const int generation = value_Atomic(&useGeneration_GmIdentity_);
+    if (generation == d->useTrieGeneration) {
+        return;
+    }
+    clear_Array(&d->useTrie);
+    const iUseTrieNode root = { .child = 0, .sibling = 0, .identity = -1, .ch = 0 };
+    pushBack_Array(&d->useTrie, &root);
+    int index = 0;
     iConstForEach(PtrArray, i, &d->idents) {
         const iGmIdentity *ident = i.ptr;
         iConstForEach(StringSet, j, ident->useUrls) {
-            const iString *used = j.value;
-            if (startsWithCase_String(url, cstr_String(used))) {
-                found = ident;
-                goto done;
-            }
+            insert_UseTrie_(&d->useTrie, j.value, index);
+        }
+        index++;
+    }
+    d->useTrieGeneration = generation;
+}
+
+const iGmIdentity *identityForUrl_GmCerts(const iGmCerts *d, const iString *url) {
+    /* The identity that comes first is used, if several are used on prefixes of the URL. */
+    iGmCerts *m = iConstCast(iGmCerts *, d);
+    lock_Mutex(d->mtx);
+    updateUseTrie_GmCerts_(m);
+    int      found = ((const iUseTrieNode *) constAt_Array(&d->useTrie, 0))->identity;
+    uint32_t node  = 0;
+    for (const char *ch = cstr_String(url); *ch; ch++) {
+        if ((node = findChild_UseTrie_(&d->useTrie, node, tolower((unsigned char) *ch))) == 0) {
+            break;
+        }
+        const int identity = ((const iUseTrieNode *) constAt_Array(&d->useTrie, node))->identity;
+        if (identity >= 0 && (found < 0 || identity < found)) {
+            found = identity;
         }
     }
-done:
+    const iGmIdentity *ident = found >= 0 ? constAt_PtrArray(&d->idents, found) : NULL;
     unlock_Mutex(d->mtx);
-    return found;
+    return ident;
 }
 
 static iGmIdentity *add_GmCerts_(iGmCerts *d, iTlsCertificate *cert, int flags) {
@@ -537,6 +790,7 @@ void deleteIdentity_GmCerts(iGmCerts *d, iGmIdentity *identity) {
     }
     removeOne_PtrArray(&d->idents, identity);
     collect_GmIdentity(identity);
+    useChanged_GmIdentity_(); /* identity indices have changed */
     unlock_Mutex(d->mtx);
 }
 
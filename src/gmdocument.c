@@ -39,6 +39,7 @@ iDeclareType(GmLink)
 struct Impl_GmLink {
     iString url;
     iRangecc urlRange; /* URL in the source */
+    iRangecc labelRange; /* description in the source */
     iTime when;
     int flags;
 };
@@ -46,6 +47,7 @@ struct Impl_GmLink {
 void init_GmLink(iGmLink *d) {
     init_String(&d->url);
     d->urlRange = iNullRange;
+    d->labelRange = iNullRange;
     iZap(d->when);
     d->flags = 0;
 }
@@ -226,6 +228,7 @@ static iRangecc addLink_GmDocument_(iGmDocument *d, iRangecc line, iGmLinkId *li
         trim_Rangecc(&desc);
         if (!isEmpty_Range(&desc)) {
             line = desc; /* Just show the description. */
+            link->labelRange = desc;
             link->flags |= humanReadable_GmLinkFlag;
         }
         else {
@@ -1223,6 +1226,13 @@ iInt2 size_GmDocument(const iGmDocument *d) {
     return d->size;
 }
 
+size_t memorySize_GmDocument(const iGmDocument *d) {
+    return sizeof(iGmDocument) + size_String(&d->source) +
+           size_Array(&d->layout) * sizeof(iGmRun) +
+           size_PtrArray(&d->links) * sizeof(iGmLink) +
+           size_Array(&d->headings) * sizeof(iGmHeading);
+}
+
 enum iGmDocumentBanner bannerType_GmDocument(const iGmDocument *d) {
     return d->bannerType;
 }
@@ -1254,6 +1264,10 @@ const iString *source_GmDocument(const iGmDocument *d) {
     return &d->source;
 }
 
+const iString *url_GmDocument(const iGmDocument *d) {
+    return &d->url;
+}
+
 iRangecc findText_GmDocument(const iGmDocument *d, const iString *text, const char *start) {
     const char * src      = constBegin_String(&d->source);
     const size_t startPos = (start ? start - src : 0);
@@ -1360,6 +1374,15 @@ iRangecc linkUrlRange_GmDocument(const iGmDocument *d, iGmLinkId linkId) {
     return link->urlRange;
 }
 
+iRangecc linkLabel_GmDocument(const iGmDocument *d, iGmLinkId linkId) {
+    const iGmLink *link = link_GmDocument_(d, linkId);
+    return link ? link->labelRange : iNullRange;
+}
+
+size_t numLinks_GmDocument(const iGmDocument *d) {
+    return size_PtrArray(&d->links);
+}
+
 int linkFlags_GmDocument(const iGmDocument *d, iGmLinkId linkId) {
     const iGmLink *link = link_GmDocument_(d, linkId);
     return link ? link->flags : 0;
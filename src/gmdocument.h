@@ -140,12 +140,14 @@ const iMedia *  constMedia_GmDocument       (const iGmDocument *);
 void            render_GmDocument           (const iGmDocument *, iRangei visRangeY,
                                              iGmDocumentRenderFunc render, void *);
 iInt2           size_GmDocument             (const iGmDocument *);
+size_t          memorySize_GmDocument       (const iGmDocument *); /* source and layout, bytes */
 const iGmRun *  siteBanner_GmDocument       (const iGmDocument *);
 iBool           hasSiteBanner_GmDocument    (const iGmDocument *);
 enum iGmDocumentBanner bannerType_GmDocument(const iGmDocument *);
 const iString * bannerText_GmDocument       (const iGmDocument *);
 const iArray *  headings_GmDocument         (const iGmDocument *); /* array of GmHeadings */
 const iString * source_GmDocument           (const iGmDocument *);
+const iString * url_GmDocument              (const iGmDocument *);
 
 iRangecc        findText_GmDocument                 (const iGmDocument *, const iString *text, const char *start);
 iRangecc        findTextBefore_GmDocument           (const iGmDocument *, const iString *text, const char *before);
@@ -164,6 +166,8 @@ const char *    findLoc_GmDocument      (const iGmDocument *, iInt2 pos);
 const iGmRun *  findRunAtLoc_GmDocument (const iGmDocument *, const char *loc);
 const iString * linkUrl_GmDocument      (const iGmDocument *, iGmLinkId linkId);
 iRangecc        linkUrlRange_GmDocument (const iGmDocument *, iGmLinkId linkId);
+iRangecc        linkLabel_GmDocument    (const iGmDocument *, iGmLinkId linkId); /* empty if none */
+size_t          numLinks_GmDocument     (const iGmDocument *);
 iMediaId        linkImage_GmDocument    (const iGmDocument *, iGmLinkId linkId);
 iMediaId        linkAudio_GmDocument    (const iGmDocument *, iGmLinkId linkId);
 int             linkFlags_GmDocument    (const iGmDocument *, iGmLinkId linkId);
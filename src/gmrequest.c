@@ -33,10 +33,13 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 #include "defs.h"
 
 #include <the_Foundation/file.h>
+#include <the_Foundation/fileinfo.h>
 #include <the_Foundation/mutex.h>
 #include <the_Foundation/path.h>
+#include <the_Foundation/ptrarray.h>
 #include <the_Foundation/regexp.h>
 #include <the_Foundation/socket.h>
+#include <the_Foundation/thread.h>
 #include <the_Foundation/tlsrequest.h>
 
 #include <SDL_timer.h>
@@ -89,10 +92,12 @@ iGmResponse *copy_GmResponse(const iGmResponse *d) {
     return copied;
 }
 
-void serialize_GmResponse(const iGmResponse *d, iStream *outs) {
+static void serializeFields_GmResponse_(const iGmResponse *d, iStream *outs, iBool withBody) {
     write32_Stream(outs, d->statusCode);
     serialize_String(&d->meta, outs);
-    serialize_Block(&d->body, outs);
+    if (withBody) {
+        serialize_Block(&d->body, outs);
+    }
     /* TODO: Add certificate fingerprint, but need to bump file version first. */
     write32_Stream(outs, d->certFlags & ~haveFingerprint_GmCertFlag);
     serialize_Date(&d->certValidUntil, outs);
@@ -100,10 +105,15 @@ void serialize_GmResponse(const iGmResponse *d, iStream *outs) {
     writeU64_Stream(outs, d->when.ts.tv_sec);
 }
 
-void deserialize_GmResponse(iGmResponse *d, iStream *ins) {
+static void deserializeFields_GmResponse_(iGmResponse *d, iStream *ins, iBool withBody) {
     d->statusCode = read32_Stream(ins);
     deserialize_String(&d->meta, ins);
-    deserialize_Block(&d->body, ins);
+    if (withBody) {
+        deserialize_Block(&d->body, ins);
+    }
+    else {
+        clear_Block(&d->body);
+    }
     d->certFlags = read32_Stream(ins);
     deserialize_Date(&d->certValidUntil, ins);
     deserialize_String(&d->certSubject, ins);
@@ -114,10 +124,27 @@ void deserialize_GmResponse(iGmResponse *d, iStream *ins) {
     }
 }
 
+void serialize_GmResponse(const iGmResponse *d, iStream *outs) {
+    serializeFields_GmResponse_(d, outs, iTrue);
+}
+
+void deserialize_GmResponse(iGmResponse *d, iStream *ins) {
+    deserializeFields_GmResponse_(d, ins, iTrue);
+}
+
+void serializeWithoutBody_GmResponse(const iGmResponse *d, iStream *outs) {
+    serializeFields_GmResponse_(d, outs, iFalse);
+}
+
+void deserializeWithoutBody_GmResponse(iGmResponse *d, iStream *ins) {
+    deserializeFields_GmResponse_(d, ins, iFalse);
+}
+
 /*----------------------------------------------------------------------------------------------*/
 
 enum iGmRequestState {
     initialized_GmRequestState,
+    queued_GmRequestState,
     receivingHeader_GmRequestState,
     receivingBody_GmRequestState,
     finished_GmRequestState,
@@ -125,25 +152,413 @@ enum iGmRequestState {
 };
 
 struct Impl_GmRequest {
-    iObject              object;
-    iMutex *             mtx;
-    iGmCerts *           certs; /* not owned */
-    enum iGmRequestState state;
-    iString              url;
-    iTlsRequest *        req;
-    iGopher              gopher;
-    iGmResponse *        resp;
-    iBool                isRespLocked;
-    iBool                isRespFiltered;
-    iAtomicInt           allowUpdate;
-    iAudience *          updated;
-    iAudience *          finished;
+    iObject                 object;
+    iMutex *                mtx;
+    iGmCerts *              certs; /* not owned */
+    enum iGmRequestState    state;
+    iString                 url;
+    iTlsRequest *           req;
+    iGopher                 gopher;
+    iGmResponse *           resp;
+    iBool                   isRespLocked;
+    iBool                   isRespFiltered;
+    iAtomicInt              allowUpdate;
+    uint32_t                updateInterval; /* ms; `updated` is sent at most this often... */
+    size_t                  updateSize;     /* ...unless this many bytes are waiting */
+    uint32_t                lastUpdateTicks;
+    size_t                  pendingUpdateSize;
+    enum iGmRequestPriority priority;
+    iTime                   queuedAt;
+    iTime                   startedAt;
+    iTime                   lastReceivedAt; /* invalid until the first byte arrives */
+    float                   responseTimeout; /* seconds; zero for no limit */
+    float                   idleTimeout;
+    iBool                   isTimingOut; /* being cancelled by the watchdog */
+    iBool                   isStarting;  /* being started by the scheduler */
+    iBool                   isNotifyingCancel; /* watchdog is notifying that it was cancelled */
+    iThread *               fileReader; /* delivers a large local file */
+    iFile *                 streamedFile; /* opened by the request, read by fileReader */
+    size_t                  reservedSize; /* scheduler budget held until deleted */
+    iAtomicInt              isCancelled;
+    iAtomicInt              isDeleted; /* the file reader must not notify anymore */
+    iAudience *             updated;
+    iAudience *             finished;
 };
 
 iDefineObjectConstructionArgs(GmRequest, (iGmCerts *certs), certs)
 iDefineAudienceGetter(GmRequest, updated)
 iDefineAudienceGetter(GmRequest, finished)
 
+static const float    defaultResponseTimeout_GmRequest_ = 30.0f; /* seconds until the first byte */
+static const float    defaultIdleTimeout_GmRequest_     = 30.0f; /* seconds between reads */
+static const uint32_t defaultUpdateInterval_GmRequest_  = 50;    /* ms */
+static const size_t   defaultUpdateSize_GmRequest_      = 0x10000;
+static const size_t   minStreamedFileSize_GmRequest_    = 0x100000;
+static const size_t   streamedChunkSize_GmRequest_      = 0x40000;
+
+static void start_GmRequest_(iGmRequest *d);
+static void timeout_GmRequest_(iGmRequest *d);
+static void setCancelled_GmRequest_(iGmRequest *d);
+static void interrupt_GmRequest_(iGmRequest *d);
+static void notifyFinished_GmRequest_(iGmRequest *d);
+
+/*----------------------------------------------------------------------------------------------*/
+
+/* All network requests go through the scheduler so that a page load is not stuck behind
+   dozens of image or feed requests, and individual servers are not flooded. Local resources
+   (about:, file:, data:) are never queued. */
+
+static const size_t   maxActive_GmRequestScheduler_        = 8;
+static const size_t   maxActivePerHost_GmRequestScheduler_ = 2;
+static const uint32_t watchdogInterval_GmRequestScheduler_ = 1000; /* ms */
+
+iDeclareType(GmRequestScheduler)
+
+struct Impl_GmRequestScheduler {
+    iMutex *            mtx;
+    iPtrArray           active; /* connections in progress */
+    iPtrArray           queued; /* ordered by priority, then by submission */
+    iGmRequestQueueInfo info;
+    SDL_TimerID         watchdog;
+    iThread *           watchdogThread; /* cancels timed out requests */
+    iCondition          watchdogDue;
+    iBool               isWatchdogDue;
+    iBool               isStopping;
+    iPtrArray           cancelled; /* cancelled while queued; notified by the watchdog thread */
+    iCondition          notBusy; /* a request is no longer being started or timed out */
+    size_t              reserved; /* bytes of budget held by requests until deleted */
+};
+
+static iGmRequestScheduler scheduler_;
+
+static iBool isTimedOut_GmRequest_(iGmRequest *d) {
+    iBool timedOut = iFalse;
+    lock_Mutex(d->mtx);
+    if (!isValid_Time(&d->lastReceivedAt)) {
+        timedOut = d->responseTimeout > 0 &&
+                   elapsedSeconds_Time(&d->startedAt) > d->responseTimeout;
+    }
+    else {
+        timedOut = d->idleTimeout > 0 && elapsedSeconds_Time(&d->lastReceivedAt) > d->idleTimeout;
+    }
+    unlock_Mutex(d->mtx);
+    return timedOut;
+}
+
+static void checkTimeouts_GmRequestScheduler_(iGmRequestScheduler *d) {
+    /* The scheduler is locked on entry and on return. */
+    iPtrArray expired;
+    init_PtrArray(&expired);
+    iConstForEach(PtrArray, i, &d->active) {
+        iGmRequest *req = i.ptr;
+        if (!req->isTimingOut && isTimedOut_GmRequest_(req)) {
+            /* Deleting the request will wait until we are done with it. */
+            req->isTimingOut = iTrue;
+            pushBack_PtrArray(&expired, req);
+        }
+    }
+    unlock_Mutex(d->mtx);
+    /* Cancelling may block until the connection's thread is done, so do it unlocked. */
+    iConstForEach(PtrArray, j, &expired) {
+        timeout_GmRequest_(j.ptr);
+    }
+    lock_Mutex(d->mtx);
+    if (!isEmpty_PtrArray(&expired)) {
+        iConstForEach(PtrArray, k, &expired) {
+            ((iGmRequest *) k.ptr)->isTimingOut = iFalse;
+        }
+        signalAll_Condition(&d->notBusy);
+    }
+    deinit_PtrArray(&expired);
+}
+
+static void notifyCancelled_GmRequestScheduler_(iGmRequestScheduler *d) {
+    /* The scheduler is locked on entry and on return. Like other completions, requests
+       cancelled while queued are notified outside the caller's thread. */
+    iPtrArray cancelled;
+    init_PtrArray(&cancelled);
+    iConstForEach(PtrArray, i, &d->cancelled) {
+        ((iGmRequest *) i.ptr)->isNotifyingCancel = iTrue;
+        pushBack_PtrArray(&cancelled, i.ptr);
+    }
+    clear_PtrArray(&d->cancelled);
+    unlock_Mutex(d->mtx);
+    iConstForEach(PtrArray, j, &cancelled) {
+        iNotifyAudience((iGmRequest *) j.ptr, finished, GmRequestFinished);
+    }
+    lock_Mutex(d->mtx);
+    iConstForEach(PtrArray, k, &cancelled) {
+        ((iGmRequest *) k.ptr)->isNotifyingCancel = iFalse;
+    }
+    signalAll_Condition(&d->notBusy);
+    deinit_PtrArray(&cancelled);
+}
+
+static iThreadResult watchdog_GmRequestScheduler_(iThread *thread) {
+    iGmRequestScheduler *d = userData_Thread(thread);
+    lock_Mutex(d->mtx);
+    for (;;) {
+        while (!d->isStopping && !d->isWatchdogDue && isEmpty_PtrArray(&d->cancelled)) {
+            wait_Condition(&d->watchdogDue, d->mtx);
+        }
+        if (d->isStopping) {
+            break;
+        }
+        if (!isEmpty_PtrArray(&d->cancelled)) {
+            notifyCancelled_GmRequestScheduler_(d);
+        }
+        if (d->isWatchdogDue) {
+            d->isWatchdogDue = iFalse;
+            checkTimeouts_GmRequestScheduler_(d);
+        }
+    }
+    unlock_Mutex(d->mtx);
+    return 0;
+}
+
+static uint32_t postWatchdog_GmRequestScheduler_(uint32_t interval, void *param) {
+    /* The timer thread must not block, so the actual work is done by the watchdog thread. */
+    iGmRequestScheduler *d = param;
+    iGuardMutex(d->mtx, {
+        d->isWatchdogDue = iTrue;
+        signal_Condition(&d->watchdogDue);
+    });
+    return interval;
+}
+
+void init_GmRequestScheduler(void) {
+    iGmRequestScheduler *d = &scheduler_;
+    d->mtx = new_Mutex();
+    init_PtrArray(&d->active);
+    init_PtrArray(&d->queued);
+    iZap(d->info);
+    init_Condition(&d->notBusy);
+    init_Condition(&d->watchdogDue);
+    d->isWatchdogDue  = iFalse;
+    d->isStopping     = iFalse;
+    init_PtrArray(&d->cancelled);
+    d->reserved       = 0;
+    d->watchdogThread = new_Thread(watchdog_GmRequestScheduler_);
+    setUserData_Thread(d->watchdogThread, d);
+    start_Thread(d->watchdogThread);
+    d->watchdog = SDL_AddTimer(
+        watchdogInterval_GmRequestScheduler_, postWatchdog_GmRequestScheduler_, d);
+}
+
+void deinit_GmRequestScheduler(void) {
+    iGmRequestScheduler *d = &scheduler_;
+    SDL_RemoveTimer(d->watchdog);
+    iGuardMutex(d->mtx, {
+        d->isStopping = iTrue;
+        signal_Condition(&d->watchdogDue);
+    });
+    join_Thread(d->watchdogThread);
+    iRelease(d->watchdogThread);
+    deinit_Condition(&d->watchdogDue);
+    deinit_Condition(&d->notBusy);
+    deinit_PtrArray(&d->cancelled);
+    deinit_PtrArray(&d->queued);
+    deinit_PtrArray(&d->active);
+    delete_Mutex(d->mtx);
+}
+
+static iBool isNetworked_GmRequest_(const iGmRequest *d) {
+    const iRangecc scheme = urlScheme_String(&d->url);
+    return !equalCase_Rangecc(scheme, "about") && !equalCase_Rangecc(scheme, "file") &&
+           !equalCase_Rangecc(scheme, "data");
+}
+
+static size_t indexOf_GmRequestScheduler_(const iPtrArray *list, const iGmRequest *req) {
+    for (size_t i = 0; i < size_PtrArray(list); i++) {
+        if (constAt_PtrArray(list, i) == req) {
+            return i;
+        }
+    }
+    return iInvalidPos;
+}
+
+static void removeAt_GmRequestScheduler_(iPtrArray *list, size_t pos) {
+    void *ptr;
+    take_PtrArray(list, pos, &ptr);
+}
+
+static size_t numActiveForHost_GmRequestScheduler_(const iGmRequestScheduler *d, iRangecc host) {
+    size_t count = 0;
+    iConstForEach(PtrArray, i, &d->active) {
+        const iRangecc reqHost = urlHost_String(&((const iGmRequest *) i.ptr)->url);
+        if (size_Range(&reqHost) == size_Range(&host) &&
+            cmpCStrNSc_Rangecc(reqHost, host.start, size_Range(&host), &iCaseInsensitive) == 0) {
+            count++;
+        }
+    }
+    return count;
+}
+
+static iBool canStart_GmRequestScheduler_(const iGmRequestScheduler *d, const iGmRequest *req) {
+    if (req->priority == foreground_GmRequestPriority) {
+        return iTrue; /* the user is waiting for this one */
+    }
+    return size_PtrArray(&d->active) < maxActive_GmRequestScheduler_ &&
+           numActiveForHost_GmRequestScheduler_(d, urlHost_String(&req->url)) <
+               maxActivePerHost_GmRequestScheduler_;
+}
+
+static void activate_GmRequestScheduler_(iGmRequestScheduler *d, iGmRequest *req) {
+    pushBack_PtrArray(&d->active, req);
+    initCurrent_Time(&req->startedAt);
+    d->info.numStarted++;
+    if (req->state == queued_GmRequestState) {
+        d->info.numWaited++;
+        d->info.totalWaitSeconds += elapsedSeconds_Time(&req->queuedAt);
+    }
+}
+
+static iBool reserve_GmRequestScheduler_(iGmRequestScheduler *d, iGmRequest *req) {
+    iBool isStarted = iFalse;
+    lock_Mutex(d->mtx);
+    if (canStart_GmRequestScheduler_(d, req)) {
+        activate_GmRequestScheduler_(d, req);
+        isStarted = iTrue;
+    }
+    else {
+        size_t pos = size_PtrArray(&d->queued);
+        while (pos > 0 &&
+               ((const iGmRequest *) constAt_PtrArray(&d->queued, pos - 1))->priority >
+                   req->priority) {
+            pos--;
+        }
+        req->state = queued_GmRequestState;
+        initCurrent_Time(&req->queuedAt);
+        insert_PtrArray(&d->queued, pos, req);
+        d->info.peakQueued = iMax(d->info.peakQueued, size_PtrArray(&d->queued));
+    }
+    unlock_Mutex(d->mtx);
+    return isStarted;
+}
+
+static iBool cancelQueued_GmRequestScheduler_(iGmRequestScheduler *d, iGmRequest *req) {
+    iBool wasQueued = iFalse;
+    lock_Mutex(d->mtx);
+    const size_t pos = indexOf_GmRequestScheduler_(&d->queued, req);
+    if (pos != iInvalidPos) {
+        removeAt_GmRequestScheduler_(&d->queued, pos);
+        setCancelled_GmRequest_(req);
+        pushBack_PtrArray(&d->cancelled, req);
+        signal_Condition(&d->watchdogDue);
+        wasQueued = iTrue;
+    }
+    unlock_Mutex(d->mtx);
+    return wasQueued;
+}
+
+static void forget_GmRequestScheduler_(iGmRequestScheduler *d, iGmRequest *req) {
+    /* The request is about to be deleted. */
+    lock_Mutex(d->mtx);
+    removeOne_PtrArray(&d->cancelled, req); /* no need to notify anymore */
+    while (req->isTimingOut || req->isStarting || req->isNotifyingCancel) {
+        wait_Condition(&d->notBusy, d->mtx);
+    }
+    size_t pos = indexOf_GmRequestScheduler_(&d->active, req);
+    if (pos != iInvalidPos) {
+        removeAt_GmRequestScheduler_(&d->active, pos);
+    }
+    else if ((pos = indexOf_GmRequestScheduler_(&d->queued, req)) != iInvalidPos) {
+        removeAt_GmRequestScheduler_(&d->queued, pos);
+    }
+    d->reserved -= req->reservedSize; /* the only place where budget is returned */
+    req->reservedSize = 0;
+    unlock_Mutex(d->mtx);
+}
+
+static void release_GmRequestScheduler_(iGmRequestScheduler *d, iGmRequest *req) {
+    lock_Mutex(d->mtx);
+    size_t pos = indexOf_GmRequestScheduler_(&d->active, req);
+    if (pos != iInvalidPos) {
+        removeAt_GmRequestScheduler_(&d->active, pos);
+    }
+    else if ((pos = indexOf_GmRequestScheduler_(&d->queued, req)) != iInvalidPos) {
+        removeAt_GmRequestScheduler_(&d->queued, pos);
+    }
+    /* Queued requests that now fit are started after unlocking, since starting one may
+       take a while. Until then they can't be deleted. */
+    iPtrArray starting;
+    init_PtrArray(&starting);
+    for (size_t i = 0; i < size_PtrArray(&d->queued); ) {
+        iGmRequest *next = at_PtrArray(&d->queued, i);
+        if (canStart_GmRequestScheduler_(d, next)) {
+            removeAt_GmRequestScheduler_(&d->queued, i);
+            activate_GmRequestScheduler_(d, next);
+            next->isStarting = iTrue;
+            pushBack_PtrArray(&starting, next);
+        }
+        else {
+            i++;
+        }
+    }
+    unlock_Mutex(d->mtx);
+    iConstForEach(PtrArray, j, &starting) {
+        iGmRequest *next = j.ptr;
+        /* A cancel may have arrived after the request was taken off the queue. */
+        if (value_Atomic(&next->isCancelled)) {
+            setCancelled_GmRequest_(next);
+            notifyFinished_GmRequest_(next);
+            continue;
+        }
+        start_GmRequest_(next);
+        if (value_Atomic(&next->isCancelled)) {
+            interrupt_GmRequest_(next); /* arrived while starting */
+        }
+    }
+    if (!isEmpty_PtrArray(&starting)) {
+        lock_Mutex(d->mtx);
+        iConstForEach(PtrArray, k, &starting) {
+            ((iGmRequest *) k.ptr)->isStarting = iFalse;
+        }
+        signalAll_Condition(&d->notBusy);
+        unlock_Mutex(d->mtx);
+    }
+    deinit_PtrArray(&starting);
+}
+
+iGmRequestQueueInfo queueInfo_GmRequestScheduler(void) {
+    iGmRequestScheduler *d = &scheduler_;
+    iGmRequestQueueInfo info;
+    lock_Mutex(d->mtx);
+    info           = d->info;
+    info.numActive = size_PtrArray(&d->active);
+    iZap(info.numQueued);
+    iConstForEach(PtrArray, i, &d->queued) {
+        info.numQueued[((const iGmRequest *) i.ptr)->priority]++;
+    }
+    unlock_Mutex(d->mtx);
+    return info;
+}
+
+iString *debugInfo_GmRequestScheduler(void) {
+    const iGmRequestQueueInfo info = queueInfo_GmRequestScheduler();
+    iString *str = new_String();
+    appendFormat_String(str,
+                        "Active: %zu\n"
+                        "Queued: %zu foreground, %zu inline, %zu background (peak %zu)\n"
+                        "Started: %zu (%zu queued first, average wait %.2f s)\n",
+                        info.numActive,
+                        info.numQueued[foreground_GmRequestPriority],
+                        info.numQueued[inline_GmRequestPriority],
+                        info.numQueued[background_GmRequestPriority],
+                        info.peakQueued,
+                        info.numStarted,
+                        info.numWaited,
+                        info.numWaited ? info.totalWaitSeconds / info.numWaited : 0.0);
+    return str;
+}
+
+/*----------------------------------------------------------------------------------------------*/
+
+static void notifyFinished_GmRequest_(iGmRequest *d) {
+    release_GmRequestScheduler_(&scheduler_, d);
+    iNotifyAudience(d, finished, GmRequestFinished);
+}
+
 static void checkServerCertificate_GmRequest_(iGmRequest *d) {
     const iTlsCertificate *cert = serverCertificate_TlsRequest(d->req);
     iGmResponse *resp = d->resp;
@@ -225,29 +640,52 @@ static int processIncomingData_GmRequest_(iGmRequest *d, const iBlock *data) {
 
 static void readIncoming_GmRequest_(iGmRequest *d, iTlsRequest *req) {
     lock_Mutex(d->mtx);
+    if (d->state == failure_GmRequestState) {
+        unlock_Mutex(d->mtx); /* timed out, nothing more to do */
+        return;
+    }
     iGmResponse *resp = d->resp;
     iAssert(d->state != finished_GmRequestState); /* notifications out of order? */
+    const enum iGmRequestState oldState = d->state;
     iBlock *  data         = readAll_TlsRequest(req);
     const int ubits        = processIncomingData_GmRequest_(d, data);
     iBool     notifyUpdate = (ubits & 1) != 0;
     iBool     notifyDone   = (ubits & 2) != 0;
     initCurrent_Time(&resp->when);
-    delete_Block(data);
-    unlock_Mutex(d->mtx);
+    d->lastReceivedAt = resp->when;
     if (notifyUpdate && !d->isRespFiltered) {
-        const iBool allowed = exchange_Atomic(&d->allowUpdate, iFalse);
-        if (allowed) {
-            iNotifyAudience(d, updated, GmRequestUpdated);
+        /* Coalesce small reads. The header is always reported immediately, and the
+           finished notification covers whatever remains pending at the end. */
+        const uint32_t now = SDL_GetTicks();
+        d->pendingUpdateSize += size_Block(data);
+        notifyUpdate = iFalse;
+        if (oldState == receivingHeader_GmRequestState ||
+            now - d->lastUpdateTicks >= d->updateInterval ||
+            (d->updateSize && d->pendingUpdateSize >= d->updateSize)) {
+            if (exchange_Atomic(&d->allowUpdate, iFalse)) {
+                d->lastUpdateTicks   = now;
+                d->pendingUpdateSize = 0;
+                notifyUpdate         = iTrue;
+            }
         }
     }
+    delete_Block(data);
+    unlock_Mutex(d->mtx);
+    if (notifyUpdate) {
+        iNotifyAudience(d, updated, GmRequestUpdated);
+    }
     if (notifyDone) {
-        iNotifyAudience(d, finished, GmRequestFinished);
+        notifyFinished_GmRequest_(d);
     }
 }
 
 static void requestFinished_GmRequest_(iGmRequest *d, iTlsRequest *req) {
     iAssert(req == d->req);
     lock_Mutex(d->mtx);
+    if (d->state == failure_GmRequestState) {
+        unlock_Mutex(d->mtx); /* already timed out */
+        return;
+    }
     /* There shouldn't be anything left to read. */ {
         iBlock *data = readAll_TlsRequest(req);
         iAssert(isEmpty_Block(data));
@@ -276,7 +714,7 @@ static void requestFinished_GmRequest_(iGmRequest *d, iTlsRequest *req) {
             unlock_Mutex(d->mtx);
         }
     }
-    iNotifyAudience(d, finished, GmRequestFinished);
+    notifyFinished_GmRequest_(d);
 }
 
 static const iBlock *aboutPageSource_(iRangecc path, iRangecc query) {
@@ -398,8 +836,9 @@ static void gopherRead_GmRequest_(iGmRequest *d, iSocket *socket) {
     lock_Mutex(d->mtx);
     d->resp->statusCode = success_GmStatusCode;
     iBlock *data = readAll_Socket(socket);
-    if (!isEmpty_Block(data)) {
+    if (!isEmpty_Block(data) && d->state != failure_GmRequestState) {
         processResponse_Gopher(&d->gopher, data);
+        initCurrent_Time(&d->lastReceivedAt);
     }
     delete_Block(data);
     unlock_Mutex(d->mtx);
@@ -418,19 +857,23 @@ static void gopherDisconnected_GmRequest_(iGmRequest *d, iSocket *socket) {
     }
     unlock_Mutex(d->mtx);
     if (notify) {
-        iNotifyAudience(d, finished, GmRequestFinished);
+        notifyFinished_GmRequest_(d);
     }
 }
 
 static void gopherError_GmRequest_(iGmRequest *d, iSocket *socket, int error, const char *msg) {
     iUnused(socket);
     lock_Mutex(d->mtx);
+    if (d->state == failure_GmRequestState) {
+        unlock_Mutex(d->mtx);
+        return;
+    }
     d->state = failure_GmRequestState;
     d->resp->statusCode = tlsFailure_GmStatusCode;
     format_String(&d->resp->meta, "%s (errno %d)", msg, error);
     clear_Block(&d->resp->body);
     unlock_Mutex(d->mtx);
-    iNotifyAudience(d, finished, GmRequestFinished);
+    notifyFinished_GmRequest_(d);
 }
 
 static void beginGopherConnection_GmRequest_(iGmRequest *d, const iString *host, uint16_t port) {
@@ -448,8 +891,56 @@ static void beginGopherConnection_GmRequest_(iGmRequest *d, const iString *host,
         resp->statusCode = input_GmStatusCode;
         setCStr_String(&resp->meta, "Enter query:");
         d->state = finished_GmRequestState;
-        iNotifyAudience(d, finished, GmRequestFinished);
+        notifyFinished_GmRequest_(d);
+    }
+}
+
+static iThreadResult readStreamedFile_GmRequest_(iThread *thread) {
+    /* The file is read in chunks so the beginning can be shown right away. */
+    iGmRequest *d = userData_Thread(thread);
+    iBlock *chunk = new_Block(streamedChunkSize_GmRequest_);
+    size_t  len;
+    while (!value_Atomic(&d->isCancelled) &&
+           (len = readData_File(d->streamedFile, size_Block(chunk), data_Block(chunk))) > 0) {
+        lock_Mutex(d->mtx);
+        appendData_Block(&d->resp->body, constData_Block(chunk), len);
+        unlock_Mutex(d->mtx);
+        if (exchange_Atomic(&d->allowUpdate, iFalse)) {
+            iNotifyAudience(d, updated, GmRequestUpdated);
+        }
+    }
+    delete_Block(chunk);
+    iReleasePtr(&d->streamedFile);
+    lock_Mutex(d->mtx);
+    initCurrent_Time(&d->resp->when);
+    if (value_Atomic(&d->isCancelled)) {
+        d->state = failure_GmRequestState;
+        d->resp->statusCode = cancelled_GmStatusCode;
+        clear_String(&d->resp->meta);
+    }
+    else {
+        d->state = finished_GmRequestState;
+    }
+    unlock_Mutex(d->mtx);
+    if (!value_Atomic(&d->isDeleted)) {
+        notifyFinished_GmRequest_(d);
     }
+    return 0;
+}
+
+static iBool beginStreamedFile_GmRequest_(iGmRequest *d, iFile *f) {
+    /* The reader thread takes over the already opened file. */
+    const size_t size = fileSize_FileInfo(path_File(f));
+    if (size < minStreamedFileSize_GmRequest_) {
+        return iFalse; /* small enough to read in one go */
+    }
+    reserve_Block(&d->resp->body, size); /* appending never reallocates */
+    d->streamedFile = ref_Object(f);
+    d->state        = receivingBody_GmRequestState;
+    d->fileReader = new_Thread(readStreamedFile_GmRequest_);
+    setUserData_Thread(d->fileReader, d);
+    start_Thread(d->fileReader);
+    return iTrue;
 }
 
 /*----------------------------------------------------------------------------------------------*/
@@ -460,6 +951,24 @@ void init_GmRequest(iGmRequest *d, iGmCerts *certs) {
     d->isRespLocked = iFalse;
     d->isRespFiltered = iFalse;
     set_Atomic(&d->allowUpdate, iTrue);
+    d->updateInterval    = defaultUpdateInterval_GmRequest_;
+    d->updateSize        = defaultUpdateSize_GmRequest_;
+    d->lastUpdateTicks   = 0;
+    d->pendingUpdateSize = 0;
+    d->priority = foreground_GmRequestPriority;
+    iZap(d->queuedAt);
+    iZap(d->startedAt);
+    iZap(d->lastReceivedAt);
+    d->responseTimeout = defaultResponseTimeout_GmRequest_;
+    d->idleTimeout     = defaultIdleTimeout_GmRequest_;
+    d->isTimingOut     = iFalse;
+    d->isStarting      = iFalse;
+    d->isNotifyingCancel = iFalse;
+    d->fileReader      = NULL;
+    d->streamedFile    = NULL;
+    d->reservedSize    = 0;
+    set_Atomic(&d->isCancelled, iFalse);
+    set_Atomic(&d->isDeleted, iFalse);
     init_String(&d->url);
     init_Gopher(&d->gopher);
     d->certs      = certs;
@@ -470,6 +979,14 @@ void init_GmRequest(iGmRequest *d, iGmCerts *certs) {
 }
 
 void deinit_GmRequest(iGmRequest *d) {
+    /* Make sure the scheduler isn't starting or timing out this request at the same time. */
+    forget_GmRequestScheduler_(&scheduler_, d);
+    if (d->fileReader) {
+        set_Atomic(&d->isDeleted, iTrue);
+        set_Atomic(&d->isCancelled, iTrue);
+        join_Thread(d->fileReader);
+        iReleasePtr(&d->fileReader);
+    }
     if (d->req) {
         iDisconnectObject(TlsRequest, d->req, readyRead, d);
         iDisconnectObject(TlsRequest, d->req, finished, d);
@@ -483,6 +1000,7 @@ void deinit_GmRequest(iGmRequest *d) {
     else {
         unlock_Mutex(d->mtx);
     }
+    release_GmRequestScheduler_(&scheduler_, d);
     iReleasePtr(&d->req);
     deinit_Gopher(&d->gopher);
     delete_Audience(d->finished);
@@ -504,11 +1022,37 @@ void setUrl_GmRequest(iGmRequest *d, const iString *url) {
     urlEncodeSpaces_String(&d->url);
 }
 
+void setPriority_GmRequest(iGmRequest *d, enum iGmRequestPriority priority) {
+    iAssert(d->state == initialized_GmRequestState);
+    d->priority = priority;
+}
+
+void setUpdateThrottle_GmRequest(iGmRequest *d, uint32_t intervalMs, size_t numBytes) {
+    lock_Mutex(d->mtx);
+    d->updateInterval = intervalMs;
+    d->updateSize     = numBytes;
+    unlock_Mutex(d->mtx);
+}
+
+void setTimeout_GmRequest(iGmRequest *d, float responseSeconds, float idleSeconds) {
+    lock_Mutex(d->mtx);
+    d->responseTimeout = responseSeconds;
+    d->idleTimeout     = idleSeconds;
+    unlock_Mutex(d->mtx);
+}
+
 void submit_GmRequest(iGmRequest *d) {
     iAssert(d->state == initialized_GmRequestState);
     if (d->state != initialized_GmRequestState) {
         return;
     }
+    if (isNetworked_GmRequest_(d) && !reserve_GmRequestScheduler_(&scheduler_, d)) {
+        return; /* will be started when there is room */
+    }
+    start_GmRequest_(d);
+}
+
+static void start_GmRequest_(iGmRequest *d) {
     set_Atomic(&d->allowUpdate, iTrue);
     iGmResponse *resp = d->resp;
     clear_GmResponse(resp);
@@ -535,7 +1079,7 @@ void submit_GmRequest(iGmRequest *d) {
             resp->statusCode = invalidLocalResource_GmStatusCode;
         }
         d->state = finished_GmRequestState;
-        iNotifyAudience(d, finished, GmRequestFinished);
+        notifyFinished_GmRequest_(d);
         return;
     }
     else if (equalCase_Rangecc(url.scheme, "file")) {
@@ -581,6 +1125,10 @@ void submit_GmRequest(iGmRequest *d) {
             else {
                 setCStr_String(&resp->meta, "application/octet-stream");
             }
+            if (beginStreamedFile_GmRequest_(d, f)) {
+                iRelease(f);
+                return; /* the reader thread finishes the request */
+            }
             set_Block(&resp->body, collect_Block(readAll_File(f)));
             d->state = receivingBody_GmRequestState;
             iNotifyAudience(d, updated, GmRequestUpdated);
@@ -591,7 +1139,7 @@ void submit_GmRequest(iGmRequest *d) {
         }
         iRelease(f);
         d->state = finished_GmRequestState;
-        iNotifyAudience(d, finished, GmRequestFinished);
+        notifyFinished_GmRequest_(d);
         return;
     }
     else if (equalCase_Rangecc(url.scheme, "data")) {
@@ -622,7 +1170,7 @@ void submit_GmRequest(iGmRequest *d) {
         d->state = receivingBody_GmRequestState;
         iNotifyAudience(d, updated, GmRequestUpdated);
         d->state = finished_GmRequestState;
-        iNotifyAudience(d, finished, GmRequestFinished);
+        notifyFinished_GmRequest_(d);
         return;
     }
     else if (schemeProxy_App(url.scheme)) {
@@ -649,7 +1197,7 @@ void submit_GmRequest(iGmRequest *d) {
     else if (!equalCase_Rangecc(url.scheme, "gemini")) {
         resp->statusCode = unsupportedProtocol_GmStatusCode;
         d->state = finished_GmRequestState;
-        iNotifyAudience(d, finished, GmRequestFinished);
+        notifyFinished_GmRequest_(d);
         return;
     }
     d->state = receivingHeader_GmRequestState;
@@ -669,11 +1217,51 @@ void submit_GmRequest(iGmRequest *d) {
     submit_TlsRequest(d->req);
 }
 
+static void setCancelled_GmRequest_(iGmRequest *d) {
+    lock_Mutex(d->mtx);
+    d->state = failure_GmRequestState;
+    d->resp->statusCode = cancelled_GmStatusCode;
+    clear_String(&d->resp->meta);
+    unlock_Mutex(d->mtx);
+}
+
+static void interrupt_GmRequest_(iGmRequest *d) {
+    if (d->req) {
+        cancel_TlsRequest(d->req);
+    }
+    cancel_Gopher(&d->gopher);
+}
+
 void cancel_GmRequest(iGmRequest *d) {
+    /* Also stops a local file reader, and a request that is just being started. */
+    set_Atomic(&d->isCancelled, iTrue);
+    if (cancelQueued_GmRequestScheduler_(&scheduler_, d)) {
+        return; /* never started, so there is nothing to interrupt */
+    }
+    interrupt_GmRequest_(d);
+}
+
+static void timeout_GmRequest_(iGmRequest *d) {
+    lock_Mutex(d->mtx);
+    if (d->state == finished_GmRequestState || d->state == failure_GmRequestState) {
+        unlock_Mutex(d->mtx);
+        return;
+    }
+    const iBool isIdle = isValid_Time(&d->lastReceivedAt);
+    d->state = failure_GmRequestState;
+    d->resp->statusCode = timedOut_GmStatusCode;
+    format_String(&d->resp->meta,
+                  isIdle ? "No data received in %.0f seconds" : "No response in %.0f seconds",
+                  isIdle ? d->idleTimeout : d->responseTimeout);
+    unlock_Mutex(d->mtx);
+    /* Close the connection. We have already given up on it, so the ensuing notifications
+       are ignored. */
     if (d->req) {
+        iDisconnectObject(TlsRequest, d->req, finished, d);
         cancel_TlsRequest(d->req);
     }
     cancel_Gopher(&d->gopher);
+    notifyFinished_GmRequest_(d);
 }
 
 iGmResponse *lockResponse_GmRequest(iGmRequest *d) {
@@ -683,6 +1271,23 @@ iGmResponse *lockResponse_GmRequest(iGmRequest *d) {
     return d->resp;
 }
 
+void allowUpdate_GmRequest(iGmRequest *d) {
+    set_Atomic(&d->allowUpdate, iTrue);
+}
+
+iBool reserveBudget_GmRequest(iGmRequest *d, size_t numBytes, size_t maxTotal) {
+    iGmRequestScheduler *sched = &scheduler_;
+    iBool ok = iFalse;
+    lock_Mutex(sched->mtx);
+    if (sched->reserved + numBytes <= maxTotal) {
+        sched->reserved += numBytes;
+        d->reservedSize += numBytes;
+        ok = iTrue;
+    }
+    unlock_Mutex(sched->mtx);
+    return ok;
+}
+
 void unlockResponse_GmRequest(iGmRequest *d) {
     if (d) {
         iAssert(d->isRespLocked);
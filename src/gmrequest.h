@@ -53,6 +53,33 @@ iDeclareTypeConstruction(GmResponse)
 iDeclareTypeSerialization(GmResponse)
 
 iGmResponse *       copy_GmResponse             (const iGmResponse *);
+void                serializeWithoutBody_GmResponse     (const iGmResponse *, iStream *outs);
+void                deserializeWithoutBody_GmResponse   (iGmResponse *, iStream *ins);
+
+/*----------------------------------------------------------------------------------------------*/
+
+enum iGmRequestPriority {
+    foreground_GmRequestPriority, /* page in the current tab */
+    inline_GmRequestPriority,     /* inline media, pages in other tabs */
+    background_GmRequestPriority, /* feeds, remote bookmarks, prefetching */
+    max_GmRequestPriority
+};
+
+iDeclareType(GmRequestQueueInfo)
+
+struct Impl_GmRequestQueueInfo {
+    size_t numActive;
+    size_t numQueued[max_GmRequestPriority];
+    size_t peakQueued;
+    size_t numStarted;       /* since launch */
+    size_t numWaited;        /* had to be queued before starting */
+    double totalWaitSeconds; /* time spent queued by started requests */
+};
+
+void                init_GmRequestScheduler     (void);
+void                deinit_GmRequestScheduler   (void);
+iGmRequestQueueInfo queueInfo_GmRequestScheduler(void);
+iString *           debugInfo_GmRequestScheduler(void);
 
 /*----------------------------------------------------------------------------------------------*/
 
@@ -65,11 +92,21 @@ iDeclareAudienceGetter(GmRequest, updated)
 iDeclareAudienceGetter(GmRequest, finished)
 
 void                setUrl_GmRequest            (iGmRequest *, const iString *url);
+void                setPriority_GmRequest       (iGmRequest *, enum iGmRequestPriority priority);
+void                setTimeout_GmRequest        (iGmRequest *, float responseSeconds, float idleSeconds);
+void                setUpdateThrottle_GmRequest (iGmRequest *, uint32_t intervalMs, size_t numBytes);
 void                submit_GmRequest            (iGmRequest *);
 void                cancel_GmRequest            (iGmRequest *);
 
+/**
+ * Reserves bytes from a budget shared by all requests, if the reserved total stays within
+ * `maxTotal`. The reservation is held until the request is deleted.
+ */
+iBool               reserveBudget_GmRequest     (iGmRequest *, size_t numBytes, size_t maxTotal);
+
 iGmResponse *       lockResponse_GmRequest      (iGmRequest *);
 void                unlockResponse_GmRequest    (iGmRequest *);
+void                allowUpdate_GmRequest       (iGmRequest *); /* without accessing the response */
 
 iBool               isFinished_GmRequest        (const iGmRequest *);
 enum iGmStatusCode  status_GmRequest            (const iGmRequest *);
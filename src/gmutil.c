@@ -420,6 +420,15 @@ static const struct {
       { 0x1f5a7, /* networked computers */
         "Network/TLS Failure",
         "Failed to communicate with the host. Here is the error message:" } },
+    { timedOut_GmStatusCode,
+      { 0x231b, /* hourglass */
+        "Timed Out",
+        "The host did not respond in time. It may be overloaded or unreachable, "
+        "so try again later." } },
+    { cancelled_GmStatusCode,
+      { 0x1f6d1, /* stop sign */
+        "Cancelled",
+        "The request was cancelled before it was finished." } },
     { temporaryFailure_GmStatusCode,
       { 0x1f50c, /* electric plug */
         "Temporary Failure",
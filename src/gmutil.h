@@ -42,6 +42,8 @@ enum iGmStatusCode {
     unknownStatusCode_GmStatusCode,
     invalidLocalResource_GmStatusCode,
     tlsFailure_GmStatusCode,
+    timedOut_GmStatusCode,
+    cancelled_GmStatusCode,
 
     none_GmStatusCode                      = 0,
     /* general status code categories */
@@ -22,55 +22,591 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 
 #include "history.h"
 #include "app.h"
+#include "contentindex.h"
+#include "defs.h"
+#include "gmdocument.h"
+#include "pagecache.h"
 
 #include <the_Foundation/file.h>
+#include <the_Foundation/hash.h>
+#include <the_Foundation/intset.h>
 #include <the_Foundation/mutex.h>
 #include <the_Foundation/path.h>
+#include <the_Foundation/ptrarray.h>
 #include <the_Foundation/stringset.h>
-#include <math.h>
+#include <the_Foundation/thread.h>
 
-static const size_t maxStack_History_ = 50; /* back/forward navigable items */
+static const size_t maxStack_History_      = 50; /* back/forward navigable items */
+static const size_t maxPrefetched_History_ = 10; /* responses loaded ahead of navigation */
+static const size_t minCompressSize_History_ = 1024; /* smaller bodies are kept as is */
+static const size_t compressDistance_History_ = 2;    /* steps from the current item */
+
+enum iRecentUrlSerialFlag {
+    cachedResponse_RecentUrlSerialFlag = iBit(1),
+    compressedBody_RecentUrlSerialFlag = iBit(2),
+};
+
+/* Identical bodies of the same URL are kept in memory only once, no matter how many history
+   items of how many tabs refer to them. The responses share the body data. A shared body is
+   compressed only once: the other items referring to it switch to the same compressed
+   body when they are compressed. */
+
+struct Impl_SharedBody {
+    iHashNode    node; /* key is a checksum of the URL and the content */
+    iString      url;
+    iBlock       body;
+    int          numRefs;
+    iCacheEntry *memory; /* the shared data is accounted here, not in the history items */
+    iSharedBody *packed; /* compressed version of `body`, once made */
+};
+
+static iHash   sharedBodies_;
+static iMutex *sharedBodiesMtx_;
+
+static iBool contains_PtrArray_(const iPtrArray *d, const void *ptr) {
+    iConstForEach(PtrArray, i, d) {
+        if (i.ptr == ptr) {
+            return iTrue;
+        }
+    }
+    return iFalse;
+}
+
+void init_SharedBodies(void) {
+    init_Hash(&sharedBodies_);
+    sharedBodiesMtx_ = new_Mutex();
+}
+
+void deinit_SharedBodies(void) {
+    /* All histories are gone by now, so anything left over was leaked. */
+    iForEach(Hash, i, &sharedBodies_) {
+        iSharedBody *shared = (iSharedBody *) i.value;
+        remove_CacheManager(shared->memory);
+        deinit_String(&shared->url);
+        deinit_Block(&shared->body);
+        free(shared);
+    }
+    deinit_Hash(&sharedBodies_);
+    delete_Mutex(sharedBodiesMtx_);
+    sharedBodiesMtx_ = NULL;
+}
+
+static iSharedBody *ref_SharedBody_(iSharedBody *d) {
+    if (d) {
+        iGuardMutex(sharedBodiesMtx_, d->numRefs++);
+    }
+    return d;
+}
+
+static void deref_SharedBody_(iSharedBody *d) {
+    if (!d) return;
+    iSharedBody *packed = NULL;
+    lock_Mutex(sharedBodiesMtx_);
+    if (--d->numRefs == 0) {
+        packed = d->packed;
+        remove_Hash(&sharedBodies_, d->node.key);
+        remove_CacheManager(d->memory);
+        deinit_String(&d->url);
+        deinit_Block(&d->body);
+        free(d);
+    }
+    unlock_Mutex(sharedBodiesMtx_);
+    deref_SharedBody_(packed);
+}
+
+static iSharedBody *packed_SharedBody_(iSharedBody *d) {
+    /* Returns a new reference to the compressed version, if one has been made. */
+    iSharedBody *packed = NULL;
+    if (d) {
+        lock_Mutex(sharedBodiesMtx_);
+        if ((packed = d->packed) != NULL) {
+            packed->numRefs++;
+        }
+        unlock_Mutex(sharedBodiesMtx_);
+    }
+    return packed;
+}
+
+static void setPacked_SharedBody_(iSharedBody *d, iSharedBody *packed) {
+    if (d && packed && d != packed) {
+        lock_Mutex(sharedBodiesMtx_);
+        if (!d->packed) {
+            d->packed = packed;
+            packed->numRefs++;
+        }
+        unlock_Mutex(sharedBodiesMtx_);
+    }
+}
+
+static uint32_t sharedBodyKey_(const iString *url, const iBlock *body) {
+    return crc32_Block(body) ^ (crc32_Block(&url->chars) * 31);
+}
+
+static void shareBody_RecentUrl_(iRecentUrl *d) {
+    deref_SharedBody_(d->sharedBody);
+    d->sharedBody = NULL;
+    if (!d->cachedResponse || isEmpty_Block(&d->cachedResponse->body)) {
+        return;
+    }
+    iBlock *body = &d->cachedResponse->body;
+    const uint32_t key = sharedBodyKey_(&d->url, body);
+    lock_Mutex(sharedBodiesMtx_);
+    iSharedBody *shared = (iSharedBody *) value_Hash(&sharedBodies_, key);
+    if (shared) {
+        /* On a checksum collision the body just remains private. */
+        if (equal_String(&shared->url, &d->url) && cmp_Block(&shared->body, body) == 0) {
+            set_Block(body, &shared->body); /* our own copy of the data is released */
+            shared->numRefs++;
+            d->sharedBody = shared;
+        }
+    }
+    else {
+        shared = iMalloc(SharedBody);
+        shared->node.key = key;
+        initCopy_String(&shared->url, &d->url);
+        initCopy_Block(&shared->body, body);
+        shared->numRefs = 1;
+        shared->memory  = add_CacheManager(size_Block(body), normal_CachePriority, NULL, NULL);
+        shared->packed  = NULL;
+        insert_Hash(&sharedBodies_, &shared->node);
+        d->sharedBody = shared;
+    }
+    unlock_Mutex(sharedBodiesMtx_);
+}
+
+static size_t memorySize_RecentUrl_(const iRecentUrl *d) {
+    const iGmResponse *resp = d->cachedResponse;
+    return sizeof(iGmResponse) + size_String(&resp->meta) +
+           (d->sharedBody ? 0 : size_Block(&resp->body)) +
+           size_Block(&resp->certFingerprint) + size_String(&resp->certSubject) +
+           (d->cachedDoc ? memorySize_GmDocument(d->cachedDoc) : 0);
+}
+
+static void dropResponse_RecentUrl_(iRecentUrl *d) {
+    deref_SharedBody_(d->sharedBody);
+    d->sharedBody = NULL;
+    delete_GmResponse(d->cachedResponse);
+    d->cachedResponse = NULL;
+    d->isBodyCompressed = iFalse;
+    clear_String(&d->storedBodyKey);
+    d->isStoredBodyCompressed = iFalse;
+    iReleasePtr(&d->cachedDoc);
+    if (d->indexKey) {
+        remove_ContentIndex(d->indexKey);
+        d->indexKey = 0;
+    }
+}
 
 void init_RecentUrl(iRecentUrl *d) {
     init_String(&d->url);
     d->normScrollY = 0;
     d->cachedResponse = NULL;
+    init_String(&d->cachedBodyKey);
+    init_String(&d->storedBodyKey);
+    d->isStoredBodyCompressed = iFalse;
+    d->isBodyCompressed = iFalse;
+    d->sharedBody = NULL;
+    d->cachedDoc = NULL;
+    d->cachedDocLayout = 0;
+    d->cacheEntry = NULL;
+    d->indexKey = 0;
 }
 
 void deinit_RecentUrl(iRecentUrl *d) {
+    remove_CacheManager(d->cacheEntry);
+    dropResponse_RecentUrl_(d);
+    deinit_String(&d->storedBodyKey);
+    deinit_String(&d->cachedBodyKey);
     deinit_String(&d->url);
-    delete_GmResponse(d->cachedResponse);
 }
 
 iDefineTypeConstruction(RecentUrl)
 
+static iBool isCompressible_RecentUrl_(const iRecentUrl *d) {
+    /* Only text is worth compressing; other media types are usually compressed already. */
+    return d->cachedResponse && !d->isBodyCompressed && isEmpty_String(&d->cachedBodyKey) &&
+           startsWithCase_String(&d->cachedResponse->meta, "text/") &&
+           size_Block(&d->cachedResponse->body) >= minCompressSize_History_;
+}
+
+static iBool decompressBody_RecentUrl_(iRecentUrl *d) {
+    if (!d->cachedResponse || !d->isBodyCompressed) {
+        return iTrue;
+    }
+#if defined (iHaveZlib)
+    iBlock *unpacked = decompress_Block(&d->cachedResponse->body);
+    if (unpacked) {
+        set_Block(&d->cachedResponse->body, unpacked);
+        delete_Block(unpacked);
+        d->isBodyCompressed = iFalse;
+        shareBody_RecentUrl_(d);
+        if (d->cacheEntry) {
+            resize_CacheManager(d->cacheEntry, memorySize_RecentUrl_(d));
+        }
+        return iTrue;
+    }
+#endif
+    return iFalse;
+}
+
+static const iBlock *readableBody_(const iBlock *body, const iString *bodyKey,
+                                   iBool isCompressed) {
+    /* Decompressed copy of the body for reading, if needed. */
+    if (!isEmpty_String(bodyKey)) {
+        /* Restored but not loaded yet, so read it without keeping it. */
+        iBlock *stored = collectNew_Block();
+        if (!peek_PageCache(bodyKey, stored)) {
+            return stored;
+        }
+        body = stored;
+    }
+    if (!isCompressed) {
+        return body;
+    }
+#if defined (iHaveZlib)
+    iBlock *unpacked = decompress_Block(body);
+    if (unpacked) {
+        return collect_Block(unpacked);
+    }
+#endif
+    return collectNew_Block();
+}
+
+static const iBlock *body_RecentUrl_(const iRecentUrl *d) {
+    return readableBody_(&d->cachedResponse->body, &d->cachedBodyKey, d->isBodyCompressed);
+}
+
+static iBool isSearchable_RecentUrl_(const iRecentUrl *d) {
+    const iGmResponse *resp = d->cachedResponse;
+    return resp && category_GmStatusCode(resp->statusCode) == categorySuccess_GmStatusCode &&
+           indexOfCStrSc_String(&resp->meta, "text/", &iCaseInsensitive) != iInvalidPos;
+}
+
+static void index_RecentUrl_(iRecentUrl *d) {
+    if (d->indexKey || !isSearchable_RecentUrl_(d) || !isEmpty_String(&d->cachedBodyKey)) {
+        return;
+    }
+    d->indexKey = add_ContentIndex(&d->url, body_RecentUrl_(d));
+}
+
 iRecentUrl *copy_RecentUrl(const iRecentUrl *d) {
     iRecentUrl *copy = new_RecentUrl();
     set_String(&copy->url, &d->url);
     copy->normScrollY = d->normScrollY;
     copy->cachedResponse = d->cachedResponse ? copy_GmResponse(d->cachedResponse) : NULL;
+    set_String(&copy->cachedBodyKey, &d->cachedBodyKey);
+    set_String(&copy->storedBodyKey, &d->storedBodyKey);
+    copy->isStoredBodyCompressed = d->isStoredBodyCompressed;
+    copy->isBodyCompressed = d->isBodyCompressed;
+    copy->sharedBody = ref_SharedBody_(d->sharedBody);
+    copy->cachedDoc = NULL; /* belongs to a single tab */
+    copy->cacheEntry = NULL; /* the owner registers the copy */
+    copy->indexKey = d->indexKey;
+    if (copy->indexKey) {
+        ref_ContentIndex(copy->indexKey);
+    }
     return copy;
 }
 
 /*----------------------------------------------------------------------------------------------*/
 
 struct Impl_History {
-    iMutex *mtx;
-    iArray recent;    /* TODO: should be specific to a DocumentWidget */
-    size_t recentPos; /* zero at the latest item */
+    iMutex * mtx;
+    iArray   recent;     /* TODO: should be specific to a DocumentWidget */
+    size_t   recentPos;  /* zero at the latest item */
+    iArray   prefetched; /* not navigable, not serialized */
+    uint32_t modCount;
 };
 
 iDefineTypeConstruction(History)
 
+static void evictCached_History_(void *context, iCacheEntry *entry) {
+    iHistory *d = context;
+    lock_Mutex(d->mtx);
+    iForEach(Array, i, &d->recent) {
+        iRecentUrl *item = i.value;
+        if (item->cacheEntry == entry) {
+            item->cacheEntry = NULL;
+            dropResponse_RecentUrl_(item);
+            clear_String(&item->cachedBodyKey);
+            d->modCount++;
+            unlock_Mutex(d->mtx);
+            return;
+        }
+    }
+    iForEach(Array, j, &d->prefetched) {
+        iRecentUrl *item = j.value;
+        if (item->cacheEntry == entry) {
+            item->cacheEntry = NULL;
+            deinit_RecentUrl(item);
+            remove_ArrayIterator(&j);
+            break;
+        }
+    }
+    unlock_Mutex(d->mtx);
+}
+
+static void updateCacheEntry_History_(iHistory *d, iRecentUrl *item,
+                                      enum iCachePriority priority) {
+    /* Keep the cache manager's accounting in sync with the item's response. */
+    if (!item->cachedResponse) {
+        remove_CacheManager(item->cacheEntry);
+        item->cacheEntry = NULL;
+    }
+    else if (!item->cacheEntry) {
+        item->cacheEntry = add_CacheManager(
+            memorySize_RecentUrl_(item), priority, evictCached_History_, d);
+    }
+    else {
+        resize_CacheManager(item->cacheEntry, memorySize_RecentUrl_(item));
+        setPriority_CacheManager(item->cacheEntry, priority);
+        touch_CacheManager(item->cacheEntry);
+    }
+}
+
+/*----------------------------------------------------------------------------------------------*/
+
+/* Bodies of items that are not near the current position are compressed in a background
+   thread, so navigating is never held up by it. The same thread adds restored bodies that
+   haven't been loaded yet to the content index, so searching never needs to read them. */
+
+iDeclareType(HistoryCompressor)
+
+struct Impl_HistoryCompressor {
+    iMutex *   mtx;
+    iThread *  thread;
+    iCondition wakeUp;
+    iCondition notBusy;
+    iBool      isStopping;
+    iPtrArray  queue; /* iHistory *, having items to compress or index */
+    iHistory * busy;  /* being worked on right now */
+};
+
+static iHistoryCompressor compressor_;
+
+static iRecentUrl *nextCompressible_History_(iHistory *d, const iPtrArray *skipped) {
+    const size_t current = size_Array(&d->recent) - 1 - d->recentPos;
+    iForEach(Array, i, &d->recent) {
+        iRecentUrl * item  = i.value;
+        const size_t pos   = index_ArrayIterator(&i);
+        const iBool  isFar = pos + compressDistance_History_ < current ||
+                             pos > current + compressDistance_History_;
+        if (isFar && isCompressible_RecentUrl_(item) &&
+            !contains_PtrArray_(skipped, item->cachedResponse)) {
+            return item;
+        }
+    }
+    iForEach(Array, j, &d->prefetched) {
+        iRecentUrl *item = j.value;
+        if (isCompressible_RecentUrl_(item) &&
+            !contains_PtrArray_(skipped, item->cachedResponse)) {
+            return item;
+        }
+    }
+    return NULL;
+}
+
+static iRecentUrl *findResponse_History_(iHistory *d, const iGmResponse *resp) {
+    iForEach(Array, i, &d->recent) {
+        if (((iRecentUrl *) i.value)->cachedResponse == resp) {
+            return i.value;
+        }
+    }
+    iForEach(Array, j, &d->prefetched) {
+        if (((iRecentUrl *) j.value)->cachedResponse == resp) {
+            return j.value;
+        }
+    }
+    return NULL;
+}
+
+static iBool compressNext_History_(iHistory *d, iPtrArray *skipped) {
+#if defined (iHaveZlib)
+    lock_Mutex(d->mtx);
+    iRecentUrl *item = nextCompressible_History_(d, skipped);
+    if (!item) {
+        unlock_Mutex(d->mtx);
+        return iFalse;
+    }
+    const iGmResponse *resp = item->cachedResponse;
+    iSharedBody *packedShared = packed_SharedBody_(item->sharedBody);
+    if (packedShared) {
+        /* Another item with the same body was already compressed. */
+        deref_SharedBody_(item->sharedBody);
+        item->sharedBody = packedShared;
+        set_Block(&item->cachedResponse->body, &packedShared->body);
+        item->isBodyCompressed = iTrue;
+        if (item->cacheEntry) {
+            resize_CacheManager(item->cacheEntry, memorySize_RecentUrl_(item));
+        }
+        unlock_Mutex(d->mtx);
+        return iTrue;
+    }
+    iBlock body;
+    initCopy_Block(&body, &resp->body); /* shares the data */
+    pushBack_PtrArray(skipped, resp);
+    unlock_Mutex(d->mtx);
+    iBlock *packed = compress_Block(&body);
+    lock_Mutex(d->mtx);
+    /* The item may have been changed, moved, or removed meanwhile. */
+    item = findResponse_History_(d, resp);
+    if (item && !item->isBodyCompressed && packed && size_Block(packed) < size_Block(&body) &&
+        constData_Block(&item->cachedResponse->body) == constData_Block(&body)) {
+        iSharedBody *source = ref_SharedBody_(item->sharedBody);
+        set_Block(&item->cachedResponse->body, packed);
+        item->isBodyCompressed = iTrue;
+        shareBody_RecentUrl_(item);
+        setPacked_SharedBody_(source, item->sharedBody); /* for the other items */
+        deref_SharedBody_(source);
+        if (item->cacheEntry) {
+            resize_CacheManager(item->cacheEntry, memorySize_RecentUrl_(item));
+        }
+    }
+    unlock_Mutex(d->mtx);
+    delete_Block(packed);
+    deinit_Block(&body);
+    return iTrue;
+#else
+    iUnused(d);
+    iUnused(skipped);
+    return iFalse;
+#endif
+}
+
+static iBool isIndexable_RecentUrl_(const iRecentUrl *d) {
+    return isSearchable_RecentUrl_(d) && !isEmpty_String(&d->cachedBodyKey) && !d->indexKey;
+}
+
+static iBool indexNext_History_(iHistory *d, iPtrArray *skipped) {
+    lock_Mutex(d->mtx);
+    const iRecentUrl *item = NULL;
+    iConstForEach(Array, i, &d->recent) {
+        const iRecentUrl *recent = i.value;
+        if (isIndexable_RecentUrl_(recent) &&
+            !contains_PtrArray_(skipped, recent->cachedResponse)) {
+            item = recent;
+            break;
+        }
+    }
+    if (!item) {
+        unlock_Mutex(d->mtx);
+        return iFalse;
+    }
+    const iGmResponse *resp = item->cachedResponse;
+    iString url, bodyKey;
+    initCopy_String(&url, &item->url);
+    initCopy_String(&bodyKey, &item->cachedBodyKey);
+    const iBool isCompressed = item->isBodyCompressed;
+    pushBack_PtrArray(skipped, resp);
+    unlock_Mutex(d->mtx);
+    iBeginCollect();
+    uint32_t indexKey = add_ContentIndex(&url, readableBody_(NULL, &bodyKey, isCompressed));
+    iEndCollect();
+    lock_Mutex(d->mtx);
+    /* The body may have been loaded or dropped meanwhile. */
+    iRecentUrl *current = findResponse_History_(d, resp);
+    if (current && isIndexable_RecentUrl_(current) &&
+        equal_String(&current->cachedBodyKey, &bodyKey)) {
+        current->indexKey = indexKey;
+        indexKey = 0;
+    }
+    unlock_Mutex(d->mtx);
+    if (indexKey) {
+        remove_ContentIndex(indexKey);
+    }
+    deinit_String(&bodyKey);
+    deinit_String(&url);
+    return iTrue;
+}
+
+static iThreadResult compress_HistoryCompressor_(iThread *thread) {
+    iHistoryCompressor *d = userData_Thread(thread);
+    lock_Mutex(d->mtx);
+    for (;;) {
+        while (!d->isStopping && isEmpty_PtrArray(&d->queue)) {
+            wait_Condition(&d->wakeUp, d->mtx);
+        }
+        if (d->isStopping) {
+            break;
+        }
+        take_PtrArray(&d->queue, 0, (void **) &d->busy);
+        unlock_Mutex(d->mtx);
+        iPtrArray skipped; /* responses already attempted */
+        init_PtrArray(&skipped);
+        while (indexNext_History_(d->busy, &skipped)) {}
+        clear_PtrArray(&skipped);
+        while (compressNext_History_(d->busy, &skipped)) {}
+        deinit_PtrArray(&skipped);
+        lock_Mutex(d->mtx);
+        d->busy = NULL;
+        signalAll_Condition(&d->notBusy);
+    }
+    unlock_Mutex(d->mtx);
+    return 0;
+}
+
+void init_HistoryCompressor(void) {
+    iHistoryCompressor *d = &compressor_;
+    d->mtx = new_Mutex();
+    init_Condition(&d->wakeUp);
+    init_Condition(&d->notBusy);
+    d->isStopping = iFalse;
+    init_PtrArray(&d->queue);
+    d->busy   = NULL;
+    d->thread = new_Thread(compress_HistoryCompressor_);
+    setUserData_Thread(d->thread, d);
+    start_Thread(d->thread);
+}
+
+void deinit_HistoryCompressor(void) {
+    iHistoryCompressor *d = &compressor_;
+    iGuardMutex(d->mtx, {
+        d->isStopping = iTrue;
+        signal_Condition(&d->wakeUp);
+    });
+    join_Thread(d->thread);
+    iRelease(d->thread);
+    deinit_PtrArray(&d->queue);
+    deinit_Condition(&d->notBusy);
+    deinit_Condition(&d->wakeUp);
+    delete_Mutex(d->mtx);
+}
+
+static void requestCompression_History_(iHistory *d) {
+    iHistoryCompressor *comp = &compressor_;
+    iGuardMutex(comp->mtx, {
+        if (!contains_PtrArray_(&comp->queue, d)) {
+            pushBack_PtrArray(&comp->queue, d);
+            signal_Condition(&comp->wakeUp);
+        }
+    });
+}
+
+static void forgetCompression_History_(iHistory *d) {
+    iHistoryCompressor *comp = &compressor_;
+    lock_Mutex(comp->mtx);
+    removeOne_PtrArray(&comp->queue, d);
+    while (comp->busy == d) {
+        wait_Condition(&comp->notBusy, comp->mtx);
+    }
+    unlock_Mutex(comp->mtx);
+}
+
+/*----------------------------------------------------------------------------------------------*/
+
 void init_History(iHistory *d) {
     d->mtx = new_Mutex();
     init_Array(&d->recent, sizeof(iRecentUrl));
     d->recentPos = 0;
+    init_Array(&d->prefetched, sizeof(iRecentUrl));
+    d->modCount = 0;
 }
 
 void deinit_History(iHistory *d) {
+    forgetCompression_History_(d);
     iGuardMutex(d->mtx, {
         clear_History(d);
+        deinit_Array(&d->prefetched);
         deinit_Array(&d->recent);
     });
     delete_Mutex(d->mtx);
@@ -81,6 +617,7 @@ iHistory *copy_History(const iHistory *d) {
     iHistory *copy = new_History();
     iConstForEach(Array, i, &d->recent) {
         pushBack_Array(&copy->recent, copy_RecentUrl(i.value));
+        updateCacheEntry_History_(copy, back_Array(&copy->recent), normal_CachePriority);
     }
     copy->recentPos = d->recentPos;
     unlock_Mutex(d->mtx);
@@ -111,25 +648,51 @@ iString *debugInfo_History(const iHistory *d) {
                             cstr_String(&item->url));
     }
     appendFormat_String(str, "\n```\n");
+    size_t prefetchedSize = 0;
+    iConstForEach(Array, j, &d->prefetched) {
+        prefetchedSize += size_Block(&((const iRecentUrl *) j.value)->cachedResponse->body);
+    }
     appendFormat_String(str,
                         "Total cached data: %.3f MB\n"
+                        "Prefetched: %zu (%.3f MB)\n"
                         "Navigation position: %zu\n\n",
                         totalSize / 1.0e6f,
+                        size_Array(&d->prefetched),
+                        prefetchedSize / 1.0e6f,
                         d->recentPos);
     return str;
 }
 
+uint32_t modCount_History(const iHistory *d) {
+    uint32_t count;
+    iGuardMutex(d->mtx, count = d->modCount);
+    return count;
+}
+
 void serialize_History(const iHistory *d, iStream *outs) {
     lock_Mutex(d->mtx);
     writeU16_Stream(outs, d->recentPos);
     writeU16_Stream(outs, size_Array(&d->recent));
     iConstForEach(Array, i, &d->recent) {
-        const iRecentUrl *item = i.value;
+        iRecentUrl *item = (iRecentUrl *) i.value; /* remembers where the body was stored */
         serialize_String(&item->url, outs);
         write32_Stream(outs, item->normScrollY * 1.0e6f);
         if (item->cachedResponse) {
-            write8_Stream(outs, 1);
-            serialize_GmResponse(item->cachedResponse, outs);
+            /* The body goes to the page cache only once; its key is kept here. Compressed
+               bodies are stored as such. */
+            if (isEmpty_String(&item->storedBodyKey)) {
+                set_String(&item->storedBodyKey, store_PageCache(&item->cachedResponse->body));
+                item->isStoredBodyCompressed = item->isBodyCompressed;
+            }
+            else {
+                keep_PageCache(&item->storedBodyKey);
+            }
+            write8_Stream(outs,
+                          cachedResponse_RecentUrlSerialFlag |
+                              (item->isStoredBodyCompressed ? compressedBody_RecentUrlSerialFlag
+                                                            : 0));
+            serialize_String(&item->storedBodyKey, outs);
+            serializeWithoutBody_GmResponse(item->cachedResponse, outs);
         }
         else {
             write8_Stream(outs, 0);
@@ -148,12 +711,25 @@ void deserialize_History(iHistory *d, iStream *ins) {
         init_RecentUrl(&item);
         deserialize_String(&item.url, ins);
         item.normScrollY = (float) read32_Stream(ins) / 1.0e6f;
-        if (read8_Stream(ins)) {
-            item.cachedResponse = new_GmResponse();
-            deserialize_GmResponse(item.cachedResponse, ins);
+        const uint8_t flags = read8_Stream(ins);
+        if (flags & cachedResponse_RecentUrlSerialFlag) {
+            item.cachedResponse   = new_GmResponse();
+            item.isBodyCompressed = (flags & compressedBody_RecentUrlSerialFlag) != 0;
+            if (version_Stream(ins) >= addedPageCache_FileVersion) {
+                deserialize_String(&item.cachedBodyKey, ins);
+                deserializeWithoutBody_GmResponse(item.cachedResponse, ins);
+                set_String(&item.storedBodyKey, &item.cachedBodyKey);
+                item.isStoredBodyCompressed = item.isBodyCompressed;
+            }
+            else {
+                deserialize_GmResponse(item.cachedResponse, ins);
+            }
+            updateCacheEntry_History_(d, &item, normal_CachePriority);
         }
         pushBack_Array(&d->recent, &item);
     }
+    requestCompression_History_(d); /* restored bodies get indexed */
+    d->modCount++;
     unlock_Mutex(d->mtx);
 }
 
@@ -163,6 +739,11 @@ void clear_History(iHistory *d) {
         deinit_RecentUrl(s.value);
     }
     clear_Array(&d->recent);
+    iForEach(Array, p, &d->prefetched) {
+        deinit_RecentUrl(p.value);
+    }
+    clear_Array(&d->prefetched);
+    d->modCount++;
     unlock_Mutex(d->mtx);
 }
 
@@ -204,12 +785,73 @@ iRecentUrl *findUrl_History(iHistory *d, const iString *url) {
     return NULL;
 }
 
+iBool loadCachedBody_History(iHistory *d, iRecentUrl *item) {
+    iBool isAvailable;
+    lock_Mutex(d->mtx);
+    if (item->cachedResponse && !isEmpty_String(&item->cachedBodyKey)) {
+        if (load_PageCache(&item->cachedBodyKey, &item->cachedResponse->body)) {
+            shareBody_RecentUrl_(item); /* other tabs may have loaded the same body */
+        }
+        else {
+            /* Missing or damaged, so the page will have to be fetched again. */
+            dropResponse_RecentUrl_(item);
+        }
+        clear_String(&item->cachedBodyKey);
+    }
+    if (!decompressBody_RecentUrl_(item)) {
+        dropResponse_RecentUrl_(item);
+    }
+    index_RecentUrl_(item);
+    updateCacheEntry_History_(d, item, normal_CachePriority);
+    isAvailable = (item->cachedResponse != NULL);
+    if (!isAvailable) {
+        d->modCount++;
+    }
+    unlock_Mutex(d->mtx);
+    return isAvailable;
+}
+
+iBool setCachedDocument_History(iHistory *d, iGmDocument *doc, uint32_t layoutKey) {
+    iBool isKept = iFalse;
+    lock_Mutex(d->mtx);
+    iRecentUrl *item = findUrl_History(d, url_GmDocument(doc));
+    if (item && item->cachedResponse) {
+        iRelease(item->cachedDoc);
+        item->cachedDoc       = ref_Object(doc);
+        item->cachedDocLayout = layoutKey;
+        updateCacheEntry_History_(d, item, normal_CachePriority);
+        isKept = iTrue;
+    }
+    unlock_Mutex(d->mtx);
+    return isKept;
+}
+
+iGmDocument *takeCachedDocument_History(iHistory *d, iRecentUrl *item, uint32_t layoutKey) {
+    iGmDocument *doc = NULL;
+    lock_Mutex(d->mtx);
+    if (item->cachedDoc) {
+        if (item->cachedDocLayout == layoutKey) {
+            doc = item->cachedDoc; /* caller gets the reference */
+        }
+        else {
+            iRelease(item->cachedDoc); /* laid out for a different width or fonts */
+        }
+        item->cachedDoc = NULL;
+        if (item->cacheEntry) {
+            resize_CacheManager(item->cacheEntry, memorySize_RecentUrl_(item));
+        }
+    }
+    unlock_Mutex(d->mtx);
+    return doc;
+}
+
 void replace_History(iHistory *d, const iString *url) {
     lock_Mutex(d->mtx);
     /* Update in the history. */
     iRecentUrl *item = mostRecentUrl_History(d);
     if (item) {
         set_String(&item->url, url);
+        d->modCount++;
     }
     unlock_Mutex(d->mtx);
 }
@@ -237,6 +879,8 @@ void add_History(iHistory *d, const iString *url ){
             remove_Array(&d->recent, 0);
         }
     }
+    requestCompression_History_(d);
+    d->modCount++;
     unlock_Mutex(d->mtx);
 }
 
@@ -244,6 +888,8 @@ iBool goBack_History(iHistory *d) {
     lock_Mutex(d->mtx);
     if (d->recentPos < size_Array(&d->recent) - 1) {
         d->recentPos++;
+        requestCompression_History_(d);
+        d->modCount++;
         postCommandf_App("open history:1 scroll:%f url:%s",
                          mostRecentUrl_History(d)->normScrollY,
                          cstr_String(url_History(d, d->recentPos)));
@@ -258,6 +904,8 @@ iBool goForward_History(iHistory *d) {
     lock_Mutex(d->mtx);
     if (d->recentPos > 0) {
         d->recentPos--;
+        requestCompression_History_(d);
+        d->modCount++;
         postCommandf_App("open history:1 scroll:%f url:%s",
                          mostRecentUrl_History(d)->normScrollY,
                          cstr_String(url_History(d, d->recentPos)));
@@ -268,113 +916,175 @@ iBool goForward_History(iHistory *d) {
     return iFalse;
 }
 
-const iGmResponse *cachedResponse_History(const iHistory *d) {
-    const iRecentUrl *item = constMostRecentUrl_History(d);
-    return item ? item->cachedResponse : NULL;
+const iGmResponse *cachedResponse_History(iHistory *d) {
+    const iGmResponse *resp = NULL;
+    lock_Mutex(d->mtx);
+    iRecentUrl *item = mostRecentUrl_History(d);
+    if (item && decompressBody_RecentUrl_(item)) {
+        resp = item->cachedResponse;
+    }
+    unlock_Mutex(d->mtx);
+    return resp;
 }
 
 void setCachedResponse_History(iHistory *d, const iGmResponse *response) {
     lock_Mutex(d->mtx);
     iRecentUrl *item = mostRecentUrl_History(d);
     if (item) {
-        delete_GmResponse(item->cachedResponse);
-        item->cachedResponse = NULL;
+        dropResponse_RecentUrl_(item);
+        clear_String(&item->cachedBodyKey);
         if (category_GmStatusCode(response->statusCode) == categorySuccess_GmStatusCode) {
             item->cachedResponse = copy_GmResponse(response);
+            shareBody_RecentUrl_(item);
+            index_RecentUrl_(item);
         }
+        updateCacheEntry_History_(d, item, normal_CachePriority);
+        d->modCount++;
     }
     unlock_Mutex(d->mtx);
 }
 
-size_t cacheSize_History(const iHistory *d) {
-    size_t cached = 0;
+void addPrefetched_History(iHistory *d, const iString *url, const iGmResponse *response) {
     lock_Mutex(d->mtx);
-    iConstForEach(Array, i, &d->recent) {
-        const iRecentUrl *url = i.value;
-        if (url->cachedResponse) {
-            cached += size_Block(&url->cachedResponse->body);
+    iForEach(Array, i, &d->prefetched) {
+        iRecentUrl *item = i.value;
+        if (cmpStringCase_String(url, &item->url) == 0) {
+            deinit_RecentUrl(item);
+            remove_ArrayIterator(&i);
         }
     }
+    iRecentUrl item;
+    init_RecentUrl(&item);
+    set_String(&item.url, url);
+    item.cachedResponse = copy_GmResponse(response);
+    shareBody_RecentUrl_(&item);
+    index_RecentUrl_(&item);
+    updateCacheEntry_History_(d, &item, speculative_CachePriority);
+    pushBack_Array(&d->prefetched, &item);
+    if (size_Array(&d->prefetched) > maxPrefetched_History_) {
+        deinit_RecentUrl(front_Array(&d->prefetched));
+        remove_Array(&d->prefetched, 0);
+    }
+    requestCompression_History_(d);
     unlock_Mutex(d->mtx);
-    return cached;
 }
 
-size_t pruneLeastImportant_History(iHistory *d) {
-    size_t delta  = 0;
-    size_t chosen = iInvalidPos;
-    double score  = 0.0f;
-    iTime now;
-    initCurrent_Time(&now);
+iBool usePrefetched_History(iHistory *d, const iString *url) {
+    iBool used = iFalse;
     lock_Mutex(d->mtx);
-    iConstForEach(Array, i, &d->recent) {
-        const iRecentUrl *url = i.value;
-        if (url->cachedResponse) {
-            const double urlScore =
-                size_Block(&url->cachedResponse->body) *
-                pow(secondsSince_Time(&now, &url->cachedResponse->when) / 60.0, 1.25);
-            if (urlScore > score) {
-                chosen = index_ArrayConstIterator(&i);
-                score  = urlScore;
+    iRecentUrl *recent = mostRecentUrl_History(d);
+    if (recent && !recent->cachedResponse) {
+        iForEach(Array, i, &d->prefetched) {
+            iRecentUrl *item = i.value;
+            if (cmpStringCase_String(url, &item->url) == 0) {
+                if (equalCase_String(url, &recent->url)) {
+                    /* Move the response to the navigation stack. */
+                    recent->cachedResponse   = item->cachedResponse;
+                    recent->isBodyCompressed = item->isBodyCompressed;
+                    recent->sharedBody       = item->sharedBody;
+                    recent->cacheEntry       = item->cacheEntry;
+                    recent->indexKey         = item->indexKey;
+                    item->cachedResponse     = NULL;
+                    item->sharedBody         = NULL;
+                    item->cacheEntry         = NULL;
+                    item->indexKey           = 0;
+                    updateCacheEntry_History_(d, recent, normal_CachePriority);
+                    d->modCount++;
+                    used = iTrue;
+                }
+                deinit_RecentUrl(item);
+                remove_ArrayIterator(&i);
+                break;
             }
         }
     }
-    if (chosen != iInvalidPos) {
-        iRecentUrl *url = at_Array(&d->recent, chosen);
-        delta = size_Block(&url->cachedResponse->body);
-        delete_GmResponse(url->cachedResponse);
-        url->cachedResponse = NULL;
-    }
     unlock_Mutex(d->mtx);
-    return delta;
+    return used;
 }
 
-const iStringArray *searchContents_History(const iHistory *d, const iRegExp *pattern) {
+iDeclareType(SearchedBody)
+
+struct Impl_SearchedBody {
+    iString url;
+    iBlock  body; /* shares the data of the cached response */
+    iString bodyKey;
+    iBool   isCompressed;
+};
+
+const iStringArray *searchContents_History(const iHistory *d, const iRegExp *pattern,
+                                           const iString *terms) {
     iStringArray *urls = iClob(new_StringArray());
+    /* Pages that can't contain the terms are skipped without looking at their bodies. */
+    iIntSet *candidates = find_ContentIndex(terms);
+    /* The bodies are decompressed and searched without holding the lock. */
+    iArray bodies;
+    init_Array(&bodies, sizeof(iSearchedBody));
     lock_Mutex(d->mtx);
+    iReverseConstForEach(Array, i, &d->recent) {
+        const iRecentUrl *item = i.value;
+        if (!isSearchable_RecentUrl_(item) ||
+            (candidates && item->indexKey && !contains_IntSet(candidates, item->indexKey))) {
+            continue;
+        }
+        if (!isEmpty_String(&item->cachedBodyKey) && (!candidates || !item->indexKey)) {
+            /* Not loaded, and the index can't tell if it matches: reading it from disk on
+               every search would be too slow. */
+            continue;
+        }
+        iSearchedBody searched;
+        initCopy_String(&searched.url, &item->url);
+        initCopy_Block(&searched.body, &item->cachedResponse->body);
+        initCopy_String(&searched.bodyKey, &item->cachedBodyKey);
+        searched.isCompressed = item->isBodyCompressed;
+        pushBack_Array(&bodies, &searched);
+    }
+    unlock_Mutex(d->mtx);
+    if (candidates) {
+        delete_IntSet(candidates);
+    }
     iStringSet inserted;
     init_StringSet(&inserted);
-    iReverseConstForEach(Array, i, &d->recent) {
-        const iRecentUrl *url = i.value;
-        const iGmResponse *resp = url->cachedResponse;
-        if (resp && category_GmStatusCode(resp->statusCode) == categorySuccess_GmStatusCode) {
-            if (indexOfCStrSc_String(&resp->meta, "text/", &iCaseInsensitive) == iInvalidPos) {
-                continue;
+    iForEach(Array, j, &bodies) {
+        iSearchedBody *searched = j.value;
+        const iBlock *body = readableBody_(&searched->body, &searched->bodyKey,
+                                           searched->isCompressed);
+        iRegExpMatch m;
+        init_RegExpMatch(&m);
+        if (matchRange_RegExp(pattern, range_Block(body), &m)) {
+            iString entry;
+            init_String(&entry);
+            iRangei cap = m.range;
+            const int prefix = iMin(10, cap.start);
+            cap.start   = cap.start - prefix;
+            cap.end     = iMin(cap.end + 30, (int) size_Block(body));
+            const size_t maxLen = 60;
+            if (size_Range(&cap) > maxLen) {
+                cap.end = cap.start + maxLen;
             }
-            iRegExpMatch m;
-            init_RegExpMatch(&m);
-            if (matchRange_RegExp(pattern, range_Block(&resp->body), &m)) {
-                iString entry;
-                init_String(&entry);
-                iRangei cap = m.range;
-                const int prefix = iMin(10, cap.start);
-                cap.start   = cap.start - prefix;
-                cap.end     = iMin(cap.end + 30, (int) size_Block(&resp->body));
-                const size_t maxLen = 60;
-                if (size_Range(&cap) > maxLen) {
-                    cap.end = cap.start + maxLen;
-                }
-                iString content;
-                initRange_String(&content, (iRangecc){ m.subject + cap.start, m.subject + cap.end });
-                /* This needs cleaning up; highlight the matched word. */
-                replace_Block(&content.chars, '\n', ' ');
-                replace_Block(&content.chars, '\r', ' ');
-                if (prefix + size_Range(&m.range) < size_String(&content)) {
-                    insertData_Block(&content.chars, prefix + size_Range(&m.range), uiText_ColorEscape, 2);
-                }
-                insertData_Block(&content.chars, prefix, uiTextStrong_ColorEscape, 2);
-                format_String(
-                    &entry, "match len:%zu str:%s", size_String(&content), cstr_String(&content));
-                deinit_String(&content);
-                appendFormat_String(&entry, " url:%s", cstr_String(&url->url));
-                if (!contains_StringSet(&inserted, &url->url)) {
-                    pushFront_StringArray(urls, &entry);
-                    insert_StringSet(&inserted, &url->url);
-                }
-                deinit_String(&entry);
+            iString content;
+            initRange_String(&content, (iRangecc){ m.subject + cap.start, m.subject + cap.end });
+            /* This needs cleaning up; highlight the matched word. */
+            replace_Block(&content.chars, '\n', ' ');
+            replace_Block(&content.chars, '\r', ' ');
+            if (prefix + size_Range(&m.range) < size_String(&content)) {
+                insertData_Block(&content.chars, prefix + size_Range(&m.range), uiText_ColorEscape, 2);
+            }
+            insertData_Block(&content.chars, prefix, uiTextStrong_ColorEscape, 2);
+            format_String(
+                &entry, "match len:%zu str:%s", size_String(&content), cstr_String(&content));
+            deinit_String(&content);
+            appendFormat_String(&entry, " url:%s", cstr_String(&searched->url));
+            if (!contains_StringSet(&inserted, &searched->url)) {
+                pushFront_StringArray(urls, &entry);
+                insert_StringSet(&inserted, &searched->url);
             }
+            deinit_String(&entry);
         }
+        deinit_String(&searched->bodyKey);
+        deinit_Block(&searched->body);
+        deinit_String(&searched->url);
     }
     deinit_StringSet(&inserted);
-    unlock_Mutex(d->mtx);
+    deinit_Array(&bodies);
     return urls;
 }
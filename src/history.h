@@ -22,6 +22,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 
 #pragma once
 
+#include "cachemanager.h"
 #include "gmrequest.h"
 
 #include <the_Foundation/ptrarray.h>
@@ -30,6 +31,8 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 #include <the_Foundation/stringarray.h>
 #include <the_Foundation/time.h>
 
+iDeclareType(GmDocument)
+iDeclareType(SharedBody)
 iDeclareType(RecentUrl)
 iDeclareTypeConstruction(RecentUrl)
 
@@ -37,28 +40,48 @@ struct Impl_RecentUrl {
     iString      url;
     float        normScrollY;    /* normalized to document height */
     iGmResponse *cachedResponse; /* kept in memory for quicker back navigation */
+    iString      cachedBodyKey;  /* body is in the page cache but not loaded yet */
+    iString      storedBodyKey;  /* body has been saved in the page cache with this key... */
+    iBool        isStoredBodyCompressed; /* ...in this form */
+    iBool        isBodyCompressed;
+    iSharedBody *sharedBody;     /* body data is shared with identical responses */
+    iGmDocument *cachedDoc;      /* laid out when last shown; not serialized */
+    uint32_t     cachedDocLayout;/* layout parameters of the cached document */
+    iCacheEntry *cacheEntry;     /* memory used by the cached response */
+    uint32_t     indexKey;       /* body text in the content index; zero if not indexed */
 };
 
 /*----------------------------------------------------------------------------------------------*/
 
+void        init_SharedBodies           (void); /* identical bodies of all histories */
+void        deinit_SharedBodies         (void);
+void        init_HistoryCompressor      (void); /* background compression of inactive bodies */
+void        deinit_HistoryCompressor    (void);
+
 iDeclareType(History)
 iDeclareTypeConstruction(History)
 iDeclareTypeSerialization(History)
 
 iHistory *  copy_History                (const iHistory *);
+uint32_t    modCount_History            (const iHistory *); /* changes when serialized state does */
 
 void        clear_History               (iHistory *);
 void        add_History                 (iHistory *, const iString *url);
 void        replace_History             (iHistory *, const iString *url);
 void        setCachedResponse_History   (iHistory *, const iGmResponse *response);
+void        addPrefetched_History       (iHistory *, const iString *url, const iGmResponse *response);
+iBool       usePrefetched_History       (iHistory *, const iString *url);
 iBool       goBack_History              (iHistory *);
 iBool       goForward_History           (iHistory *);
 iRecentUrl *recentUrl_History           (iHistory *, size_t pos);
 iRecentUrl *mostRecentUrl_History       (iHistory *);
 iRecentUrl *findUrl_History             (iHistory *, const iString *url);
-size_t      pruneLeastImportant_History (iHistory *);
+iBool       loadCachedBody_History      (iHistory *, iRecentUrl *item);
+iBool       setCachedDocument_History   (iHistory *, iGmDocument *doc, uint32_t layoutKey);
+iGmDocument *takeCachedDocument_History (iHistory *, iRecentUrl *item, uint32_t layoutKey);
 
-const iStringArray *   searchContents_History   (const iHistory *, const iRegExp *pattern); /* chronologically ascending */
+const iStringArray *   searchContents_History   (const iHistory *, const iRegExp *pattern,
+                                                  const iString *terms); /* chronologically ascending */
 
 const iString *
             url_History                 (const iHistory *, size_t pos);
@@ -67,8 +90,7 @@ const iRecentUrl *
 const iRecentUrl *
             constMostRecentUrl_History  (const iHistory *);
 const iGmResponse *
-            cachedResponse_History      (const iHistory *);
-size_t      cacheSize_History           (const iHistory *);
+            cachedResponse_History      (iHistory *); /* body is decompressed if needed */
 
 iString *   debugInfo_History           (const iHistory *);
 
@@ -154,6 +154,10 @@ void clear_Media(iMedia *d) {
     clear_PtrArray(&d->audio);
 }
 
+iBool isEmpty_Media(const iMedia *d) {
+    return isEmpty_PtrArray(&d->images) && isEmpty_PtrArray(&d->audio);
+}
+
 iBool setData_Media(iMedia *d, iGmLinkId linkId, const iString *mime, const iBlock *data,
                     int flags) {
     const iBool isPartial  = (flags & partialData_MediaFlag) != 0;
@@ -318,6 +322,7 @@ void init_MediaRequest(iMediaRequest *d, iDocumentWidget *doc, unsigned int link
     d->linkId = linkId;
     d->req    = new_GmRequest(certs_App());
     setUrl_GmRequest(d->req, url);
+    setPriority_GmRequest(d->req, inline_GmRequestPriority);
     iConnect(GmRequest, d->req, updated, d, updated_MediaRequest_);
     iConnect(GmRequest, d->req, finished, d, finished_MediaRequest_);
     submit_GmRequest(d->req);
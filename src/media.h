@@ -54,6 +54,7 @@ enum iMediaFlags {
 };
 
 void    clear_Media     (iMedia *);
+iBool   isEmpty_Media   (const iMedia *);
 iBool   setData_Media   (iMedia *, uint16_t linkId, const iString *mime, const iBlock *data, int flags);
 
 iMediaId        findLinkImage_Media (const iMedia *, uint16_t linkId);
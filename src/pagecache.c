@@ -0,0 +1,397 @@
+/* Copyright 2020 Jaakko Keränen <jaakko.keranen@iki.fi>
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+#include "pagecache.h"
+#include "sha256.h"
+#include "statejournal.h"
+
+#include <the_Foundation/file.h>
+#include <the_Foundation/fileinfo.h>
+#include <the_Foundation/mutex.h>
+#include <the_Foundation/path.h>
+#include <the_Foundation/ptrarray.h>
+#include <the_Foundation/stringset.h>
+#include <the_Foundation/thread.h>
+
+#include <ctype.h>
+#include <stdio.h> /* remove() */
+
+static const char *dirName_PageCache_   = "cache";
+static const char *indexName_PageCache_ = "index.txt"; /* no longer used */
+static const size_t maxPreloadSize_PageCache_ = 16 * 1000000; /* bytes kept in memory */
+
+iDeclareType(CachedBody)
+
+struct Impl_CachedBody {
+    iString key;
+    iBlock  body;
+};
+
+static iCachedBody *new_CachedBody_(const iString *key) {
+    iCachedBody *d = iMalloc(CachedBody);
+    initCopy_String(&d->key, key);
+    init_Block(&d->body, 0);
+    return d;
+}
+
+static void delete_CachedBody_(iCachedBody *d) {
+    deinit_String(&d->key);
+    deinit_Block(&d->body);
+    free(d);
+}
+
+iDeclareType(PageCache)
+
+struct Impl_PageCache {
+    iMutex *    mtx;
+    iString     dir;
+    iStringSet *stored; /* keys of all body files on disk, found when initializing */
+    iStringSet *used;   /* keys referenced since takeUnused_PageCache() */
+    iThread *   preloader;
+    iCondition  preloadWanted;
+    iBool       isStopping;
+    iPtrArray   preloadQueue; /* iString *, keys waiting to be read */
+    iPtrArray   preloaded;    /* iCachedBody * */
+    size_t      preloadedSize;
+    iString *   preloading;   /* key being read right now */
+    iBool       isPreloadCancelled;
+    iPtrArray   pendingWrites; /* iCachedBody *, stored but not yet on disk */
+};
+
+static iPageCache pageCache_;
+
+static const iString *key_PageCache_(const iBlock *body) {
+    /* Different bodies never end up with the same key, and the key also verifies the
+       contents when reading. */
+    const iSha256 digest = digest_Sha256(body);
+    return hex_Sha256(&digest);
+}
+
+static iBool isKey_PageCache_(iRangecc name) {
+    /* Keys of older versions are shorter: a CRC-32 and the size. */
+    if (size_Range(&name) != 64 && size_Range(&name) != 16) {
+        return iFalse;
+    }
+    for (const char *ch = name.start; ch != name.end; ch++) {
+        if (!isxdigit((unsigned char) *ch)) {
+            return iFalse;
+        }
+    }
+    return iTrue;
+}
+
+static iBool isIntact_PageCache_(const iString *key, const iBlock *body) {
+    if (size_String(key) == 16) {
+        return equal_String(key, collectNewFormat_String("%08x%08x",
+                                                         crc32_Block(body),
+                                                         (uint32_t) size_Block(body)));
+    }
+    return equal_String(key, key_PageCache_(body));
+}
+
+static const iString *path_PageCache_(const iPageCache *d, const iString *key) {
+    return collect_String(concat_Path(&d->dir, key));
+}
+
+static void findStored_PageCache_(iPageCache *d) {
+    /* The directory itself is the index, so bodies written just before a crash are known
+       and can be collected. */
+    iForEach(DirFileInfo, i, iClob(directoryContents_FileInfo(iClob(new_FileInfo(&d->dir))))) {
+        const iString *path = path_FileInfo(i.value);
+        const iRangecc name = baseName_Path(path);
+        if (isKey_PageCache_(name)) {
+            insert_StringSet(d->stored, collect_String(newRange_String(name)));
+        }
+        else if (endsWith_Rangecc(name, ".tmp") ||
+                 equal_Rangecc(name, indexName_PageCache_)) {
+            remove(cstr_String(path)); /* unfinished write or an old index */
+        }
+    }
+}
+
+static iBool readBody_PageCache_(const iString *path, const iString *key, iBlock *body_out) {
+    iBool ok = iFalse;
+    iFile *f = new_File(path);
+    if (open_File(f, readOnly_FileMode)) {
+        iBlock *data = readAll_File(f);
+        set_Block(body_out, data);
+        delete_Block(data);
+        /* The key doubles as a checksum. */
+        ok = isIntact_PageCache_(key, body_out);
+        if (!ok) {
+            clear_Block(body_out);
+        }
+    }
+    iRelease(f);
+    return ok;
+}
+
+static iThreadResult preload_PageCache_(iThread *thread) {
+    iPageCache *d = userData_Thread(thread);
+    lock_Mutex(d->mtx);
+    for (;;) {
+        while (!d->isStopping && isEmpty_PtrArray(&d->preloadQueue)) {
+            wait_Condition(&d->preloadWanted, d->mtx);
+        }
+        if (d->isStopping) {
+            break;
+        }
+        iString *key = NULL;
+        take_PtrArray(&d->preloadQueue, 0, (void **) &key);
+        if (d->preloadedSize >= maxPreloadSize_PageCache_) {
+            delete_String(key);
+            continue;
+        }
+        iBeginCollect();
+        const iString *path = path_PageCache_(d, key);
+        d->preloading = key;
+        d->isPreloadCancelled = iFalse;
+        /* Reading happens outside the lock so the UI thread is never held up by it. */
+        unlock_Mutex(d->mtx);
+        iCachedBody *pre = new_CachedBody_(key);
+        const iBool ok = readBody_PageCache_(path, key, &pre->body);
+        iEndCollect();
+        lock_Mutex(d->mtx);
+        d->preloading = NULL;
+        delete_String(key);
+        if (ok && !d->isPreloadCancelled) {
+            d->preloadedSize += size_Block(&pre->body);
+            pushBack_PtrArray(&d->preloaded, pre);
+        }
+        else {
+            delete_CachedBody_(pre);
+        }
+    }
+    unlock_Mutex(d->mtx);
+    return 0;
+}
+
+void init_PageCache(const char *saveDir) {
+    iPageCache *d = &pageCache_;
+    d->mtx = new_Mutex();
+    init_String(&d->dir);
+    set_String(&d->dir, collect_String(concatCStr_Path(collectNewCStr_String(saveDir),
+                                                       dirName_PageCache_)));
+    d->stored = new_StringSet();
+    d->used   = new_StringSet();
+    if (!fileExists_FileInfo(&d->dir)) {
+        makeDirs_Path(&d->dir);
+    }
+    findStored_PageCache_(d);
+    init_Condition(&d->preloadWanted);
+    d->isStopping = iFalse;
+    init_PtrArray(&d->preloadQueue);
+    init_PtrArray(&d->preloaded);
+    d->preloadedSize = 0;
+    d->preloading         = NULL;
+    d->isPreloadCancelled = iFalse;
+    init_PtrArray(&d->pendingWrites);
+    d->preloader = new_Thread(preload_PageCache_);
+    setUserData_Thread(d->preloader, d);
+    start_Thread(d->preloader);
+}
+
+void deinit_PageCache(void) {
+    iPageCache *d = &pageCache_;
+    /* Stop the preloader. */ {
+        iGuardMutex(d->mtx, {
+            d->isStopping = iTrue;
+            signal_Condition(&d->preloadWanted);
+        });
+        join_Thread(d->preloader);
+        iRelease(d->preloader);
+    }
+    iForEach(PtrArray, q, &d->preloadQueue) {
+        delete_String(q.ptr);
+    }
+    deinit_PtrArray(&d->preloadQueue);
+    iForEach(PtrArray, p, &d->preloaded) {
+        delete_CachedBody_(p.ptr);
+    }
+    deinit_PtrArray(&d->preloaded);
+    deinit_Condition(&d->preloadWanted);
+    writePending_PageCache();
+    deinit_PtrArray(&d->pendingWrites);
+    iRelease(d->used);
+    iRelease(d->stored);
+    deinit_String(&d->dir);
+    delete_Mutex(d->mtx);
+}
+
+static iCachedBody *findPending_PageCache_(const iPageCache *d, const iString *key) {
+    iConstForEach(PtrArray, i, &d->pendingWrites) {
+        if (equal_String(&((iCachedBody *) i.ptr)->key, key)) {
+            return i.ptr;
+        }
+    }
+    return NULL;
+}
+
+const iString *store_PageCache(const iBlock *body) {
+    /* The body is written later by the state journal's writer. */
+    iPageCache *d = &pageCache_;
+    const iString *key = key_PageCache_(body);
+    lock_Mutex(d->mtx);
+    if (!contains_StringSet(d->stored, key) && !findPending_PageCache_(d, key)) {
+        iCachedBody *pending = new_CachedBody_(key);
+        set_Block(&pending->body, body); /* shares the data */
+        pushBack_PtrArray(&d->pendingWrites, pending);
+    }
+    insert_StringSet(d->used, key);
+    unlock_Mutex(d->mtx);
+    return key;
+}
+
+void writePending_PageCache(void) {
+    /* Called by the state journal's writer thread, too. */
+    iPageCache *d = &pageCache_;
+    iPtrArray writes;
+    init_PtrArray(&writes);
+    iGuardMutex(d->mtx, {
+        iConstForEach(PtrArray, i, &d->pendingWrites) {
+            pushBack_PtrArray(&writes, i.ptr);
+        }
+    });
+    /* The bodies stay pending until written so they can still be loaded meanwhile. */
+    iBeginCollect();
+    iConstForEach(PtrArray, i, &writes) {
+        iCachedBody *pending = i.ptr;
+        const iBool  ok = writeFile_StateJournal(path_PageCache_(d, &pending->key), &pending->body);
+        lock_Mutex(d->mtx);
+        if (ok) {
+            insert_StringSet(d->stored, &pending->key);
+        }
+        else {
+            remove_StringSet(d->used, &pending->key); /* nothing to keep */
+        }
+        removeOne_PtrArray(&d->pendingWrites, pending);
+        unlock_Mutex(d->mtx);
+        delete_CachedBody_(pending);
+    }
+    iEndCollect();
+    deinit_PtrArray(&writes);
+}
+
+void keep_PageCache(const iString *key) {
+    iPageCache *d = &pageCache_;
+    iGuardMutex(d->mtx, insert_StringSet(d->used, key));
+}
+
+void preload_PageCache(const iString *key) {
+    iPageCache *d = &pageCache_;
+    iGuardMutex(d->mtx, {
+        pushBack_PtrArray(&d->preloadQueue, copy_String(key));
+        signal_Condition(&d->preloadWanted);
+    });
+}
+
+void cancelPreload_PageCache(const iString *key) {
+    iPageCache *d = &pageCache_;
+    lock_Mutex(d->mtx);
+    iForEach(PtrArray, q, &d->preloadQueue) {
+        if (equal_String(q.ptr, key)) {
+            delete_String(q.ptr);
+            remove_PtrArrayIterator(&q);
+            break;
+        }
+    }
+    if (d->preloading && equal_String(d->preloading, key)) {
+        d->isPreloadCancelled = iTrue;
+    }
+    iForEach(PtrArray, i, &d->preloaded) {
+        iCachedBody *pre = i.ptr;
+        if (equal_String(&pre->key, key)) {
+            d->preloadedSize -= size_Block(&pre->body);
+            remove_PtrArrayIterator(&i);
+            delete_CachedBody_(pre);
+            break;
+        }
+    }
+    unlock_Mutex(d->mtx);
+}
+
+static iBool load_PageCache_(iPageCache *d, const iString *key, iBlock *body_out,
+                            iBool takePreloaded) {
+    lock_Mutex(d->mtx);
+    iForEach(PtrArray, i, &d->preloaded) {
+        iCachedBody *pre = i.ptr;
+        if (equal_String(&pre->key, key)) {
+            set_Block(body_out, &pre->body);
+            if (takePreloaded) {
+                d->preloadedSize -= size_Block(&pre->body);
+                remove_PtrArrayIterator(&i);
+                delete_CachedBody_(pre);
+            }
+            unlock_Mutex(d->mtx);
+            return iTrue;
+        }
+    }
+    const iCachedBody *pending = findPending_PageCache_(d, key);
+    if (pending) {
+        set_Block(body_out, &pending->body);
+        unlock_Mutex(d->mtx);
+        return iTrue;
+    }
+    const iString *path = path_PageCache_(d, key);
+    unlock_Mutex(d->mtx);
+    return readBody_PageCache_(path, key, body_out);
+}
+
+iBool load_PageCache(const iString *key, iBlock *body_out) {
+    /* Bodies that were read ahead of time are used only once. */
+    return load_PageCache_(&pageCache_, key, body_out, iTrue);
+}
+
+iBool peek_PageCache(const iString *key, iBlock *body_out) {
+    return load_PageCache_(&pageCache_, key, body_out, iFalse);
+}
+
+iStringSet *takeUnused_PageCache(void) {
+    /* Called after every tab has been serialized, so unreferenced bodies are garbage. */
+    iPageCache *d = &pageCache_;
+    iStringSet *unused = new_StringSet();
+    lock_Mutex(d->mtx);
+    for (size_t i = 0; i < size_StringSet(d->stored); i++) {
+        const iString *key = constAt_StringSet(d->stored, i);
+        if (!contains_StringSet(d->used, key)) {
+            insert_StringSet(unused, key);
+        }
+    }
+    clear_StringSet(d->used);
+    unlock_Mutex(d->mtx);
+    return unused;
+}
+
+void collectGarbage_PageCache(const iStringSet *unused) {
+    /* Called once the state that no longer refers to `unused` has been written. Bodies that
+       have been referenced again in the meantime are kept. */
+    iPageCache *d = &pageCache_;
+    lock_Mutex(d->mtx);
+    for (size_t i = 0; i < size_StringSet(unused); i++) {
+        const iString *key = constAt_StringSet(unused, i);
+        if (!contains_StringSet(d->used, key)) {
+            remove(cstr_String(path_PageCache_(d, key)));
+            remove_StringSet(d->stored, key);
+        }
+    }
+    unlock_Mutex(d->mtx);
+}
@@ -0,0 +1,43 @@
+/* Copyright 2020 Jaakko Keränen <jaakko.keranen@iki.fi>
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+#pragma once
+
+#include <the_Foundation/block.h>
+#include <the_Foundation/string.h>
+#include <the_Foundation/stringset.h>
+
+/* Content-addressed store for the bodies of cached responses. Saved tab state refers to
+   bodies by key, and the bodies are read back only when actually needed. */
+
+void            init_PageCache              (const char *saveDir);
+void            deinit_PageCache            (void);
+
+const iString * store_PageCache             (const iBlock *body); /* returns key */
+void            writePending_PageCache      (void);
+void            keep_PageCache              (const iString *key);
+void            preload_PageCache           (const iString *key); /* read in the background */
+void            cancelPreload_PageCache     (const iString *key);
+iBool           load_PageCache              (const iString *key, iBlock *body_out);
+iBool           peek_PageCache              (const iString *key, iBlock *body_out); /* leaves preloaded body */
+iStringSet *    takeUnused_PageCache        (void); /* since the previous call */
+void            collectGarbage_PageCache    (const iStringSet *unused);
@@ -35,6 +35,8 @@ void init_Prefs(iPrefs *d) {
     d->loadImageInsteadOfScrolling = iFalse;
     d->decodeUserVisibleURLs = iTrue;
     d->maxCacheSize      = 10;
+    d->prefetchLinks     = 0;
+    d->maxFeedRequests   = 4;
     d->font              = nunito_TextFont;
     d->headingFont       = nunito_TextFont;
     d->monospaceGemini   = iFalse;
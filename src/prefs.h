@@ -50,6 +50,8 @@ struct Impl_Prefs {
     /* Network */
     iBool            decodeUserVisibleURLs;
     int              maxCacheSize; /* MB */
+    int              prefetchLinks; /* number of likely next pages to load in advance */
+    int              maxFeedRequests; /* concurrent requests when refreshing feeds */
     iString          geminiProxy;
     iString          gopherProxy;
     iString          httpProxy;
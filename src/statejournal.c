@@ -0,0 +1,528 @@
+/* Copyright 2020 Jaakko Keränen <jaakko.keranen@iki.fi>
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+#include "statejournal.h"
+#include "defs.h"
+#include "pagecache.h"
+
+#include <the_Foundation/file.h>
+#include <the_Foundation/fileinfo.h>
+#include <the_Foundation/mutex.h>
+#include <the_Foundation/path.h>
+#include <the_Foundation/thread.h>
+
+#include <stdio.h> /* rename(), remove() */
+#if defined (iPlatformMsys)
+#   include <io.h>
+#else
+#   include <unistd.h>
+#endif
+
+static const char *stateFileName_StateJournal_   = "state.lgr";
+static const char *journalFileName_StateJournal_ = "state.journal";
+static const char *magicState_StateJournal_      = "lgS1"; /* older versions only know "lgL1" */
+static const char *magicJournal_StateJournal_    = "lgJ1";
+static const char *magicTabs_StateJournal_       = "ordr";
+static const char *magicTab_StateJournal_        = "tabd";
+static const size_t maxJournalSize_StateJournal_ = 256 * 1024; /* bytes before compaction */
+
+iDeclareType(JournalTab)
+
+struct Impl_JournalTab {
+    iString  id;
+    iBlock   state;
+    uint32_t crc;
+    uint32_t modCount; /* of the tab when `state` was last updated */
+};
+
+static iJournalTab *new_JournalTab_(const iString *id) {
+    iJournalTab *d = iMalloc(JournalTab);
+    initCopy_String(&d->id, id);
+    init_Block(&d->state, 0);
+    d->crc      = 0;
+    d->modCount = 0;
+    return d;
+}
+
+static void delete_JournalTab_(iJournalTab *d) {
+    deinit_String(&d->id);
+    deinit_Block(&d->state);
+    free(d);
+}
+
+struct Impl_StateJournal {
+    iString    statePath;
+    iString    journalPath;
+    iPtrArray  tabs;        /* iJournalTab *, in tab order */
+    size_t     currentTab;
+    uint32_t   generation;  /* the journal only applies to a state file of the same generation */
+    size_t     journalSize; /* bytes committed since the last compaction */
+    iBool      isOutdated;  /* restored state is in an older format */
+    iBlock     pending;     /* records not yet committed */
+    /* Writer thread: */
+    iMutex *   mtx;
+    iThread *  writer;
+    iCondition wakeUp;
+    iBool      isStopping;
+    iBlock     appendQueue; /* records to append to the journal */
+    iBlock *   compacted;   /* complete state to write, replacing the journal */
+    iStringSet *garbage;    /* page cache bodies unused by `compacted` */
+};
+
+iDefineTypeConstructionArgs(StateJournal, (const char *saveDir), saveDir)
+
+/*----------------------------------------------------------------------------------------------*/
+
+static void appendU16_(iBlock *d, uint16_t value) {
+    const uint8_t bytes[2] = { value & 0xff, value >> 8 };
+    appendData_Block(d, bytes, 2);
+}
+
+static void appendU32_(iBlock *d, uint32_t value) {
+    const uint8_t bytes[4] = { value & 0xff, (value >> 8) & 0xff, (value >> 16) & 0xff,
+                               value >> 24 };
+    appendData_Block(d, bytes, 4);
+}
+
+static void appendId_(iBlock *d, const iString *id) {
+    appendU16_(d, (uint16_t) size_String(id));
+    append_Block(d, &id->chars);
+}
+
+static void appendRecord_(iBlock *d, const char *magic, const iBlock *payload) {
+    appendData_Block(d, magic, 4);
+    appendU32_(d, (uint32_t) size_Block(payload));
+    appendU32_(d, crc32_Block(payload));
+    append_Block(d, payload);
+}
+
+static iBool readU16_(iRangecc *src, uint16_t *value_out) {
+    if (size_Range(src) < 2) return iFalse;
+    const uint8_t *p = (const uint8_t *) src->start;
+    *value_out = p[0] | (p[1] << 8);
+    src->start += 2;
+    return iTrue;
+}
+
+static iBool readU32_(iRangecc *src, uint32_t *value_out) {
+    if (size_Range(src) < 4) return iFalse;
+    const uint8_t *p = (const uint8_t *) src->start;
+    *value_out = p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+    src->start += 4;
+    return iTrue;
+}
+
+static iBool readId_(iRangecc *src, iString *id_out) {
+    uint16_t len;
+    if (!readU16_(src, &len) || size_Range(src) < len) return iFalse;
+    setRange_String(id_out, (iRangecc){ src->start, src->start + len });
+    src->start += len;
+    return iTrue;
+}
+
+/*----------------------------------------------------------------------------------------------*/
+
+static iJournalTab *findTab_StateJournal_(const iStateJournal *d, const iString *id) {
+    iConstForEach(PtrArray, i, &d->tabs) {
+        iJournalTab *tab = i.ptr;
+        if (equal_String(&tab->id, id)) {
+            return tab;
+        }
+    }
+    return NULL;
+}
+
+static void clearTabs_StateJournal_(iStateJournal *d) {
+    iForEach(PtrArray, i, &d->tabs) {
+        delete_JournalTab_(i.ptr);
+    }
+    clear_PtrArray(&d->tabs);
+    d->currentTab = 0;
+}
+
+static void encodeTabs_StateJournal_(const iStateJournal *d, iBlock *out) {
+    iBlock payload;
+    init_Block(&payload, 0);
+    appendU16_(&payload, (uint16_t) d->currentTab);
+    appendU16_(&payload, (uint16_t) size_PtrArray(&d->tabs));
+    iConstForEach(PtrArray, i, &d->tabs) {
+        appendId_(&payload, &((const iJournalTab *) i.ptr)->id);
+    }
+    appendRecord_(out, magicTabs_StateJournal_, &payload);
+    deinit_Block(&payload);
+}
+
+static void encodeTab_StateJournal_(const iJournalTab *tab, iBlock *out) {
+    iBlock payload;
+    init_Block(&payload, 0);
+    appendId_(&payload, &tab->id);
+    append_Block(&payload, &tab->state);
+    appendRecord_(out, magicTab_StateJournal_, &payload);
+    deinit_Block(&payload);
+}
+
+static void encodeHeader_StateJournal_(const iStateJournal *d, const char *magic,
+                                       uint32_t generation, iBlock *out) {
+    iUnused(d);
+    appendData_Block(out, magic, 4);
+    appendU32_(out, latest_FileVersion);
+    appendU32_(out, generation);
+}
+
+static iBool applyRecord_StateJournal_(iStateJournal *d, const char *magic, iRangecc payload) {
+    if (!memcmp(magic, magicTabs_StateJournal_, 4)) {
+        uint16_t current, count;
+        if (!readU16_(&payload, &current) || !readU16_(&payload, &count)) {
+            return iFalse;
+        }
+        iPtrArray ordered;
+        init_PtrArray(&ordered);
+        iString id;
+        init_String(&id);
+        iBool ok = iTrue;
+        for (uint16_t i = 0; i < count && ok; i++) {
+            if ((ok = readId_(&payload, &id)) != iFalse) {
+                iJournalTab *tab = findTab_StateJournal_(d, &id);
+                if (tab) {
+                    removeOne_PtrArray(&d->tabs, tab);
+                }
+                else {
+                    tab = new_JournalTab_(&id);
+                }
+                pushBack_PtrArray(&ordered, tab);
+            }
+        }
+        deinit_String(&id);
+        /* Tabs that are not listed have been closed. */
+        clearTabs_StateJournal_(d);
+        iForEach(PtrArray, j, &ordered) {
+            pushBack_PtrArray(&d->tabs, j.ptr);
+        }
+        deinit_PtrArray(&ordered);
+        d->currentTab = current;
+        return ok;
+    }
+    if (!memcmp(magic, magicTab_StateJournal_, 4)) {
+        iString id;
+        init_String(&id);
+        const iBool ok = readId_(&payload, &id);
+        iJournalTab *tab = ok ? findTab_StateJournal_(d, &id) : NULL;
+        if (tab) {
+            setData_Block(&tab->state, payload.start, size_Range(&payload));
+            tab->crc = crc32_Block(&tab->state);
+        }
+        deinit_String(&id);
+        return ok;
+    }
+    return iFalse;
+}
+
+static iBool readFile_StateJournal_(iStateJournal *d, const iString *path, const char *magic,
+                                    uint32_t *generation, uint32_t *version_out) {
+    /* If `generation` is nonzero, it must match the file. Reading stops at the first damaged
+       record; everything before it is kept. */
+    iBool ok = iFalse;
+    iFile *f = new_File(path);
+    if (open_File(f, readOnly_FileMode)) {
+        iBlock  *data    = readAll_File(f);
+        iRangecc src     = range_Block(data);
+        uint32_t version = 0, gen = 0;
+        if (size_Range(&src) >= 12 && !memcmp(src.start, magic, 4)) {
+            src.start += 4;
+            readU32_(&src, &version);
+            readU32_(&src, &gen);
+        }
+        if (version >= addedStateJournal_FileVersion && version <= latest_FileVersion &&
+            (*generation == 0 || *generation == gen)) {
+            *generation  = gen;
+            *version_out = version;
+            ok = iTrue;
+            while (size_Range(&src) >= 12) {
+                const char *recMagic = src.start;
+                uint32_t size, crc;
+                src.start += 4;
+                readU32_(&src, &size);
+                readU32_(&src, &crc);
+                if (size_Range(&src) < size) {
+                    break; /* cut short */
+                }
+                iBlock payload;
+                init_Block(&payload, 0);
+                setData_Block(&payload, src.start, size);
+                const iBool isIntact = (crc32_Block(&payload) == crc);
+                deinit_Block(&payload);
+                if (!isIntact ||
+                    !applyRecord_StateJournal_(d, recMagic, (iRangecc){ src.start, src.start + size })) {
+                    break;
+                }
+                src.start += size;
+            }
+        }
+        delete_Block(data);
+    }
+    iRelease(f);
+    return ok;
+}
+
+static iBool sync_(FILE *f) {
+#if defined (iPlatformMsys)
+    return _commit(_fileno(f)) == 0;
+#else
+    return fsync(fileno(f)) == 0;
+#endif
+}
+
+iBool writeFile_StateJournal(const iString *path, const iBlock *data) {
+    /* The file is complete on disk before it replaces the old one. */
+    const iString *tmpPath = collectNewFormat_String("%s.tmp", cstr_String(path));
+    iBool ok = iFalse;
+    FILE *f = fopen(cstr_String(tmpPath), "wb");
+    if (f) {
+        ok = (fwrite(constData_Block(data), 1, size_Block(data), f) == size_Block(data));
+        ok = (fflush(f) == 0) && ok;
+        ok = ok && sync_(f);
+        ok = (fclose(f) == 0) && ok;
+    }
+    if (ok) {
+#if defined (iPlatformMsys)
+        remove(cstr_String(path)); /* rename() does not replace existing files */
+#endif
+        ok = (rename(cstr_String(tmpPath), cstr_String(path)) == 0);
+    }
+    else {
+        remove(cstr_String(tmpPath));
+    }
+    return ok;
+}
+
+static iThreadResult write_StateJournal_(iThread *thread) {
+    iStateJournal *d = userData_Thread(thread);
+    lock_Mutex(d->mtx);
+    for (;;) {
+        while (!d->isStopping && !d->compacted && isEmpty_Block(&d->appendQueue)) {
+            wait_Condition(&d->wakeUp, d->mtx);
+        }
+        if (!d->compacted && isEmpty_Block(&d->appendQueue)) {
+            break; /* stopping, and everything has been written */
+        }
+        iBlock *    compacted = d->compacted;
+        iStringSet *garbage   = d->garbage;
+        iBlock      records;
+        initCopy_Block(&records, &d->appendQueue);
+        d->compacted = NULL;
+        d->garbage   = NULL;
+        clear_Block(&d->appendQueue);
+        /* Writing happens outside the lock so the UI thread is never held up by it. */
+        unlock_Mutex(d->mtx);
+        iBeginCollect();
+        /* Page bodies referred to by the state go to disk first. */
+        writePending_PageCache();
+        if (compacted) {
+            /* The journal header is stored after the state. */
+            const size_t stateSize = size_Block(compacted) - 12;
+            iBlock journal;
+            init_Block(&journal, 0);
+            setData_Block(&journal, constData_Block(compacted) + stateSize, 12);
+            truncate_Block(compacted, stateSize);
+            append_Block(&journal, &records);
+            if (writeFile_StateJournal(&d->statePath, compacted)) {
+                writeFile_StateJournal(&d->journalPath, &journal);
+                /* The old state is gone, so bodies only it referred to can be removed. */
+                collectGarbage_PageCache(garbage);
+            }
+            deinit_Block(&journal);
+            delete_Block(compacted);
+            iRelease(garbage);
+        }
+        else {
+            iFile *f = new_File(&d->journalPath);
+            if (open_File(f, append_FileMode)) {
+                write_File(f, &records);
+            }
+            iRelease(f);
+        }
+        deinit_Block(&records);
+        iEndCollect();
+        lock_Mutex(d->mtx);
+    }
+    unlock_Mutex(d->mtx);
+    return 0;
+}
+
+void init_StateJournal(iStateJournal *d, const char *saveDir) {
+    initCStr_String(&d->statePath, concatPath_CStr(saveDir, stateFileName_StateJournal_));
+    initCStr_String(&d->journalPath, concatPath_CStr(saveDir, journalFileName_StateJournal_));
+    init_PtrArray(&d->tabs);
+    d->currentTab  = 0;
+    d->generation  = 0;
+    d->journalSize = 0;
+    d->isOutdated  = iFalse;
+    init_Block(&d->pending, 0);
+    d->mtx = new_Mutex();
+    init_Condition(&d->wakeUp);
+    d->isStopping = iFalse;
+    init_Block(&d->appendQueue, 0);
+    d->compacted = NULL;
+    d->garbage   = NULL;
+    d->writer = new_Thread(write_StateJournal_);
+    setUserData_Thread(d->writer, d);
+    start_Thread(d->writer);
+}
+
+void deinit_StateJournal(iStateJournal *d) {
+    /* Let the writer finish everything that has been committed. */ {
+        iGuardMutex(d->mtx, {
+            d->isStopping = iTrue;
+            signal_Condition(&d->wakeUp);
+        });
+        join_Thread(d->writer);
+        iRelease(d->writer);
+    }
+    deinit_Block(&d->appendQueue);
+    deinit_Condition(&d->wakeUp);
+    delete_Mutex(d->mtx);
+    deinit_Block(&d->pending);
+    clearTabs_StateJournal_(d);
+    deinit_PtrArray(&d->tabs);
+    deinit_String(&d->journalPath);
+    deinit_String(&d->statePath);
+}
+
+iBool restore_StateJournal(iStateJournal *d, iPtrArray *states_out, size_t *currentTab_out,
+                           uint32_t *version_out) {
+    /* Older state files are not in the journaled format and must be read by the caller. */
+    uint32_t gen = 0, journalVersion;
+    if (!readFile_StateJournal_(d, &d->statePath, magicState_StateJournal_, &gen, version_out)) {
+        clearTabs_StateJournal_(d);
+        return iFalse;
+    }
+    readFile_StateJournal_(d, &d->journalPath, magicJournal_StateJournal_, &gen, &journalVersion);
+    d->generation = gen;
+    /* Records of an older format must not be appended to the journal. */
+    d->isOutdated = (*version_out != latest_FileVersion);
+    *currentTab_out = 0;
+    iConstForEach(PtrArray, i, &d->tabs) {
+        const iJournalTab *tab = i.ptr;
+        if (index_PtrArrayConstIterator(&i) == d->currentTab) {
+            *currentTab_out = size_PtrArray(states_out);
+        }
+        if (!isEmpty_Block(&tab->state)) {
+            pushBack_PtrArray(states_out, copy_Block(&tab->state));
+        }
+    }
+    /* The restored tabs will get new IDs. */
+    clearTabs_StateJournal_(d);
+    return iTrue;
+}
+
+void setTabs_StateJournal(iStateJournal *d, const iStringArray *tabIds, size_t currentTab) {
+    iBool isChanged = (currentTab != d->currentTab ||
+                       size_StringArray(tabIds) != size_PtrArray(&d->tabs));
+    for (size_t i = 0; !isChanged && i < size_StringArray(tabIds); i++) {
+        const iJournalTab *tab = constAt_PtrArray(&d->tabs, i);
+        isChanged = !equal_String(&tab->id, constAt_StringArray(tabIds, i));
+    }
+    iPtrArray ordered;
+    init_PtrArray(&ordered);
+    iConstForEach(StringArray, i, tabIds) {
+        iJournalTab *tab = findTab_StateJournal_(d, i.value);
+        if (tab) {
+            removeOne_PtrArray(&d->tabs, tab);
+        }
+        else {
+            tab = new_JournalTab_(i.value);
+        }
+        pushBack_PtrArray(&ordered, tab);
+    }
+    /* The remaining ones have been closed. */
+    clearTabs_StateJournal_(d);
+    iForEach(PtrArray, j, &ordered) {
+        pushBack_PtrArray(&d->tabs, j.ptr);
+    }
+    deinit_PtrArray(&ordered);
+    d->currentTab = currentTab;
+    if (isChanged) {
+        encodeTabs_StateJournal_(d, &d->pending);
+    }
+}
+
+iBool isModified_StateJournal(const iStateJournal *d, const iString *tabId, uint32_t modCount) {
+    const iJournalTab *tab = findTab_StateJournal_(d, tabId);
+    return tab && (isEmpty_Block(&tab->state) || tab->modCount != modCount);
+}
+
+void update_StateJournal(iStateJournal *d, const iString *tabId, uint32_t modCount,
+                         const iBlock *state) {
+    iJournalTab *tab = findTab_StateJournal_(d, tabId);
+    if (!tab) {
+        return; /* not listed in the tabs */
+    }
+    tab->modCount = modCount;
+    const uint32_t crc = crc32_Block(state);
+    if (crc == tab->crc && size_Block(state) == size_Block(&tab->state)) {
+        return; /* unchanged */
+    }
+    set_Block(&tab->state, state);
+    tab->crc = crc;
+    encodeTab_StateJournal_(tab, &d->pending);
+}
+
+iBool isCompactionDue_StateJournal(const iStateJournal *d) {
+    return d->journalSize > maxJournalSize_StateJournal_ || d->isOutdated;
+}
+
+void commit_StateJournal(iStateJournal *d, iBool compact) {
+    d->journalSize += size_Block(&d->pending);
+    if (compact) {
+        d->isOutdated = iFalse;
+        /* Everything is in the new state file, and the new journal starts out empty. */
+        iBlock *state = new_Block(0);
+        d->generation++;
+        encodeHeader_StateJournal_(d, magicState_StateJournal_, d->generation, state);
+        encodeTabs_StateJournal_(d, state);
+        iConstForEach(PtrArray, i, &d->tabs) {
+            encodeTab_StateJournal_(i.ptr, state);
+        }
+        encodeHeader_StateJournal_(d, magicJournal_StateJournal_, d->generation, state);
+        clear_Block(&d->pending);
+        d->journalSize = 0;
+        /* Every tab was just serialized, so they have all marked the bodies they use. */
+        iStringSet *garbage = takeUnused_PageCache();
+        iGuardMutex(d->mtx, {
+            if (d->compacted) {
+                delete_Block(d->compacted);
+                iRelease(d->garbage); /* the newer set covers these, too */
+            }
+            d->compacted = state;
+            d->garbage   = garbage;
+            clear_Block(&d->appendQueue);
+            signal_Condition(&d->wakeUp);
+        });
+    }
+    else if (!isEmpty_Block(&d->pending)) {
+        iGuardMutex(d->mtx, {
+            append_Block(&d->appendQueue, &d->pending);
+            signal_Condition(&d->wakeUp);
+        });
+        clear_Block(&d->pending);
+    }
+}
@@ -0,0 +1,46 @@
+/* Copyright 2020 Jaakko Keränen <jaakko.keranen@iki.fi>
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+#pragma once
+
+#include <the_Foundation/block.h>
+#include <the_Foundation/ptrarray.h>
+#include <the_Foundation/stringarray.h>
+
+/* Saves the state of open tabs continuously. Changes are appended to a journal file in the
+   background, and the journal is periodically compacted into the state file. Both files are
+   replaced by renaming a complete temporary file, so a crash loses at most the latest
+   changes. */
+
+iDeclareType(StateJournal)
+iDeclareTypeConstructionArgs(StateJournal, const char *saveDir)
+
+iBool   restore_StateJournal    (iStateJournal *, iPtrArray *states_out, size_t *currentTab_out,
+                                 uint32_t *version_out); /* states are iBlock * */
+void    setTabs_StateJournal    (iStateJournal *, const iStringArray *tabIds, size_t currentTab);
+iBool   isModified_StateJournal (const iStateJournal *, const iString *tabId, uint32_t modCount);
+void    update_StateJournal     (iStateJournal *, const iString *tabId, uint32_t modCount,
+                                 const iBlock *state);
+iBool   isCompactionDue_StateJournal(const iStateJournal *);
+void    commit_StateJournal     (iStateJournal *, iBool compact); /* compact: all tabs updated */
+
+iBool   writeFile_StateJournal  (const iString *path, const iBlock *data); /* replaces atomically */
@@ -28,6 +28,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 #include "app.h"
 #include "audio/player.h"
 #include "bookmarks.h"
+#include "cachemanager.h"
 #include "command.h"
 #include "defs.h"
 #include "gmcerts.h"
@@ -40,6 +41,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 #include "keys.h"
 #include "labelwidget.h"
 #include "media.h"
+#include "pagecache.h"
 #include "paint.h"
 #include "playerui.h"
 #include "scrollwidget.h"
@@ -70,11 +72,13 @@ iDeclareTypeSerialization(PersistentDocumentState)
 struct Impl_PersistentDocumentState {
     iHistory *history;
     iString * url;
+    uint32_t  modCount; /* changes not made via the history */
 };
 
 void init_PersistentDocumentState(iPersistentDocumentState *d) {
-    d->history = new_History();
-    d->url     = new_String();
+    d->history  = new_History();
+    d->url      = new_String();
+    d->modCount = 0;
 }
 
 void deinit_PersistentDocumentState(iPersistentDocumentState *d) {
@@ -114,11 +118,16 @@ struct Impl_OutlineItem {
 
 static void animatePlayers_DocumentWidget_      (iDocumentWidget *d);
 static void updateSideIconBuf_DocumentWidget_   (iDocumentWidget *d);
+static void clearPrefetch_DocumentWidget_       (iDocumentWidget *d);
+static const iRecentUrl *pendingRestoreItem_DocumentWidget_(const iDocumentWidget *d);
 
 static const int smoothDuration_DocumentWidget_  = 600; /* milliseconds */
 static const int outlineMinWidth_DocumentWdiget_ = 45;  /* times gap_UI */
 static const int outlineMaxWidth_DocumentWidget_ = 65;  /* times gap_UI */
 static const int outlinePadding_DocumentWidget_  = 3;   /* times gap_UI */
+static const size_t maxPrefetchSize_DocumentWidget_   = 1000000; /* bytes per response */
+static const size_t maxPrefetchBudget_DocumentWidget_ = 4000000; /* bytes in all tabs */
+
 
 enum iRequestState {
     blank_RequestState,
@@ -133,6 +142,8 @@ enum iDocumentWidgetFlag {
     showLinkNumbers_DocumentWidgetFlag       = iBit(3),
     setHoverViaKeys_DocumentWidgetFlag       = iBit(4),
     newTabViaHomeKeys_DocumentWidgetFlag     = iBit(5),
+    pendingRestore_DocumentWidgetFlag        = iBit(6), /* page is shown when tab is activated */
+    historyDocument_DocumentWidgetFlag       = iBit(7), /* document shows the cached response */
 };
 
 enum iDocumentLinkOrdinalMode {
@@ -148,14 +159,18 @@ struct Impl_DocumentWidget {
     enum iDocumentLinkOrdinalMode ordinalMode;
     size_t         ordinalBase;
     iString *      titleUser;
+    iString *      restoredTitle; /* shown until a restored tab's document is laid out */
     iGmRequest *   request;
     iAtomicInt     isRequestUpdated; /* request has new content, need to parse it */
     iObjectList *  media;
+    iObjectList *  prefetch; /* requests for likely next pages */
+    iString        prefetchOrigin; /* page whose links are being prefetched */
     iString        sourceHeader;
     iString        sourceMime;
     iBlock         sourceContent; /* original content as received, for saving */
     iTime          sourceTime;
     iGmDocument *  doc;
+    iCacheEntry *  docMemory; /* source and layout of the current document */
     int            certFlags;
     iBlock *       certFingerprint;
     iDate          certExpiry;
@@ -209,10 +224,14 @@ void init_DocumentWidget(iDocumentWidget *d) {
     d->certSubject      = new_String();
     d->state            = blank_RequestState;
     d->titleUser        = new_String();
+    d->restoredTitle    = new_String();
     d->request          = NULL;
     d->isRequestUpdated = iFalse;
     d->media            = new_ObjectList();
+    d->prefetch         = new_ObjectList();
+    init_String(&d->prefetchOrigin);
     d->doc              = new_GmDocument();
+    d->docMemory        = add_CacheManager(0, normal_CachePriority, NULL, NULL);
     d->redirectCount    = 0;
     d->ordinalBase      = 0;
     d->initNormScrollY  = 0;
@@ -264,6 +283,12 @@ void init_DocumentWidget(iDocumentWidget *d) {
 }
 
 void deinit_DocumentWidget(iDocumentWidget *d) {
+    /* A restored tab may be closed without ever being shown. */ {
+        const iRecentUrl *recent = pendingRestoreItem_DocumentWidget_(d);
+        if (recent) {
+            cancelPreload_PageCache(&recent->cachedBodyKey);
+        }
+    }
     if (d->sideIconBuf) {
         SDL_DestroyTexture(d->sideIconBuf);
     }
@@ -271,6 +296,9 @@ void deinit_DocumentWidget(iDocumentWidget *d) {
     delete_VisBuf(d->visBuf);
     delete_PtrSet(d->invalidRuns);
     deinit_Array(&d->outline);
+    clearPrefetch_DocumentWidget_(d);
+    iRelease(d->prefetch);
+    deinit_String(&d->prefetchOrigin);
     iRelease(d->media);
     iRelease(d->request);
     deinit_String(&d->pendingGotoHeading);
@@ -278,6 +306,7 @@ void deinit_DocumentWidget(iDocumentWidget *d) {
     deinit_String(&d->sourceMime);
     deinit_String(&d->sourceHeader);
     iRelease(d->doc);
+    remove_CacheManager(d->docMemory);
     if (d->playerTimer) {
         SDL_RemoveTimer(d->playerTimer);
     }
@@ -288,6 +317,7 @@ void deinit_DocumentWidget(iDocumentWidget *d) {
     delete_Block(d->certFingerprint);
     delete_String(d->certSubject);
     delete_String(d->titleUser);
+    delete_String(d->restoredTitle);
     deinit_PersistentDocumentState(&d->mod);
 }
 
@@ -311,6 +341,24 @@ static void requestFinished_DocumentWidget_(iAnyObject *obj) {
     postCommand_Widget(obj, "document.request.finished doc:%p request:%p", d, d->request);
 }
 
+static void prefetchUpdated_DocumentWidget_(iAnyObject *obj, iGmRequest *req) {
+    /* Responses that are too large to keep are not downloaded any further. Updates stop
+       coming until they are allowed again, so this is posted only once. */
+    if (bodySize_GmRequest(req) > maxPrefetchSize_DocumentWidget_) {
+        postCommand_Widget(obj, "document.prefetch.cancel doc:%p request:%p", obj, req);
+        return;
+    }
+    allowUpdate_GmRequest(req);
+}
+
+static void prefetchFinished_DocumentWidget_(iAnyObject *obj, iGmRequest *req) {
+    postCommand_Widget(obj, "document.prefetch.finished doc:%p request:%p", obj, req);
+}
+
+static void clearPrefetch_DocumentWidget_(iDocumentWidget *d) {
+    clear_ObjectList(d->prefetch);
+}
+
 static int documentWidth_DocumentWidget_(const iDocumentWidget *d) {
     const iWidget *w      = constAs_Widget(d);
     const iRect    bounds = bounds_Widget(w);
@@ -611,7 +659,11 @@ static void updateVisible_DocumentWidget_(iDocumentWidget *d) {
     /* Remember scroll positions of recently visited pages. */ {
         iRecentUrl *recent = mostRecentUrl_History(d->mod.history);
         if (recent && docSize && d->state == ready_RequestState) {
-            recent->normScrollY = normScrollPos_DocumentWidget_(d);
+            const float normScrollY = normScrollPos_DocumentWidget_(d);
+            if (normScrollY != recent->normScrollY) {
+                recent->normScrollY = normScrollY;
+                d->mod.modCount++;
+            }
         }
     }
 }
@@ -626,6 +678,9 @@ static void updateWindowTitle_DocumentWidget_(const iDocumentWidget *d) {
     if (!isEmpty_String(title_GmDocument(d->doc))) {
         pushBack_StringArray(title, title_GmDocument(d->doc));
     }
+    else if (!isEmpty_String(d->restoredTitle)) {
+        pushBack_StringArray(title, d->restoredTitle);
+    }
     if (!isEmpty_String(d->titleUser)) {
         pushBack_StringArray(title, d->titleUser);
     }
@@ -748,9 +803,14 @@ static void updateOutline_DocumentWidget_(iDocumentWidget *d) {
     }
 }
 
-static void setSource_DocumentWidget_(iDocumentWidget *d, const iString *source) {
-    setUrl_GmDocument(d->doc, d->mod.url);
-    setSource_GmDocument(d->doc, source, documentWidth_DocumentWidget_(d));
+static void updateMemoryUse_DocumentWidget_(iDocumentWidget *d) {
+    /* The shown document cannot be evicted, but it takes space from the cached pages. */
+    resize_CacheManager(d->docMemory,
+                        memorySize_GmDocument(d->doc) + size_Block(&d->sourceContent));
+}
+
+static void documentReplaced_DocumentWidget_(iDocumentWidget *d) {
+    updateMemoryUse_DocumentWidget_(d);
     d->foundMark       = iNullRange;
     d->selectMark      = iNullRange;
     d->hoverLink       = NULL;
@@ -766,6 +826,12 @@ static void setSource_DocumentWidget_(iDocumentWidget *d, const iString *source)
     refresh_Widget(as_Widget(d));
 }
 
+static void setSource_DocumentWidget_(iDocumentWidget *d, const iString *source) {
+    setUrl_GmDocument(d->doc, d->mod.url);
+    setSource_GmDocument(d->doc, source, documentWidth_DocumentWidget_(d));
+    documentReplaced_DocumentWidget_(d);
+}
+
 static void updateTheme_DocumentWidget_(iDocumentWidget *d) {
     if (isEmpty_String(d->titleUser)) {
         setThemeSeed_GmDocument(d->doc,
@@ -777,6 +843,56 @@ static void updateTheme_DocumentWidget_(iDocumentWidget *d) {
     updateTimestampBuf_DocumentWidget_(d);
 }
 
+static uint32_t layoutKey_DocumentWidget_(const iDocumentWidget *d) {
+    /* Everything that affects how a document gets laid out. */
+    const iPrefs *prefs = prefs_App();
+    const int params[] = {
+        documentWidth_DocumentWidget_(d),
+        prefs->font,
+        prefs->headingFont,
+        prefs->zoomPercent,
+        prefs->monospaceGemini,
+        prefs->monospaceGopher,
+        prefs->bigFirstParagraph,
+        prefs->quoteIcon,
+        (int) (prefs->uiScale * 100),
+    };
+    uint32_t key = 2166136261u;
+    iForIndices(i, params) {
+        key = (key ^ (uint32_t) params[i]) * 16777619u;
+    }
+    return key;
+}
+
+static void resetDocument_DocumentWidget_(iDocumentWidget *d) {
+    /* A finished page is handed over to the history so it doesn't need to be laid out again
+       when navigating back to it. */
+    if (d->flags & historyDocument_DocumentWidgetFlag &&
+        isEmpty_Media(constMedia_GmDocument(d->doc)) &&
+        setCachedDocument_History(d->mod.history, d->doc, layoutKey_DocumentWidget_(d))) {
+        iRelease(d->doc);
+        d->doc = new_GmDocument();
+    }
+    d->flags &= ~historyDocument_DocumentWidgetFlag;
+    reset_GmDocument(d->doc);
+}
+
+static void setCachedDocument_DocumentWidget_(iDocumentWidget *d, iGmDocument *doc,
+                                              const iGmResponse *resp) {
+    iRelease(d->doc);
+    d->doc = doc;
+    /* MIME type without parameters, like updateDocument_DocumentWidget_() sets it. */ {
+        iRangecc mime = iNullRange;
+        nextSplit_Rangecc(range_String(collect_String(lower_String(&resp->meta))), ";", &mime);
+        trim_Rangecc(&mime);
+        setRange_String(&d->sourceMime, mime);
+    }
+    if (document_App() == d) {
+        updateTheme_DocumentWidget_(d);
+    }
+    documentReplaced_DocumentWidget_(d);
+}
+
 static enum iGmDocumentBanner bannerType_DocumentWidget_(const iDocumentWidget *d) {
     if (d->certFlags & available_GmCertFlag) {
         const int req = domainVerified_GmCertFlag | timeVerified_GmCertFlag | trusted_GmCertFlag;
@@ -789,6 +905,7 @@ static enum iGmDocumentBanner bannerType_DocumentWidget_(const iDocumentWidget *
 
 static void showErrorPage_DocumentWidget_(iDocumentWidget *d, enum iGmStatusCode code,
                                           const iString *meta) {
+    d->flags &= ~historyDocument_DocumentWidgetFlag;
     iString *src = collectNewCStr_String("# ");
     const iGmError *msg = get_GmError(code);
     appendChar_String(src, msg->icon ? msg->icon : 0x2327); /* X in a box */
@@ -801,6 +918,7 @@ static void showErrorPage_DocumentWidget_(iDocumentWidget *d, enum iGmStatusCode
                 appendFormat_String(src, "\n=> %s\n", cstr_String(meta));
                 break;
             case tlsFailure_GmStatusCode:
+            case timedOut_GmStatusCode:
                 useBanner = iFalse; /* valid data wasn't received from host */
                 appendFormat_String(src, "\n\n>%s\n", cstr_String(meta));
                 break;
@@ -965,17 +1083,140 @@ static void fetch_DocumentWidget_(iDocumentWidget *d) {
     }
     postCommandf_App("document.request.started doc:%p url:%s", d, cstr_String(d->mod.url));
     clear_ObjectList(d->media);
+    clearPrefetch_DocumentWidget_(d);
     d->certFlags = 0;
     d->flags &= ~showLinkNumbers_DocumentWidgetFlag;
     d->state = fetching_RequestState;
     set_Atomic(&d->isRequestUpdated, iFalse);
     d->request = new_GmRequest(certs_App());
     setUrl_GmRequest(d->request, d->mod.url);
+    setPriority_GmRequest(d->request,
+                          document_App() == d ? foreground_GmRequestPriority
+                                              : inline_GmRequestPriority);
     iConnect(GmRequest, d->request, updated, d, requestUpdated_DocumentWidget_);
     iConnect(GmRequest, d->request, finished, d, requestFinished_DocumentWidget_);
     submit_GmRequest(d->request);
 }
 
+static size_t lastNumberPos_(iRangecc range) {
+    for (const char *pos = range.end; pos != range.start; pos--) {
+        if (isdigit((unsigned char) pos[-1])) {
+            while (pos != range.start && isdigit((unsigned char) pos[-1])) {
+                pos--;
+            }
+            return pos - range.start;
+        }
+    }
+    return iInvalidPos;
+}
+
+static iBool isNextInSequence_(iRangecc current, iRangecc next) {
+    /* Same path except for a number that has been incremented by one. */
+    const size_t pos = lastNumberPos_(current);
+    if (pos == iInvalidPos || pos != lastNumberPos_(next) ||
+        strncmp(current.start, next.start, pos)) {
+        return iFalse;
+    }
+    char *curEnd, *nextEnd;
+    const long   curNum  = strtol(current.start + pos, &curEnd, 10);
+    const long   nextNum = strtol(next.start + pos, &nextEnd, 10);
+    const size_t rest    = current.end - curEnd;
+    return nextNum == curNum + 1 && rest == (size_t) (next.end - nextEnd) &&
+           strncmp(curEnd, nextEnd, rest) == 0;
+}
+
+static int prefetchScore_DocumentWidget_(const iDocumentWidget *d, iGmLinkId linkId) {
+    const int flags = linkFlags_GmDocument(d->doc, linkId);
+    if (~flags & gemini_GmLinkFlag ||
+        flags & (remote_GmLinkFlag | visited_GmLinkFlag | imageFileExtension_GmLinkFlag |
+                 audioFileExtension_GmLinkFlag)) {
+        return 0;
+    }
+    const iString *url = linkUrl_GmDocument(d->doc, linkId);
+    if (indexOf_String(url, '?') != iInvalidPos || equalCase_String(url, d->mod.url)) {
+        return 0;
+    }
+    int score = 1;
+    const iRangecc label = linkLabel_GmDocument(d->doc, linkId);
+    if (!isEmpty_Range(&label)) {
+        const iString *text = collectNewRange_String(label);
+        if (indexOfCStrSc_String(text, "next", &iCaseInsensitive) != iInvalidPos ||
+            indexOfCStr_String(text, "\u2192") != iInvalidPos ||
+            indexOfCStr_String(text, "\u00bb") != iInvalidPos) {
+            score += 100;
+        }
+    }
+    iUrl cur, next;
+    init_Url(&cur, d->mod.url);
+    init_Url(&next, url);
+    if (isNextInSequence_(cur.path, next.path)) {
+        score += 50;
+    }
+    const size_t curDir = lastIndexOfCStr_Rangecc(cur.path, "/");
+    if (curDir != iInvalidPos && size_Range(&next.path) > curDir &&
+        strncmp(cur.path.start, next.path.start, curDir + 1) == 0) {
+        score += 10;
+    }
+    return score;
+}
+
+static void prefetchLinks_DocumentWidget_(iDocumentWidget *d) {
+    const int maxPrefetch = prefs_App()->prefetchLinks;
+    clearPrefetch_DocumentWidget_(d);
+    set_String(&d->prefetchOrigin, d->mod.url);
+    if (maxPrefetch <= 0 || !equalCase_Rangecc(urlScheme_String(d->mod.url), "gemini")) {
+        return;
+    }
+    /* Pick the highest scoring links, in document order on ties. */
+    iGmLinkId chosen[10];
+    int       chosenScore[10];
+    size_t    numChosen = 0;
+    const size_t numLinks = numLinks_GmDocument(d->doc);
+    for (iGmLinkId linkId = 1; linkId <= numLinks; linkId++) {
+        const int score = prefetchScore_DocumentWidget_(d, linkId);
+        if (score <= 0) {
+            continue;
+        }
+        size_t pos = numChosen;
+        while (pos > 0 && chosenScore[pos - 1] < score) {
+            pos--;
+        }
+        if (pos >= (size_t) maxPrefetch || pos >= iElemCount(chosen)) {
+            continue;
+        }
+        numChosen = iMin(numChosen + 1, iMin((size_t) maxPrefetch, iElemCount(chosen)));
+        for (size_t i = numChosen - 1; i > pos; i--) {
+            chosen[i]      = chosen[i - 1];
+            chosenScore[i] = chosenScore[i - 1];
+        }
+        chosen[pos]      = linkId;
+        chosenScore[pos] = score;
+    }
+    for (size_t i = 0; i < numChosen; i++) {
+        const iString *url = linkUrl_GmDocument(d->doc, chosen[i]);
+        if (findUrl_History(d->mod.history, url)) {
+            continue; /* already available or navigated away from */
+        }
+        if (identityForUrl_GmCerts(certs_App(), url)) {
+            continue; /* don't present a client certificate without the user asking */
+        }
+        iGmRequest *req = new_GmRequest(certs_App());
+        /* Each prefetch may use up to the maximum size, and that is reserved from the
+           budget shared by all tabs until the request is deleted. */
+        if (!reserveBudget_GmRequest(
+                req, maxPrefetchSize_DocumentWidget_, maxPrefetchBudget_DocumentWidget_)) {
+            iRelease(req);
+            break;
+        }
+        setUrl_GmRequest(req, url);
+        setPriority_GmRequest(req, background_GmRequestPriority);
+        iConnect(GmRequest, req, updated, d, prefetchUpdated_DocumentWidget_);
+        iConnect(GmRequest, req, finished, d, prefetchFinished_DocumentWidget_);
+        pushBack_ObjectList(d->prefetch, iClob(req));
+        submit_GmRequest(req);
+    }
+}
+
 static void updateTrust_DocumentWidget_(iDocumentWidget *d, const iGmResponse *response) {
     if (response) {
         d->certFlags  = response->certFlags;
@@ -1019,11 +1260,13 @@ static void parseUser_DocumentWidget_(iDocumentWidget *d) {
 }
 
 static iBool updateFromHistory_DocumentWidget_(iDocumentWidget *d) {
-    const iRecentUrl *recent = findUrl_History(d->mod.history, d->mod.url);
-    if (recent && recent->cachedResponse) {
+    iRecentUrl *recent = findUrl_History(d->mod.history, d->mod.url);
+    if (recent && loadCachedBody_History(d->mod.history, recent)) {
         const iGmResponse *resp = recent->cachedResponse;
         clear_ObjectList(d->media);
-        reset_GmDocument(d->doc);
+        resetDocument_DocumentWidget_(d);
+        iGmDocument *cachedDoc =
+            takeCachedDocument_History(d->mod.history, recent, layoutKey_DocumentWidget_(d));
         d->state = fetching_RequestState;
         d->initNormScrollY = recent->normScrollY;
         resetWideRuns_DocumentWidget_(d);
@@ -1033,7 +1276,13 @@ static iBool updateFromHistory_DocumentWidget_(iDocumentWidget *d) {
         format_String(&d->sourceHeader, "(cached content)");
         updateTimestampBuf_DocumentWidget_(d);
         set_Block(&d->sourceContent, &resp->body);
-        updateDocument_DocumentWidget_(d, resp, iTrue);
+        if (cachedDoc) {
+            setCachedDocument_DocumentWidget_(d, cachedDoc, resp);
+        }
+        else {
+            updateDocument_DocumentWidget_(d, resp, iTrue);
+        }
+        d->flags |= historyDocument_DocumentWidgetFlag;
         init_Anim(&d->scrollY, d->initNormScrollY * size_GmDocument(d->doc).y);
         d->state = ready_RequestState;
         updateSideOpacity_DocumentWidget_(d, iFalse);
@@ -1205,7 +1454,7 @@ static void checkResponse_DocumentWidget_(iDocumentWidget *d) {
             }
             case categorySuccess_GmStatusCode:
                 init_Anim(&d->scrollY, 0);
-                reset_GmDocument(d->doc); /* new content incoming */
+                resetDocument_DocumentWidget_(d); /* new content incoming */
                 resetWideRuns_DocumentWidget_(d);
                 updateDocument_DocumentWidget_(d, resp, iTrue);
                 break;
@@ -1537,6 +1786,7 @@ static iBool handleCommand_DocumentWidget_(iDocumentWidget *d, const char *cmd)
         /* Alt/Option key may be involved in window size changes. */
         iChangeFlags(d->flags, showLinkNumbers_DocumentWidgetFlag, iFalse);
         setWidth_GmDocument(d->doc, documentWidth_DocumentWidget_(d));
+        updateMemoryUse_DocumentWidget_(d);
         scroll_DocumentWidget_(d, 0);
         if (midLoc) {
             mid = findRunAtLoc_GmDocument(d->doc, midLoc);
@@ -1576,6 +1826,12 @@ static iBool handleCommand_DocumentWidget_(iDocumentWidget *d, const char *cmd)
     else if (equal_Command(cmd, "tabs.changed")) {
         iChangeFlags(d->flags, showLinkNumbers_DocumentWidgetFlag, iFalse);
         if (cmp_String(id_Widget(w), suffixPtr_Command(cmd, "id")) == 0) {
+            if (d->flags & pendingRestore_DocumentWidgetFlag) {
+                /* First time this restored tab is visible. */
+                d->flags &= ~pendingRestore_DocumentWidgetFlag;
+                updateFromHistory_DocumentWidget_(d);
+                clear_String(d->restoredTitle);
+            }
             /* Set palette for our document. */
             updateTheme_DocumentWidget_(d);
             updateTrust_DocumentWidget_(d, NULL);
@@ -1752,8 +2008,12 @@ static iBool handleCommand_DocumentWidget_(iDocumentWidget *d, const char *cmd)
                 startsWithCase_String(meta_GmRequest(d->request), "text/")) {
                 setCachedResponse_History(d->mod.history, lockResponse_GmRequest(d->request));
                 unlockResponse_GmRequest(d->request);
+                if (isSuccess_GmStatusCode(status_GmRequest(d->request))) {
+                    d->flags |= historyDocument_DocumentWidgetFlag;
+                }
             }
         }
+        const iBool isSuccess = isSuccess_GmStatusCode(status_GmRequest(d->request));
         iReleasePtr(&d->request);
         updateVisible_DocumentWidget_(d);
         updateSideIconBuf_DocumentWidget_(d);
@@ -1764,8 +2024,42 @@ static iBool handleCommand_DocumentWidget_(iDocumentWidget *d, const char *cmd)
             scrollToHeading_DocumentWidget_(d, cstr_String(&d->pendingGotoHeading));
             clear_String(&d->pendingGotoHeading);
         }
+        if (isSuccess) {
+            prefetchLinks_DocumentWidget_(d);
+        }
         return iFalse;
     }
+    else if (equalWidget_Command(cmd, w, "document.prefetch.finished")) {
+        iGmRequest *req = pointerLabel_Command(cmd, "request");
+        /* The request may already be deleted so treat the pointer with caution. */
+        iForEach(ObjectList, i, d->prefetch) {
+            if (i.object == req) {
+                const iGmResponse *resp = lockResponse_GmRequest(req);
+                /* Links of a page that is no longer shown aren't worth keeping. */
+                if (isSuccess_GmStatusCode(resp->statusCode) &&
+                    startsWithCase_String(&resp->meta, "text/") &&
+                    size_Block(&resp->body) <= maxPrefetchSize_DocumentWidget_ &&
+                    equal_String(&d->prefetchOrigin, d->mod.url)) {
+                    addPrefetched_History(d->mod.history, url_GmRequest(req), resp);
+                }
+                unlockResponse_GmRequest(req);
+                remove_ObjectListIterator(&i);
+                break;
+            }
+        }
+        return iTrue;
+    }
+    else if (equalWidget_Command(cmd, w, "document.prefetch.cancel")) {
+        iGmRequest *req = pointerLabel_Command(cmd, "request");
+        iForEach(ObjectList, i, d->prefetch) {
+            if (i.object == req) {
+                cancel_GmRequest(req);
+                remove_ObjectListIterator(&i);
+                break;
+            }
+        }
+        return iTrue;
+    }
     else if (equal_Command(cmd, "media.updated") || equal_Command(cmd, "media.finished")) {
         return handleMediaCommand_DocumentWidget_(d, cmd);
     }
@@ -3333,21 +3627,58 @@ const iString *bookmarkTitle_DocumentWidget(const iDocumentWidget *d) {
     return collect_String(joinCStr_StringArray(title, " \u2014 "));
 }
 
+uint32_t modCount_DocumentWidget(const iDocumentWidget *d) {
+    /* Both counters only increase, so the sum changes whenever either one does. */
+    return d->mod.modCount + modCount_History(d->mod.history);
+}
+
+static const iRecentUrl *pendingRestoreItem_DocumentWidget_(const iDocumentWidget *d) {
+    /* The cached body of a restored tab that hasn't been shown yet. */
+    if (d->flags & pendingRestore_DocumentWidgetFlag) {
+        const iRecentUrl *recent = findUrl_History(d->mod.history, d->mod.url);
+        if (recent && recent->cachedResponse && !isEmpty_String(&recent->cachedBodyKey)) {
+            return recent;
+        }
+    }
+    return NULL;
+}
+
 void serializeState_DocumentWidget(const iDocumentWidget *d, iStream *outs) {
     serialize_PersistentDocumentState(&d->mod, outs);
+    /* The title lets a restored tab be labeled before its document is laid out. */
+    serialize_String(d->flags & pendingRestore_DocumentWidgetFlag ? d->restoredTitle
+                                                                   : title_GmDocument(d->doc),
+                     outs);
 }
 
 void deserializeState_DocumentWidget(iDocumentWidget *d, iStream *ins) {
     deserialize_PersistentDocumentState(&d->mod, ins);
+    if (version_Stream(ins) >= addedRestoredTitle_FileVersion) {
+        deserialize_String(d->restoredTitle, ins);
+    }
     parseUser_DocumentWidget_(d);
-    updateFromHistory_DocumentWidget_(d);
+    /* Layout and rendering are deferred until the tab is shown, but the cached body can
+       already be read in the background. */
+    d->flags |= pendingRestore_DocumentWidgetFlag;
+    const iRecentUrl *recent = pendingRestoreItem_DocumentWidget_(d);
+    if (recent) {
+        preload_PageCache(&recent->cachedBodyKey);
+    }
 }
 
 void setUrlFromCache_DocumentWidget(iDocumentWidget *d, const iString *url, iBool isFromCache) {
     d->flags &= ~showLinkNumbers_DocumentWidgetFlag;
     set_String(d->mod.url, urlFragmentStripped_String(url));
+    d->mod.modCount++;
     /* See if there a username in the URL. */
     parseUser_DocumentWidget_(d);
+    if (!isFromCache && usePrefetched_History(d->mod.history, d->mod.url)) {
+        /* The page was loaded ahead of time. */
+        if (updateFromHistory_DocumentWidget_(d)) {
+            prefetchLinks_DocumentWidget_(d);
+        }
+        return;
+    }
     if (!isFromCache || !updateFromHistory_DocumentWidget_(d)) {
         fetch_DocumentWidget_(d);
     }
@@ -3380,6 +3711,7 @@ iBool isRequestOngoing_DocumentWidget(const iDocumentWidget *d) {
 
 void updateSize_DocumentWidget(iDocumentWidget *d) {
     setWidth_GmDocument(d->doc, documentWidth_DocumentWidget_(d));
+    updateMemoryUse_DocumentWidget_(d);
     resetWideRuns_DocumentWidget_(d);
     updateSideIconBuf_DocumentWidget_(d);
     updateOutline_DocumentWidget_(d);
@@ -33,6 +33,7 @@ iDeclareObjectConstruction(DocumentWidget)
 
 void    serializeState_DocumentWidget   (const iDocumentWidget *, iStream *outs);
 void    deserializeState_DocumentWidget (iDocumentWidget *, iStream *ins);
+uint32_t modCount_DocumentWidget        (const iDocumentWidget *); /* changes when the state does */
 
 iDocumentWidget *   duplicate_DocumentWidget        (const iDocumentWidget *);
 iHistory *          history_DocumentWidget          (iDocumentWidget *);
@@ -44,6 +44,7 @@ iDeclareType(LookupJob)
 
 struct Impl_LookupJob {
     iRegExp *term;
+    iString terms; /* words of the term, for the history content index */
     iTime now;
     iObjectList *docs;
     iPtrArray results;
@@ -51,6 +52,7 @@ struct Impl_LookupJob {
 
 static void init_LookupJob(iLookupJob *d) {
     d->term = NULL;
+    init_String(&d->terms);
     initCurrent_Time(&d->now);
     d->docs = NULL;
     init_PtrArray(&d->results);
@@ -63,6 +65,7 @@ static void deinit_LookupJob(iLookupJob *d) {
     deinit_PtrArray(&d->results);
     iRelease(d->docs);
     iRelease(d->term);
+    deinit_String(&d->terms);
 }
 
 iDefineTypeConstruction(LookupJob)
@@ -249,7 +252,6 @@ static void searchFeeds_LookupJob_(iLookupJob *d) {
 
 static void searchVisited_LookupJob_(iLookupJob *d) {
     /* Note: Called in a background thread. */
-    /* TODO: Thread safety! Visited URLs may be deleted while being accessed here. */
     iConstForEach(PtrArray, i, list_Visited(visited_App(), 0)) {
         const iVisitedUrl *vis = i.ptr;
         const float relevance = visitedRelevance_LookupJob_(d, vis);
@@ -270,7 +272,7 @@ static void searchHistory_LookupJob_(iLookupJob *d) {
     size_t index = 0;
     iForEach(ObjectList, i, d->docs) {
         iConstForEach(StringArray, j,
-                      searchContents_History(history_DocumentWidget(i.object), d->term)) {
+                      searchContents_History(history_DocumentWidget(i.object), d->term, &d->terms)) {
             const char *match = cstr_String(j.value);
             const size_t matchLen = argLabel_Command(match, "len");
             iRangecc text;
@@ -341,6 +343,7 @@ static iThreadResult worker_LookupWidget_(iThread *thread) {
             delete_String(pattern);
         }
         const size_t termLen = length_String(&d->pendingTerm); /* characters */
+        set_String(&job->terms, &d->pendingTerm);
         clear_String(&d->pendingTerm);
         job->docs = d->pendingDocs;
         d->pendingDocs = NULL;
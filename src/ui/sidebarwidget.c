@@ -99,6 +99,7 @@ struct Impl_SidebarWidget {
     iWidget *         resizer;
     iWidget *         menu;
     iSidebarItem *    contextItem; /* list item accessed in the context menu */
+    uint32_t          bookmarksGeneration; /* of the listed bookmarks, or zero */
 };
 
 iDefineObjectConstructionArgs(SidebarWidget, (enum iSidebarSide side), side)
@@ -107,27 +108,12 @@ static iBool isResizing_SidebarWidget_(const iSidebarWidget *d) {
     return (flags_Widget(d->resizer) & pressed_WidgetFlag) != 0;
 }
 
-static int cmpTitle_Bookmark_(const iBookmark **a, const iBookmark **b) {
-    const iBookmark *bm1 = *a, *bm2 = *b;
-    if (bm2->sourceId == id_Bookmark(bm1)) {
-        return -1;
-    }
-    if (bm1->sourceId == id_Bookmark(bm2)) {
-        return 1;
-    }
-    if (bm1->sourceId == bm2->sourceId) {
-        return cmpStringCase_String(&bm1->title, &bm2->title);
-    }
-    if (bm1->sourceId) {
-        bm1 = get_Bookmarks(bookmarks_App(), bm1->sourceId);
-    }
-    if (bm2->sourceId) {
-        bm2 = get_Bookmarks(bookmarks_App(), bm2->sourceId);
-    }
-    return cmpStringCase_String(&bm1->title, &bm2->title);
-}
-
 static void updateItems_SidebarWidget_(iSidebarWidget *d) {
+    if (d->mode == bookmarks_SidebarMode &&
+        d->bookmarksGeneration == generation_Bookmarks(bookmarks_App())) {
+        return; /* bookmarks have not changed since they were listed */
+    }
+    d->bookmarksGeneration = 0;
     clear_ListWidget(d->list);
     releaseChildren_Widget(d->blank);
     destroy_Widget(d->menu);
@@ -219,7 +205,27 @@ static void updateItems_SidebarWidget_(iSidebarWidget *d) {
             iRegExp *homeTag = iClob(new_RegExp("\\bhomepage\\b", caseSensitive_RegExpOption));
             iRegExp *subTag  = iClob(new_RegExp("\\bsubscribed\\b", caseSensitive_RegExpOption));
             iRegExp *remoteSourceTag = iClob(new_RegExp("\\bremotesource\\b", caseSensitive_RegExpOption));
-            iConstForEach(PtrArray, i, list_Bookmarks(bookmarks_App(), cmpTitle_Bookmark_, NULL, NULL)) {
+            /* The title view is already sorted. Remote bookmarks go after their source. */
+            iPtrArray *listed = collectNew_PtrArray();
+            iPtrArray *remote = collectNew_PtrArray();
+            iConstForEach(PtrArray, r, sorted_Bookmarks(bookmarks_App(), byTitle_BookmarkSortOrder)) {
+                if (((const iBookmark *) r.ptr)->sourceId) {
+                    pushBack_PtrArray(remote, r.ptr);
+                }
+            }
+            iConstForEach(PtrArray, s, sorted_Bookmarks(bookmarks_App(), byTitle_BookmarkSortOrder)) {
+                const iBookmark *bm = s.ptr;
+                if (bm->sourceId) {
+                    continue;
+                }
+                pushBack_PtrArray(listed, bm);
+                iConstForEach(PtrArray, r, remote) {
+                    if (((const iBookmark *) r.ptr)->sourceId == id_Bookmark(bm)) {
+                        pushBack_PtrArray(listed, r.ptr);
+                    }
+                }
+            }
+            iConstForEach(PtrArray, i, listed) {
                 const iBookmark *bm = i.ptr;
                 iSidebarItem *item = new_SidebarItem();
                 item->id = id_Bookmark(bm);
@@ -245,6 +251,7 @@ static void updateItems_SidebarWidget_(iSidebarWidget *d) {
                 addItem_ListWidget(d->list, item);
                 iRelease(item);
             }
+            d->bookmarksGeneration = generation_Bookmarks(bookmarks_App());
             d->menu = makeMenu_Widget(
                 as_Widget(d),
                 (iMenuItem[]){ { "Open in New Tab", 0, 0, "bookmark.open newtab:1" },
@@ -413,6 +420,7 @@ iBool setMode_SidebarWidget(iSidebarWidget *d, enum iSidebarMode mode) {
         d->modeScroll[d->mode] = scrollPos_ListWidget(d->list); /* saved for later */
     }
     d->mode = mode;
+    d->bookmarksGeneration = 0;
     for (enum iSidebarMode i = 0; i < max_SidebarMode; i++) {
         setFlags_Widget(as_Widget(d->modeButtons[i]), selected_WidgetFlag, i == d->mode);
     }
@@ -464,6 +472,7 @@ void init_SidebarWidget(iSidebarWidget *d, enum iSidebarSide side) {
     iZap(d->modeScroll);
     d->side = side;
     d->mode  = -1;
+    d->bookmarksGeneration = 0;
     d->width = 60 * gap_UI;
     setFlags_Widget(w, fixedWidth_WidgetFlag, iTrue);
     d->maxButtonLabelWidth = 0;
@@ -621,10 +630,7 @@ iBool handleBookmarkEditorCommands_SidebarWidget_(iWidget *editor, const char *c
             const iString *tags  = text_InputWidget(findChild_Widget(editor, "bmed.tags"));
             const iSidebarItem *item = hoverItem_ListWidget(d->list);
             iAssert(item); /* hover item cannot have been changed */
-            iBookmark *bm = get_Bookmarks(bookmarks_App(), item->id);
-            set_String(&bm->title, title);
-            set_String(&bm->url, url);
-            set_String(&bm->tags, tags);
+            update_Bookmarks(bookmarks_App(), item->id, title, url, tags);
             postCommand_App("bookmarks.changed");
         }
         setFlags_Widget(as_Widget(d), disabled_WidgetFlag, iFalse);
@@ -794,15 +800,9 @@ static iBool processEvent_SidebarWidget_(iSidebarWidget *d, const SDL_Event *ev)
             const iSidebarItem *item = d->contextItem;
             if (d->mode == bookmarks_SidebarMode && item) {
                 const char *tag = cstr_String(string_Command(cmd, "tag"));
-                iBookmark *bm = get_Bookmarks(bookmarks_App(), item->id);
-                if (hasTag_Bookmark(bm, tag)) {
-                    removeTag_Bookmark(bm, tag);
-                    if (!iCmpStr(tag, "subscribed")) {
-                        removeEntries_Feeds(item->id);
-                    }
-                }
-                else {
-                    addTag_Bookmark(bm, tag);
+                if (!toggleTag_Bookmarks(bookmarks_App(), item->id, tag) &&
+                    !iCmpStr(tag, "subscribed")) {
+                    removeEntries_Feeds(item->id);
                 }
                 postCommand_App("bookmarks.changed");
             }
@@ -867,7 +867,10 @@ static iBool processEvent_SidebarWidget_(iSidebarWidget *d, const SDL_Event *ev)
                     }
                     if (isCommand_Widget(w, ev, "feed.entry.unsubscribe")) {
                         if (arg_Command(cmd)) {
-                            removeTag_Bookmark(feedBookmark, "subscribed");
+                            if (hasTag_Bookmark(feedBookmark, "subscribed")) {
+                                toggleTag_Bookmarks(
+                                    bookmarks_App(), id_Bookmark(feedBookmark), "subscribed");
+                            }
                             removeEntries_Feeds(id_Bookmark(feedBookmark));
                             updateItems_SidebarWidget_(d);
                         }
@@ -1175,6 +1175,22 @@ iWidget *makePreferences_Widget(void) {
             addChildFlags_Widget(cacheGroup, iClob(new_LabelWidget("MB", NULL)), frameless_WidgetFlag);
         }
         addChildFlags_Widget(values, iClob(cacheGroup), arrangeHorizontal_WidgetFlag | arrangeSize_WidgetFlag);
+        addChild_Widget(headings, iClob(makeHeading_Widget("Prefetch links:")));
+        iWidget *prefetchGroup = new_Widget(); {
+            iInputWidget *prefetch = new_InputWidget(2);
+            setSelectAllOnFocus_InputWidget(prefetch, iTrue);
+            setId_Widget(addChild_Widget(prefetchGroup, iClob(prefetch)), "prefs.prefetch");
+            addChildFlags_Widget(prefetchGroup, iClob(new_LabelWidget("pages", NULL)), frameless_WidgetFlag);
+        }
+        addChildFlags_Widget(values, iClob(prefetchGroup), arrangeHorizontal_WidgetFlag | arrangeSize_WidgetFlag);
+        addChild_Widget(headings, iClob(makeHeading_Widget("Feed requests:")));
+        iWidget *feedGroup = new_Widget(); {
+            iInputWidget *feedRequests = new_InputWidget(2);
+            setSelectAllOnFocus_InputWidget(feedRequests, iTrue);
+            setId_Widget(addChild_Widget(feedGroup, iClob(feedRequests)), "prefs.feedrequests");
+            addChildFlags_Widget(feedGroup, iClob(new_LabelWidget("at once", NULL)), frameless_WidgetFlag);
+        }
+        addChildFlags_Widget(values, iClob(feedGroup), arrangeHorizontal_WidgetFlag | arrangeSize_WidgetFlag);
         addChild_Widget(headings, iClob(makeHeading_Widget("Decode URLs:")));
         addChild_Widget(values, iClob(makeToggle_Widget("prefs.decodeurls")));
         makeTwoColumnHeading_("PROXIES", headings, values);
@@ -1330,11 +1346,7 @@ static iBool handleFeedSettingCommands_(iWidget *dlg, const char *cmd) {
             }
         }
         else {
-            iBookmark *bm = get_Bookmarks(bookmarks_App(), id);
-            if (bm) {
-                set_String(&bm->title, feedTitle);
-                set_String(&bm->tags, tags);
-            }
+            update_Bookmarks(bookmarks_App(), id, feedTitle, NULL, tags);
         }
         postCommand_App("bookmarks.changed");
         destroy_Widget(dlg);
@@ -19,18 +19,35 @@ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
 ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
 (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
 SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
-
 #include "visited.h"
 #include "app.h"
 
+#include <the_Foundation/atomic.h>
 #include <the_Foundation/file.h>
+#include <the_Foundation/fileinfo.h>
 #include <the_Foundation/mutex.h>
 #include <the_Foundation/path.h>
 #include <the_Foundation/ptrarray.h>
 #include <the_Foundation/sortedarray.h>
+#include <the_Foundation/stringset.h>
+
+#include <stdio.h> /* rename(), remove() */
+
+#if !defined (iPlatformMsys)
+#   include <fcntl.h>
+#   include <sys/mman.h>
+#   include <sys/stat.h>
+#   include <unistd.h>
+#   define LAGRANGE_MAPPED_FILES
+#endif
 
 const int maxAge_Visited = 2 * 3600 * 24 * 30; /* two months */
 
+static const char *fileName_Visited_    = "visited.bin";
+static const char *oldFileName_Visited_ = "visited.2.txt";
+static const char *magic_Visited_       = "lgV2";
+static const size_t numBloomBits_Visited_ = 1 << 21; /* a few percent false positives for 300k URLs */
+
 void init_VisitedUrl(iVisitedUrl *d) {
     initCurrent_Time(&d->when);
     init_String(&d->url);
@@ -41,6 +58,8 @@ void deinit_VisitedUrl(iVisitedUrl *d) {
     deinit_String(&d->url);
 }
 
+iDefineTypeConstruction(VisitedUrl)
+
 static int cmpUrl_VisitedUrl_(const void *a, const void *b) {
     return cmpString_String(&((const iVisitedUrl *) a)->url, &((const iVisitedUrl *) b)->url);
 }
@@ -50,52 +69,363 @@ static int cmpNewer_VisitedUrl_(const void *insert, const void *existing) {
            seconds_Time(&((const iVisitedUrl *) existing)->when);
 }
 
+static void deleteVisitedUrl_(void *ptr) {
+    delete_VisitedUrl(ptr);
+}
+
+/*----------------------------------------------------------------------------------------------*/
+
+/* The saved file has a header, records of fixed size sorted by URL, a hash table of the
+   records, and a table of the URL strings. It is used as is from memory, so nothing needs to
+   be parsed when loading. Values are in native byte order. */
+
+iDeclareType(VisitedFileHeader)
+
+struct Impl_VisitedFileHeader {
+    char     magic[4];
+    uint32_t count;
+    uint32_t stringsSize;
+    uint32_t numSlots; /* power of two */
+};
+
+iDeclareType(VisitedRecord)
+
+struct Impl_VisitedRecord {
+    uint32_t when; /* seconds since the epoch */
+    uint32_t hash; /* of the URL */
+    uint32_t urlOffset;
+    uint32_t urlSize;
+    uint16_t flags;
+    uint16_t reserved;
+};
+
+static uint32_t hashUrl_(iRangecc url) {
+    uint32_t hash = 2166136261u; /* FNV-1a */
+    for (const char *ch = url.start; ch != url.end; ch++) {
+        hash = (hash ^ (uint8_t) *ch) * 16777619u;
+    }
+    return hash;
+}
+
+iDeclareType(VisitedStore)
+
+struct Impl_VisitedStore {
+    void *                map;  /* the entire file */
+    size_t                mapSize;
+    iBlock *              data; /* used if the file cannot be mapped */
+    const iVisitedRecord *records;
+    size_t                count;
+    const uint32_t *      slots; /* record index + 1, or zero if empty */
+    size_t                numSlots;
+    const char *          strings;
+    size_t                stringsSize;
+};
+
+static void init_VisitedStore_(iVisitedStore *d) {
+    iZap(*d);
+}
+
+static void close_VisitedStore_(iVisitedStore *d) {
+#if defined (LAGRANGE_MAPPED_FILES)
+    if (d->map) {
+        munmap(d->map, d->mapSize);
+    }
+#endif
+    delete_Block(d->data);
+    init_VisitedStore_(d);
+}
+
+static iBool isValid_VisitedFileHeader_(const iVisitedFileHeader *d, size_t fileSize) {
+    if (memcmp(d->magic, magic_Visited_, 4) || d->numSlots == 0 ||
+        (d->numSlots & (d->numSlots - 1)) || d->count >= d->numSlots) {
+        return iFalse;
+    }
+    /* Check each table in turn; dividing instead of multiplying avoids overflows. */
+    size_t avail = fileSize - sizeof(*d);
+    if (avail / sizeof(iVisitedRecord) < d->count) {
+        return iFalse;
+    }
+    avail -= d->count * sizeof(iVisitedRecord);
+    if (avail / sizeof(uint32_t) < d->numSlots) {
+        return iFalse;
+    }
+    avail -= d->numSlots * sizeof(uint32_t);
+    return avail >= d->stringsSize;
+}
+
+static iBool open_VisitedStore_(iVisitedStore *d, const char *path) {
+    const char *src  = NULL;
+    size_t      size = 0;
+#if defined (LAGRANGE_MAPPED_FILES)
+    const int fd = open(path, O_RDONLY);
+    if (fd >= 0) {
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+            void *map = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (map != MAP_FAILED) {
+                d->map     = map;
+                d->mapSize = (size_t) st.st_size;
+                src        = map;
+                size       = d->mapSize;
+            }
+        }
+        close(fd); /* the mapping stays valid */
+    }
+#endif
+    if (!src) {
+        iFile *f = newCStr_File(path);
+        if (open_File(f, readOnly_FileMode)) {
+            d->data = readAll_File(f);
+            src     = constData_Block(d->data);
+            size    = size_Block(d->data);
+        }
+        iRelease(f);
+    }
+    const iVisitedFileHeader *hdr = (const iVisitedFileHeader *) src;
+    if (!src || size < sizeof(*hdr) || !isValid_VisitedFileHeader_(hdr, size)) {
+        close_VisitedStore_(d);
+        return iFalse;
+    }
+    d->records     = (const iVisitedRecord *) (hdr + 1);
+    d->count       = hdr->count;
+    d->slots       = (const uint32_t *) (d->records + d->count);
+    d->numSlots    = hdr->numSlots;
+    d->strings     = (const char *) (d->slots + d->numSlots);
+    d->stringsSize = hdr->stringsSize;
+    return iTrue;
+}
+
+static iRangecc url_VisitedStore_(const iVisitedStore *d, size_t index) {
+    const iVisitedRecord *rec = &d->records[index];
+    if (rec->urlOffset > d->stringsSize || d->stringsSize - rec->urlOffset < rec->urlSize) {
+        return iNullRange; /* damaged */
+    }
+    const char *start = d->strings + rec->urlOffset;
+    return (iRangecc){ start, start + rec->urlSize };
+}
+
+static int cmpUrl_(iRangecc a, iRangecc b) {
+    /* Same order as cmpString_String(). */
+    const size_t na = size_Range(&a), nb = size_Range(&b);
+    const int    cmp = memcmp(a.start, b.start, iMin(na, nb));
+    if (cmp) {
+        return cmp;
+    }
+    return na < nb ? -1 : na > nb ? 1 : 0;
+}
+
+static size_t find_VisitedStore_(const iVisitedStore *d, iRangecc url, uint32_t hash) {
+    if (!d->numSlots) {
+        return iInvalidPos;
+    }
+    const size_t mask = d->numSlots - 1;
+    for (size_t n = 0, i = hash & mask; n < d->numSlots && d->slots[i]; n++, i = (i + 1) & mask) {
+        const size_t index = d->slots[i] - 1;
+        if (index < d->count && d->records[index].hash == hash &&
+            cmpUrl_(url, url_VisitedStore_(d, index)) == 0) {
+            return index;
+        }
+    }
+    return iInvalidPos;
+}
+
+static iBool isExpired_(const iTime *now, uint32_t when) {
+    return integralSeconds_Time(now) - (long long) when > maxAge_Visited;
+}
+
 /*----------------------------------------------------------------------------------------------*/
 
 struct Impl_Visited {
-    iMutex *mtx;
-    iSortedArray visited;
+    iMutex *      mtx;
+    iVisitedStore stored;  /* as saved; read-only */
+    iSortedArray  visited; /* changes since loading, take precedence over the stored ones */
+    iStringSet *  removed; /* stored URLs that have been removed */
+    iAtomicInt *  bloom;   /* bits set for every known URL; read without locking */
 };
 
 iDefineTypeConstruction(Visited)
 
+static size_t bloomBit_(uint32_t hash, int index) {
+    const uint32_t step = (hash >> 17) | (hash << 15);
+    return (hash + index * step) & (numBloomBits_Visited_ - 1);
+}
+
+static void addBloom_Visited_(iVisited *d, uint32_t hash) {
+    /* Only called while holding the mutex, so the bits are never set concurrently. */
+    for (int i = 0; i < 3; i++) {
+        const size_t bit  = bloomBit_(hash, i);
+        iAtomicInt * word = &d->bloom[bit / 32];
+        const unsigned value = (unsigned) value_Atomic(word);
+        if (~value & (1u << (bit % 32))) {
+            set_Atomic(word, (int) (value | (1u << (bit % 32))));
+        }
+    }
+}
+
+static iBool maybeContains_Visited_(const iVisited *d, uint32_t hash) {
+    /* False positives are possible, for example after removals, but not false negatives. */
+    for (int i = 0; i < 3; i++) {
+        const size_t bit = bloomBit_(hash, i);
+        if (~(unsigned) value_Atomic(&d->bloom[bit / 32]) & (1u << (bit % 32))) {
+            return iFalse;
+        }
+    }
+    return iTrue;
+}
+
+static void clearBloom_Visited_(iVisited *d) {
+    for (size_t i = 0; i < numBloomBits_Visited_ / 32; i++) {
+        set_Atomic(&d->bloom[i], 0);
+    }
+}
+
 void init_Visited(iVisited *d) {
     d->mtx = new_Mutex();
+    d->bloom = calloc(numBloomBits_Visited_ / 32, sizeof(iAtomicInt));
+    init_VisitedStore_(&d->stored);
     init_SortedArray(&d->visited, sizeof(iVisitedUrl), cmpUrl_VisitedUrl_);
+    d->removed = new_StringSet();
 }
 
 void deinit_Visited(iVisited *d) {
     iGuardMutex(d->mtx, {
         clear_Visited(d);
         deinit_SortedArray(&d->visited);
+        iRelease(d->removed);
     });
+    free(d->bloom);
     delete_Mutex(d->mtx);
 }
 
-void save_Visited(const iVisited *d, const char *dirPath) {
-    iString *line = new_String();
-    iFile *f = newCStr_File(concatPath_CStr(dirPath, "visited.2.txt"));
-    if (open_File(f, writeOnly_FileMode | text_FileMode)) {
-        lock_Mutex(d->mtx);
-        iConstForEach(Array, i, &d->visited.values) {
-            const iVisitedUrl *item = i.value;
-            format_String(line,
-                          "%llu %04x %s\n",
-                          (unsigned long long) integralSeconds_Time(&item->when),
-                          item->flags,
-                          cstr_String(&item->url));
-            writeData_File(f, cstr_String(line), size_String(line));
+static iBool isRemoved_Visited_(const iVisited *d, iRangecc url) {
+    if (size_StringSet(d->removed) == 0) {
+        return iFalse;
+    }
+    iString str;
+    initRange_String(&str, url);
+    const iBool isRemoved = contains_StringSet(d->removed, &str);
+    deinit_String(&str);
+    return isRemoved;
+}
+
+static void appendRecord_(iBlock *records, iBlock *strings, iRangecc url, uint32_t hash,
+                          uint32_t when, uint16_t flags) {
+    const iVisitedRecord rec = { .when      = when,
+                                 .hash      = hash,
+                                 .urlOffset = (uint32_t) size_Block(strings),
+                                 .urlSize   = (uint32_t) size_Range(&url),
+                                 .flags     = flags };
+    appendData_Block(records, &rec, sizeof(rec));
+    appendData_Block(strings, url.start, size_Range(&url));
+    appendData_Block(strings, "", 1); /* NUL-terminated for convenience */
+}
+
+void save_Visited(iVisited *d, const char *dirPath) {
+    lock_Mutex(d->mtx);
+    if (d->stored.records && size_SortedArray(&d->visited) == 0 &&
+        size_StringSet(d->removed) == 0) {
+        unlock_Mutex(d->mtx); /* nothing has changed */
+        return;
+    }
+    /* Merge the new visits with the stored ones. Both are already sorted. */
+    iTime now;
+    initCurrent_Time(&now);
+    iBlock records, strings;
+    init_Block(&records, 0);
+    init_Block(&strings, 0);
+    const size_t numNew = size_SortedArray(&d->visited);
+    size_t       s      = 0;
+    size_t       n      = 0;
+    while (s < d->stored.count || n < numNew) {
+        const iVisitedUrl *vis = n < numNew ? constAt_SortedArray(&d->visited, n) : NULL;
+        const iRangecc storedUrl =
+            s < d->stored.count ? url_VisitedStore_(&d->stored, s) : iNullRange;
+        const int cmp = !vis               ? -1
+                        : !storedUrl.start ? 1
+                                           : cmpUrl_(storedUrl, range_String(&vis->url));
+        if (cmp < 0) {
+            const iVisitedRecord *rec = &d->stored.records[s++];
+            if (storedUrl.start && !isExpired_(&now, rec->when) &&
+                !isRemoved_Visited_(d, storedUrl)) {
+                appendRecord_(&records, &strings, storedUrl, rec->hash, rec->when, rec->flags);
+            }
+            continue;
+        }
+        if (cmp == 0) {
+            s++; /* superseded by the new visit */
         }
-        unlock_Mutex(d->mtx);
+        n++;
+        const uint32_t when = (uint32_t) integralSeconds_Time(&vis->when);
+        if (!isExpired_(&now, when)) {
+            appendRecord_(&records,
+                          &strings,
+                          range_String(&vis->url),
+                          hashUrl_(range_String(&vis->url)),
+                          when,
+                          vis->flags);
+        }
+    }
+    iVisitedFileHeader hdr = { .count       = size_Block(&records) / sizeof(iVisitedRecord),
+                               .stringsSize = size_Block(&strings),
+                               .numSlots    = 16 };
+    memcpy(hdr.magic, magic_Visited_, 4);
+    /* Hash table of the records, at most half full. */
+    while (hdr.numSlots < 2 * hdr.count) {
+        hdr.numSlots *= 2;
+    }
+    iBlock slots;
+    init_Block(&slots, hdr.numSlots * sizeof(uint32_t));
+    fill_Block(&slots, 0);
+    uint32_t *slot = data_Block(&slots);
+    for (uint32_t i = 0; i < hdr.count; i++) {
+        const iVisitedRecord *rec = (const iVisitedRecord *) constData_Block(&records) + i;
+        size_t pos = rec->hash & (hdr.numSlots - 1);
+        while (slot[pos]) {
+            pos = (pos + 1) & (hdr.numSlots - 1);
+        }
+        slot[pos] = i + 1;
+    }
+    /* The old file remains mapped, so the new one is written separately and then renamed. */
+    const char *path    = concatPath_CStr(dirPath, fileName_Visited_);
+    const char *tmpPath = format_CStr("%s.tmp", path);
+    iBool ok = iFalse;
+    iFile *f = newCStr_File(tmpPath);
+    if (open_File(f, writeOnly_FileMode)) {
+        writeData_File(f, &hdr, sizeof(hdr));
+        write_File(f, &records);
+        write_File(f, &slots);
+        ok = (write_File(f, &strings) == size_Block(&strings));
+        close_File(f);
     }
     iRelease(f);
-    delete_String(line);
+    if (ok) {
+#if defined (iPlatformMsys)
+        remove(path); /* rename() does not replace existing files */
+#endif
+        ok = (rename(tmpPath, path) == 0);
+    }
+    iVisitedStore saved;
+    init_VisitedStore_(&saved);
+    if (ok && open_VisitedStore_(&saved, path)) {
+        /* Everything is now in the stored visits. */
+        close_VisitedStore_(&d->stored);
+        d->stored = saved;
+        iForEach(Array, v, &d->visited.values) {
+            deinit_VisitedUrl(v.value);
+        }
+        clear_SortedArray(&d->visited);
+        iRelease(d->removed);
+        d->removed = new_StringSet();
+    }
+    unlock_Mutex(d->mtx);
+    deinit_Block(&slots);
+    deinit_Block(&strings);
+    deinit_Block(&records);
 }
 
-void load_Visited(iVisited *d, const char *dirPath) {
-    iFile *f = newCStr_File(concatPath_CStr(dirPath, "visited.2.txt"));
+static void loadOld_Visited_(iVisited *d, const char *path) {
+    iFile *f = newCStr_File(path);
     if (open_File(f, readOnly_FileMode | text_FileMode)) {
-        lock_Mutex(d->mtx);
         const iRangecc src  = range_Block(collect_Block(readAll_File(f)));
         iRangecc       line = iNullRange;
         iTime          now;
@@ -114,19 +444,52 @@ void load_Visited(iVisited *d, const char *dirPath) {
             }
             item.flags = flags;
             initRange_String(&item.url, (iRangecc){ urlStart, line.end });
-            insert_SortedArray(&d->visited, &item);
+            pushBack_Array(&d->visited.values, &item);
+        }
+        /* Sorting once is much faster than inserting each item in order. */
+        sort_Array(&d->visited.values, cmpUrl_VisitedUrl_);
+        for (size_t i = 1; i < size_Array(&d->visited.values); ) {
+            iVisitedUrl *prev = at_Array(&d->visited.values, i - 1);
+            iVisitedUrl *item = at_Array(&d->visited.values, i);
+            if (equal_String(&prev->url, &item->url)) {
+                if (cmpNewer_VisitedUrl_(item, prev)) {
+                    prev->when  = item->when;
+                    prev->flags = item->flags;
+                }
+                deinit_VisitedUrl(item);
+                remove_Array(&d->visited.values, i);
+                continue;
+            }
+            i++;
         }
-        unlock_Mutex(d->mtx);
     }
     iRelease(f);
 }
 
+void load_Visited(iVisited *d, const char *dirPath) {
+    lock_Mutex(d->mtx);
+    if (!open_VisitedStore_(&d->stored, concatPath_CStr(dirPath, fileName_Visited_))) {
+        loadOld_Visited_(d, concatPath_CStr(dirPath, oldFileName_Visited_));
+    }
+    for (size_t i = 0; i < d->stored.count; i++) {
+        addBloom_Visited_(d, d->stored.records[i].hash);
+    }
+    iConstForEach(Array, v, &d->visited.values) {
+        addBloom_Visited_(d, hashUrl_(range_String(&((const iVisitedUrl *) v.value)->url)));
+    }
+    unlock_Mutex(d->mtx);
+}
+
 void clear_Visited(iVisited *d) {
     lock_Mutex(d->mtx);
     iForEach(Array, v, &d->visited.values) {
         deinit_VisitedUrl(v.value);
     }
     clear_SortedArray(&d->visited);
+    close_VisitedStore_(&d->stored);
+    iRelease(d->removed);
+    d->removed = new_StringSet();
+    clearBloom_Visited_(d);
     unlock_Mutex(d->mtx);
 }
 
@@ -150,6 +513,7 @@ void visitUrl_Visited(iVisited *d, const iString *url, uint16_t visitFlags) {
     set_String(&visit.url, url);
     size_t pos;
     lock_Mutex(d->mtx);
+    addBloom_Visited_(d, hashUrl_(range_String(url)));
     if (locate_SortedArray(&d->visited, &visit, &pos)) {
         iVisitedUrl *old = at_SortedArray(&d->visited, pos);
         if (cmpNewer_VisitedUrl_(&visit, old)) {
@@ -174,6 +538,10 @@ void removeUrl_Visited(iVisited *d, const iString *url) {
                 remove_Array(&d->visited.values, pos);
             }
         }
+        if (find_VisitedStore_(&d->stored, range_String(url), hashUrl_(range_String(url))) !=
+            iInvalidPos) {
+            insert_StringSet(d->removed, url);
+        }
     });
 }
 
@@ -181,11 +549,24 @@ iTime urlVisitTime_Visited(const iVisited *d, const iString *url) {
     iVisitedUrl item;
     size_t pos;
     iZap(item);
+    const uint32_t hash = hashUrl_(range_String(url));
+    if (!maybeContains_Visited_(d, hash)) {
+        return item.when; /* not visited */
+    }
     initCopy_String(&item.url, url);
     lock_Mutex(d->mtx);
     if (locate_SortedArray(&d->visited, &item, &pos)) {
         item.when = ((const iVisitedUrl *) constAt_SortedArray(&d->visited, pos))->when;
     }
+    else if ((pos = find_VisitedStore_(&d->stored, range_String(url), hash)) != iInvalidPos &&
+             !isRemoved_Visited_(d, range_String(url))) {
+        const uint32_t when = d->stored.records[pos].when;
+        iTime now;
+        initCurrent_Time(&now);
+        if (!isExpired_(&now, when)) {
+            item.when.ts = (struct timespec){ .tv_sec = when };
+        }
+    }
     unlock_Mutex(d->mtx);
     deinit_String(&item.url);
     return item.when;
@@ -196,24 +577,70 @@ iBool containsUrl_Visited(const iVisited *d, const iString *url) {
     return isValid_Time(&time);
 }
 
-static int cmpWhenDescending_VisitedUrlPtr_(const void *a, const void *b) {
-    const iVisitedUrl *s = *(const void **) a, *t = *(const void **) b;
-    return -cmp_Time(&s->when, &t->when);
+iDeclareType(ListedVisit)
+
+struct Impl_ListedVisit {
+    iTime              when;
+    const iVisitedUrl *visit;  /* new visit */
+    size_t             stored; /* index of a stored visit */
+};
+
+static int cmpWhenDescending_ListedVisit_(const void *a, const void *b) {
+    return -cmp_Time(&((const iListedVisit *) a)->when, &((const iListedVisit *) b)->when);
 }
 
 const iArray *list_Visited(const iVisited *d, size_t count) {
+    /* The items are copies, so they remain valid even if the visited URLs change. */
     iPtrArray *urls = collectNew_PtrArray();
-    iGuardMutex(d->mtx, {
-        iConstForEach(Array, i, &d->visited.values) {
-            const iVisitedUrl *vis = i.value;
-            if (~vis->flags & transient_VisitedUrlFlag) {
-                pushBack_PtrArray(urls, vis);
-            }
+    iArray listed;
+    init_Array(&listed, sizeof(iListedVisit));
+    iTime now;
+    initCurrent_Time(&now);
+    lock_Mutex(d->mtx);
+    iConstForEach(Array, i, &d->visited.values) {
+        const iVisitedUrl *vis = i.value;
+        if (~vis->flags & transient_VisitedUrlFlag) {
+            pushBack_Array(&listed, &(iListedVisit){ vis->when, vis, iInvalidPos });
         }
-    });
-    sort_Array(urls, cmpWhenDescending_VisitedUrlPtr_);
-    if (count > 0 && size_Array(urls) > count) {
-        resize_Array(urls, count);
     }
+    for (size_t s = 0; s < d->stored.count; s++) {
+        const iVisitedRecord *rec = &d->stored.records[s];
+        if (rec->flags & transient_VisitedUrlFlag || isExpired_(&now, rec->when)) {
+            continue;
+        }
+        const iRangecc url = url_VisitedStore_(&d->stored, s);
+        if (!url.start || isRemoved_Visited_(d, url)) {
+            continue;
+        }
+        iVisitedUrl key = { .url = { iBlockLiteral(url.start, size_Range(&url), size_Range(&url)) } };
+        size_t pos;
+        if (locate_SortedArray(&d->visited, &key, &pos)) {
+            continue; /* visited again */
+        }
+        iListedVisit item = { .visit = NULL, .stored = s };
+        item.when.ts = (struct timespec){ .tv_sec = rec->when };
+        pushBack_Array(&listed, &item);
+    }
+    sort_Array(&listed, cmpWhenDescending_ListedVisit_);
+    if (count > 0 && size_Array(&listed) > count) {
+        resize_Array(&listed, count);
+    }
+    iConstForEach(Array, j, &listed) {
+        const iListedVisit *item = j.value;
+        iVisitedUrl *copy = new_VisitedUrl();
+        copy->when = item->when;
+        if (item->visit) {
+            set_String(&copy->url, &item->visit->url);
+            copy->flags = item->visit->flags;
+        }
+        else {
+            setRange_String(&copy->url, url_VisitedStore_(&d->stored, item->stored));
+            copy->flags = d->stored.records[item->stored].flags;
+        }
+        pushBack_PtrArray(urls, copy);
+        collect_Garbage(copy, deleteVisitedUrl_);
+    }
+    unlock_Mutex(d->mtx);
+    deinit_Array(&listed);
     return urls;
 }
@@ -48,7 +48,7 @@ iDeclareTypeConstruction(Visited)
 
 void    clear_Visited           (iVisited *);
 void    load_Visited            (iVisited *, const char *dirPath);
-void    save_Visited            (const iVisited *, const char *dirPath);
+void    save_Visited            (iVisited *, const char *dirPath); /* merges new visits */
 
 iTime   urlVisitTime_Visited    (const iVisited *, const iString *url);
 void    visitUrl_Visited        (iVisited *, const iString *url, uint16_t visitFlags); /* adds URL to the visited URLs set */